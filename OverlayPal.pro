@@ -6,6 +6,8 @@ CONFIG += c++17
 
 # enable this to have a sane debugging experience.
 OVERLAYPAL_FEATURES += copy_cmpl
+# enable this to link CBC in-process and solve without running CMPL (requires CBC development libraries)
+#OVERLAYPAL_FEATURES += link_cbc
 
 QML_IMPORT_NAME = nes.overlay.optimiser
 QML_IMPORT_MAJOR_VERSION = 1
@@ -26,11 +28,26 @@ SOURCES += \
     src/cpp/HardwareColorsModel.cpp \
     src/cpp/OverlayPalApp.cpp \
     src/cpp/Sprite.cpp \
+    src/cpp/Palette.cpp \
     src/cpp/main.cpp \
     src/cpp/GridLayer.cpp \
+    src/cpp/ShiftedGridLayers.cpp \
     src/cpp/ImageUtils.cpp \
     src/cpp/OverlayPalGuiBackend.cpp \
     src/cpp/OverlayOptimiser.cpp \
+    src/cpp/SolverBackend.cpp \
+    src/cpp/CmplSolverBackend.cpp \
+    src/cpp/CbcSolverBackend.cpp \
+    src/cpp/CbcLpSolverBackend.cpp \
+    src/cpp/PortfolioSolverBackend.cpp \
+    src/cpp/BranchAndBoundSolverBackend.cpp \
+    src/cpp/MipModel.cpp \
+    src/cpp/PaletteCoverModel.cpp \
+    src/cpp/Presolve.cpp \
+    src/cpp/HeuristicSolver.cpp \
+    src/cpp/PassBounds.cpp \
+    src/cpp/SolutionCache.cpp \
+    src/cpp/MappedFile.cpp \
     src/cpp/SubProcess.cpp \
     src/cpp/SimplePaletteModel.cpp
 
@@ -50,16 +67,44 @@ else: unix:!android: target.path = /opt/$${TARGET}/bin
 HEADERS += \
     src/cpp/Export.h \
     src/cpp/GridLayer.h \
+    src/cpp/ColorMask.h \
+    src/cpp/ShiftedGridLayers.h \
     src/cpp/Array2D.h \
+    src/cpp/Array2DView.h \
     src/cpp/HardwareColorsModel.h \
     src/cpp/ImageUtils.h \
     src/cpp/OverlayPalApp.h \
     src/cpp/OverlayPalGuiBackend.h \
     src/cpp/OverlayOptimiser.h \
+    src/cpp/SolverBackend.h \
+    src/cpp/CmplSolverBackend.h \
+    src/cpp/CbcSolverBackend.h \
+    src/cpp/CbcLpSolverBackend.h \
+    src/cpp/PortfolioSolverBackend.h \
+    src/cpp/BranchAndBoundSolverBackend.h \
+    src/cpp/MipModel.h \
+    src/cpp/PaletteCoverModel.h \
+    src/cpp/Presolve.h \
+    src/cpp/HeuristicSolver.h \
+    src/cpp/PassBounds.h \
+    src/cpp/SolutionCache.h \
+    src/cpp/MappedFile.h \
     src/cpp/Sprite.h \
+    src/cpp/Palette.h \
     src/cpp/SubProcess.h \
     src/cpp/SimplePaletteModel.h
 
+contains(OVERLAYPAL_FEATURES, link_cbc) {
+    DEFINES += OVERLAYPAL_LINK_CBC
+    unix {
+        CONFIG += link_pkgconfig
+        PKGCONFIG += cbc
+    }
+    win32 {
+        LIBS += -lCbcSolver -lCbc -lCgl -lOsiClp -lClp -lOsi -lCoinUtils
+    }
+}
+
 macx {
     # copy nes palette to $app/Contents/MacOS/nespalettes
     NES_PALETTE_FILES.files = $$files($$PWD/nespalettes/*.pal)
@@ -23,79 +23,127 @@
 #include <cstdint>
 #include <cassert>
 #include <cstring>
+#include <memory>
+#include <memory_resource>
+#include <algorithm>
+#include <type_traits>
 
 //
 // Simple class for representing a 2d array
 //
+// Elements are stored row by row in one cache-line aligned allocation from a memory resource.
+// As with std::pmr containers, copies use the default resource and assignment keeps the resource of the target.
+//
 template<typename T>
 class Array2D
 {
 public:
+    static constexpr size_t Alignment = 64;
+
     Array2D():
         mWidth(0),
         mHeight(0),
-        mData(nullptr)
+        mData(nullptr),
+        mResource(std::pmr::get_default_resource())
     {
     }
 
-    Array2D(int width, int height, T initValue = T()):
+    explicit Array2D(std::pmr::memory_resource* resource):
+        mWidth(0),
+        mHeight(0),
+        mData(nullptr),
+        mResource(resource)
+    {
+    }
+
+    Array2D(int width, int height, T initValue = T(), std::pmr::memory_resource* resource = std::pmr::get_default_resource()):
         mWidth(width),
         mHeight(height),
-        mData(nullptr)
+        mData(nullptr),
+        mResource(resource)
     {
         if(mWidth > 0 && mHeight > 0)
         {
-            mData = new T[mWidth * mHeight];
-            for(size_t y = 0; y < mHeight; y++)
-            {
-                for(size_t x = 0; x < mWidth; x++)
-                {
-                    (*this)(x, y) = initValue;
-                }
-            }
+            mData = allocate(size());
+            std::uninitialized_fill_n(mData, size(), initValue);
         }
     }
 
     Array2D(const Array2D& other):
+        Array2D(other, std::pmr::get_default_resource())
+    {
+    }
+
+    Array2D(const Array2D& other, std::pmr::memory_resource* resource):
         mWidth(other.width()),
         mHeight(other.height()),
-        mData(nullptr)
+        mData(nullptr),
+        mResource(resource)
     {
         if(mWidth > 0 && mHeight > 0)
         {
-            mData = new T[mWidth * mHeight];
+            mData = allocate(size());
+            initialiseFromOther(other);
         }
-        initialiseFromOther(other);
+    }
+
+    Array2D(Array2D&& other) noexcept:
+        mWidth(other.mWidth),
+        mHeight(other.mHeight),
+        mData(other.mData),
+        mResource(other.mResource)
+    {
+        other.mWidth = 0;
+        other.mHeight = 0;
+        other.mData = nullptr;
     }
 
     Array2D& operator=(const Array2D& other)
     {
-        if(mData != nullptr)
+        if(this == &other)
+            return *this;
+        // Reuse the allocation when the size is unchanged
+        if(mData != nullptr && mWidth == other.width() && mHeight == other.height())
         {
-            delete[] mData;
-            mData = nullptr;
-            mWidth = 0;
-            mHeight = 0;
+            copyFromOther(other);
+            return *this;
         }
+        release();
         mWidth = other.width();
         mHeight = other.height();
         if(mWidth > 0 && mHeight > 0)
         {
-            mData = new T[mWidth * mHeight];
+            mData = allocate(size());
+            initialiseFromOther(other);
         }
-        initialiseFromOther(other);
         return *this;
     }
 
-    virtual ~Array2D()
+    Array2D& operator=(Array2D&& other)
     {
-        if(mData != nullptr)
-        {
-            delete[] mData;
-            mData = nullptr;
-            mWidth = 0;
-            mHeight = 0;
-        }
+        if(this == &other)
+            return *this;
+        // Storage from another resource can not be taken over, so it is copied instead
+        if(*mResource != *other.mResource)
+            return *this = static_cast<const Array2D&>(other);
+        release();
+        mWidth = other.mWidth;
+        mHeight = other.mHeight;
+        mData = other.mData;
+        other.mWidth = 0;
+        other.mHeight = 0;
+        other.mData = nullptr;
+        return *this;
+    }
+
+    ~Array2D()
+    {
+        release();
+    }
+
+    std::pmr::memory_resource* resource() const
+    {
+        return mResource;
     }
 
     size_t width() const
@@ -134,6 +182,21 @@ public:
         return mData[mWidth * y + x];
     }
 
+    //
+    // Contiguous elements of row y
+    //
+    T* row(size_t y)
+    {
+        assert(y < mHeight);
+        return mData + mWidth * y;
+    }
+
+    const T* row(size_t y) const
+    {
+        assert(y < mHeight);
+        return mData + mWidth * y;
+    }
+
     bool empty(T emptyValue = T()) const
     {
         if(mWidth > 0 && mHeight > 0)
@@ -165,16 +228,55 @@ public:
 
 protected:
 
+    size_t size() const
+    {
+        return mWidth * mHeight;
+    }
+
+    T* allocate(size_t numElements)
+    {
+        return static_cast<T*>(mResource->allocate(numElements * sizeof(T), Alignment));
+    }
+
+    void release()
+    {
+        if(mData != nullptr)
+        {
+            std::destroy_n(mData, size());
+            mResource->deallocate(mData, size() * sizeof(T), Alignment);
+            mData = nullptr;
+        }
+        mWidth = 0;
+        mHeight = 0;
+    }
+
+    // Construct the elements of freshly allocated storage from other
     void initialiseFromOther(const Array2D& other)
     {
         assert(mWidth == other.width());
         assert(mHeight == other.height());
-        for(int y = 0; y < mHeight; y++)
+        if constexpr(std::is_trivially_copyable<T>::value)
         {
-            for(int x = 0; x < mWidth; x++)
-            {
-                mData[mWidth * y + x] = other.mData[mWidth * y + x];
-            }
+            std::memcpy(mData, other.mData, size() * sizeof(T));
+        }
+        else
+        {
+            std::uninitialized_copy_n(other.mData, size(), mData);
+        }
+    }
+
+    // Assign the elements of other over already constructed elements
+    void copyFromOther(const Array2D& other)
+    {
+        assert(mWidth == other.width());
+        assert(mHeight == other.height());
+        if constexpr(std::is_trivially_copyable<T>::value)
+        {
+            std::memcpy(mData, other.mData, size() * sizeof(T));
+        }
+        else
+        {
+            std::copy_n(other.mData, size(), mData);
         }
     }
 
@@ -182,6 +284,7 @@ private:
     size_t mWidth;
     size_t mHeight;
     T* mData;
+    std::pmr::memory_resource* mResource;
 };
 
 // Specialization for indexed color images
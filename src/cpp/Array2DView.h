@@ -0,0 +1,142 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+#ifndef ARRAY_2D_VIEW_H
+#define ARRAY_2D_VIEW_H
+
+#include <cstddef>
+#include <cassert>
+#include <type_traits>
+
+#include "Array2D.h"
+
+//
+// Non-owning view of a rectangle within an Array2D, for reading (or writing) sprites, cells and tiles in place.
+// T is const for read-only views. The viewed array must outlive the view and keep its size.
+//
+template<typename T>
+class Array2DView
+{
+public:
+    using Element = std::remove_const_t<T>;
+
+    Array2DView():
+        mData(nullptr),
+        mWidth(0),
+        mHeight(0),
+        mStride(0)
+    {
+    }
+
+    Array2DView(T* data, size_t width, size_t height, size_t stride):
+        mData(data),
+        mWidth(width),
+        mHeight(height),
+        mStride(stride)
+    {
+        assert(width <= stride || height <= 1);
+    }
+
+    Array2DView(Array2D<Element>& array):
+        Array2DView(array, 0, 0, array.width(), array.height())
+    {
+    }
+
+    Array2DView(const Array2D<Element>& array):
+        Array2DView(array, 0, 0, array.width(), array.height())
+    {
+    }
+
+    Array2DView(Array2D<Element>& array, size_t x, size_t y, size_t width, size_t height):
+        Array2DView(width > 0 && height > 0 ? &array(x, y) : nullptr, width, height, array.width())
+    {
+        assert(x + width <= array.width() && y + height <= array.height());
+    }
+
+    Array2DView(const Array2D<Element>& array, size_t x, size_t y, size_t width, size_t height):
+        Array2DView(width > 0 && height > 0 ? &array(x, y) : nullptr, width, height, array.width())
+    {
+        assert(x + width <= array.width() && y + height <= array.height());
+    }
+
+    // Writable views convert to read-only ones
+    operator Array2DView<const Element>() const
+    {
+        return Array2DView<const Element>(mData, mWidth, mHeight, mStride);
+    }
+
+    size_t width() const
+    {
+        return mWidth;
+    }
+
+    size_t height() const
+    {
+        return mHeight;
+    }
+
+    size_t stride() const
+    {
+        return mStride;
+    }
+
+    T& operator()(size_t x, size_t y) const
+    {
+        assert(x < mWidth);
+        assert(y < mHeight);
+        return mData[mStride * y + x];
+    }
+
+    T* row(size_t y) const
+    {
+        assert(y < mHeight);
+        return mData + mStride * y;
+    }
+
+    //
+    // View of a rectangle within this view
+    //
+    Array2DView subView(size_t x, size_t y, size_t width, size_t height) const
+    {
+        assert(x + width <= mWidth && y + height <= mHeight);
+        return Array2DView(width > 0 && height > 0 ? row(y) + x : nullptr, width, height, mStride);
+    }
+
+    //
+    // Copy the viewed elements into a new array
+    //
+    Array2D<Element> copy() const
+    {
+        Array2D<Element> array(mWidth, mHeight);
+        for(size_t y = 0; y < mHeight; y++)
+        {
+            std::copy_n(row(y), mWidth, array.row(y));
+        }
+        return array;
+    }
+
+private:
+    T* mData;
+    size_t mWidth;
+    size_t mHeight;
+    size_t mStride;
+};
+
+#endif // ARRAY_2D_VIEW_H
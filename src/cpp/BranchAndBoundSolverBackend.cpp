@@ -0,0 +1,936 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "BranchAndBoundSolverBackend.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static int popcount(uint64_t mask)
+{
+    return int(std::bitset<64>(mask).count());
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+//
+// Call f with every subset of mask that has at most maxSize elements, including the empty set
+//
+template<typename F>
+static void forEachSubset(uint64_t mask, int maxSize, F f, uint64_t subset = 0)
+{
+    if(mask == 0 || maxSize == 0)
+    {
+        f(subset);
+        return;
+    }
+    const uint64_t bit = mask & (~mask + 1);
+    forEachSubset(mask & ~bit, maxSize, f, subset);
+    forEachSubset(mask & ~bit, maxSize - 1, f, subset | bit);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+//
+// Cell class with its colors as a mask of indices into the problem colors
+//
+struct BnbClass
+{
+    uint64_t colors;
+    // (color bit, column count) of each color, heaviest first
+    std::vector<std::pair<int, int>> weights;
+    // (row, number of member cells) of each row with member cells
+    std::vector<std::pair<int, int>> rowCounts;
+    // Summed column count of the lightest colors above the cell color limit, which are moved whatever the palettes
+    int minMoved;
+    // Index into the cell classes of the problem
+    size_t index;
+
+    int movedWeight(uint64_t moved) const
+    {
+        int weight = 0;
+        for(const auto& colorWeight : weights)
+        {
+            if(moved & (uint64_t(1) << colorWeight.first))
+            {
+                weight += colorWeight.second;
+            }
+        }
+        return weight;
+    }
+};
+
+//
+// Palette chosen for a cell class and the colors it keeps in the grid
+//
+struct BnbChoice
+{
+    int palette;
+    uint64_t keep;
+};
+
+//
+// Partial assignment of the first depth cell classes
+//
+struct BnbState
+{
+    size_t depth = 0;
+    std::vector<uint64_t> palettes;
+    uint64_t moved = 0;
+    int cost = 0;
+    // Only tracked when a row size limit can be reached
+    std::vector<int> rowUsage;
+    std::vector<BnbChoice> choices;
+};
+
+//
+// Branch for the next cell class
+//
+struct BnbOption
+{
+    BnbChoice choice;
+    // Palette contents after the choice
+    uint64_t palette;
+    bool opensPalette;
+    int cost;
+    int addedColors;
+};
+
+//
+// Hash of memoised search states
+//
+struct BnbStateHash
+{
+    size_t operator()(const std::vector<uint64_t>& key) const
+    {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for(uint64_t value : key)
+        {
+            hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+        }
+        return size_t(hash);
+    }
+};
+
+//---------------------------------------------------------------------------------------------------------------------
+
+class BranchAndBoundSearch
+{
+public:
+    using IncumbentCallback = std::function<void(const std::vector<Colors>& palettes)>;
+
+    BranchAndBoundSearch(const SolverProblem& problem, const SolverBackend& backend, const IncumbentCallback& incumbentCallback);
+
+    //
+    // Search with the given number of threads. Returns false if the search was stopped before it completed.
+    //
+    bool run(int numThreads);
+
+    bool hasIncumbent() const;
+
+    CellAssignment incumbent() const;
+
+private:
+    using Memo = std::unordered_map<std::vector<uint64_t>, int, BnbStateHash>;
+
+    void search(BnbState& state, Memo& memo, size_t& numNodes);
+
+    //
+    // Apply an option to a state. Returns false, leaving the state unchanged, if it breaks a constraint.
+    //
+    bool apply(const BnbOption& option, BnbState& state) const;
+    void undo(const BnbOption& option, const BnbState& parent, BnbState& state) const;
+
+    std::vector<BnbOption> options(const BnbState& state) const;
+
+    //
+    // Lower bound on the cost of assigning all remaining cell classes with the current palettes,
+    // or a value above any cost when the state cannot be completed
+    //
+    int completionBound(const BnbState& state) const;
+
+    //
+    // Assign the remaining cell classes when no palette can change any more. Returns false if the
+    // independent best choices break a constraint, which leaves the state to be searched as usual.
+    //
+    bool completeWithFullPalettes(const BnbState& state);
+
+    void recordIncumbent(const BnbState& state);
+
+    //
+    // Moved colors not in any palette, and room left in open and unopened palettes
+    //
+    uint64_t unplacedColors(const BnbState& state, uint64_t moved) const;
+    int paletteRoom(const BnbState& state) const;
+
+    std::vector<uint64_t> paddedPalettes(const std::vector<uint64_t>& palettes, const std::vector<BnbChoice>& choices) const;
+    std::vector<Colors> colorsFromMasks(const std::vector<uint64_t>& palettes) const;
+    Colors colorsFromMask(uint64_t mask) const;
+
+    const SolverProblem& mProblem;
+    const SolverBackend& mBackend;
+    IncumbentCallback mIncumbentCallback;
+    bool mSecondPass;
+    int mLimit;
+    int mNumPalettes;
+    int mMaxMovedColors;
+    std::vector<uint8_t> mColors;
+    std::vector<BnbClass> mClasses;
+    // Sum of minMoved over the cell classes from each depth onwards
+    std::vector<int> mSuffixBound;
+    bool mRowsBind;
+    std::vector<int> mRowLimits;
+    std::chrono::steady_clock::time_point mDeadline;
+    std::atomic<bool> mStop;
+    std::atomic<bool> mAborted;
+    std::atomic<int> mBestCost;
+    mutable std::mutex mIncumbentMutex;
+    bool mHasIncumbent;
+    std::vector<BnbChoice> mBestChoices;
+    std::vector<uint64_t> mBestPalettes;
+};
+
+//---------------------------------------------------------------------------------------------------------------------
+
+BranchAndBoundSearch::BranchAndBoundSearch(const SolverProblem& problem, const SolverBackend& backend, const IncumbentCallback& incumbentCallback):
+    mProblem(problem),
+    mBackend(backend),
+    mIncumbentCallback(incumbentCallback),
+    mSecondPass(problem.pass == SolverPass::Second),
+    mLimit(problem.gridCellColorLimit),
+    mNumPalettes(problem.numPalettes),
+    mMaxMovedColors(problem.maxSpritePalettes * problem.gridCellColorLimit),
+    mRowsBind(false),
+    mDeadline(std::chrono::steady_clock::time_point::max()),
+    mStop(false),
+    mAborted(false),
+    mBestCost(std::numeric_limits<int>::max()),
+    mHasIncumbent(false)
+{
+    Colors colors;
+    for(const CellClass& cellClass : problem.cellClasses)
+    {
+        colors.insert(cellClass.colors.begin(), cellClass.colors.end());
+    }
+    if(colors.size() > 64)
+    {
+        throw SolverBackend::Error("Too many colors for the branch-and-bound solver");
+    }
+    mColors.assign(colors.begin(), colors.end());
+    std::map<uint8_t, int> colorBits;
+    for(size_t i = 0; i < mColors.size(); i++)
+    {
+        colorBits[mColors[i]] = int(i);
+    }
+    std::vector<int> totalWeights;
+    for(size_t k = 0; k < problem.cellClasses.size(); k++)
+    {
+        const CellClass& cellClass = problem.cellClasses[k];
+        BnbClass bnbClass;
+        bnbClass.colors = 0;
+        bnbClass.index = k;
+        int totalWeight = 0;
+        for(uint8_t c : cellClass.colors)
+        {
+            const int bit = colorBits[c];
+            const int weight = cellClass.columnCount.at(c);
+            bnbClass.colors |= uint64_t(1) << bit;
+            bnbClass.weights.push_back({bit, weight});
+            totalWeight += weight;
+        }
+        std::stable_sort(bnbClass.weights.begin(), bnbClass.weights.end(), [](const std::pair<int, int>& a, const std::pair<int, int>& b)
+        {
+            return a.second > b.second;
+        });
+        bnbClass.minMoved = 0;
+        for(size_t i = size_t(mLimit); i < bnbClass.weights.size(); i++)
+        {
+            bnbClass.minMoved += bnbClass.weights[i].second;
+        }
+        std::map<int, int> rowCounts;
+        for(const auto& cell : cellClass.cells)
+        {
+            rowCounts[cell.second]++;
+        }
+        bnbClass.rowCounts.assign(rowCounts.begin(), rowCounts.end());
+        mClasses.push_back(std::move(bnbClass));
+        totalWeights.push_back(totalWeight);
+    }
+    // Deciding heavy classes first finds good incumbents early
+    std::stable_sort(mClasses.begin(), mClasses.end(), [&](const BnbClass& a, const BnbClass& b)
+    {
+        return totalWeights[a.index] > totalWeights[b.index];
+    });
+    mSuffixBound.assign(mClasses.size() + 1, 0);
+    for(size_t d = mClasses.size(); d > 0; d--)
+    {
+        mSuffixBound[d - 1] = mSuffixBound[d] + mClasses[d - 1].minMoved;
+    }
+    // Row usage is only tracked when some row could reach its limit
+    const int height = int(problem.layer.height());
+    std::vector<int> maxRowUsage(height, 0);
+    for(const BnbClass& bnbClass : mClasses)
+    {
+        const int usage = mSecondPass ? popcount(bnbClass.colors) : 1;
+        for(const auto& rowCount : bnbClass.rowCounts)
+        {
+            maxRowUsage[rowCount.first] += usage * rowCount.second;
+        }
+    }
+    for(int y = 0; y < height; y++)
+    {
+        const int reserved = y < int(problem.rowReserved.size()) ? problem.rowReserved[y] : 0;
+        mRowLimits.push_back(problem.maxRowSize - reserved);
+        mRowsBind = mRowsBind || maxRowUsage[y] > mRowLimits[y];
+    }
+    if(problem.timeOut > 0)
+    {
+        mDeadline = std::chrono::steady_clock::now() + std::chrono::seconds(problem.timeOut);
+    }
+    // The start assignment is the first incumbent
+    const CellAssignment& start = problem.start;
+    if(!start.empty() && start.palettes.size() <= size_t(mNumPalettes))
+    {
+        // Start palettes may hold colors no cell class has, e.g. when carried over from an edited image.
+        // These are dropped, as they would otherwise alias another color's bit.
+        auto toMask = [&](const Colors& colors)
+        {
+            uint64_t mask = 0;
+            for(uint8_t c : colors)
+            {
+                const auto it = colorBits.find(c);
+                if(it != colorBits.end())
+                {
+                    mask |= uint64_t(1) << it->second;
+                }
+            }
+            return mask;
+        };
+        int cost = 0;
+        for(size_t d = 0; d < mClasses.size(); d++)
+        {
+            const BnbClass& bnbClass = mClasses[d];
+            const uint64_t keep = toMask(start.grid[bnbClass.index]);
+            mBestChoices.push_back(BnbChoice{start.palette[bnbClass.index], keep});
+            cost += bnbClass.movedWeight(bnbClass.colors & ~keep);
+        }
+        for(const Colors& palette : start.palettes)
+        {
+            mBestPalettes.push_back(toMask(palette));
+        }
+        mBestCost = cost;
+        mHasIncumbent = true;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool BranchAndBoundSearch::run(int numThreads)
+{
+    if(mNumPalettes <= 0 || mBestCost <= mProblem.objectiveLowerBound)
+        return true;
+    for(int rowLimit : mRowLimits)
+    {
+        if(rowLimit < 0)
+            return true;
+    }
+    BnbState root;
+    root.choices.resize(mClasses.size());
+    if(mRowsBind)
+    {
+        root.rowUsage.assign(mRowLimits.size(), 0);
+    }
+    if(numThreads <= 1)
+    {
+        Memo memo;
+        size_t numNodes = 0;
+        search(root, memo, numNodes);
+        return !mAborted;
+    }
+    // Split the top of the tree into enough subtrees to keep all threads busy
+    const size_t MinSubtreesPerThread = 8;
+    std::vector<BnbState> frontier(1, root);
+    while(frontier.size() < MinSubtreesPerThread * size_t(numThreads))
+    {
+        std::vector<BnbState> next;
+        bool expanded = false;
+        for(BnbState& state : frontier)
+        {
+            if(state.depth == mClasses.size())
+            {
+                recordIncumbent(state);
+                continue;
+            }
+            for(const BnbOption& option : options(state))
+            {
+                BnbState child = state;
+                if(apply(option, child))
+                {
+                    next.push_back(std::move(child));
+                    expanded = true;
+                }
+            }
+        }
+        frontier = std::move(next);
+        if(!expanded)
+            break;
+    }
+    std::stable_sort(frontier.begin(), frontier.end(), [](const BnbState& a, const BnbState& b)
+    {
+        return a.cost < b.cost;
+    });
+    std::atomic<size_t> nextSubtree(0);
+    std::vector<std::thread> threads;
+    for(int i = 0; i < numThreads; i++)
+    {
+        threads.emplace_back([&]()
+        {
+            Memo memo;
+            size_t numNodes = 0;
+            for(size_t j = nextSubtree++; j < frontier.size() && !mStop; j = nextSubtree++)
+            {
+                search(frontier[j], memo, numNodes);
+            }
+        });
+    }
+    for(std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    return !mAborted;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void BranchAndBoundSearch::search(BnbState& state, Memo& memo, size_t& numNodes)
+{
+    // Stopping is checked periodically, as reading the clock is relatively slow
+    const size_t CheckInterval = 1024;
+    const size_t MaxMemoEntries = 1 << 20;
+    if(++numNodes % CheckInterval == 0 && (mBackend.cancelled() || std::chrono::steady_clock::now() > mDeadline))
+    {
+        mAborted = true;
+        mStop = true;
+    }
+    if(mStop)
+        return;
+    const size_t d = state.depth;
+    if(d == mClasses.size())
+    {
+        recordIncumbent(state);
+        return;
+    }
+    if(state.cost + mSuffixBound[d] >= mBestCost || state.cost + completionBound(state) >= mBestCost)
+        return;
+    // States with the same palettes and moved colors have the same completions. Row usage differs
+    // between them, so they are only memoised when no row limit can be reached.
+    std::vector<uint64_t> key;
+    if(!mRowsBind)
+    {
+        std::vector<uint64_t> palettes = state.palettes;
+        std::sort(palettes.begin(), palettes.end());
+        key.push_back(d);
+        key.push_back(state.moved);
+        key.insert(key.end(), palettes.begin(), palettes.end());
+        auto it = memo.find(key);
+        if(it != memo.end() && state.cost + it->second >= mBestCost)
+            return;
+    }
+    if(!completeWithFullPalettes(state))
+    {
+        const BnbState parent = state;
+        for(const BnbOption& option : options(state))
+        {
+            // Options are sorted by cost, so no later option can pass the bound either
+            if(state.cost + option.cost + mSuffixBound[d + 1] >= mBestCost)
+                break;
+            if(!apply(option, state))
+                continue;
+            search(state, memo, numNodes);
+            undo(option, parent, state);
+            if(mStop)
+                return;
+        }
+    }
+    // No completion of this state is better than the incumbent, which gives a bound for reaching it again
+    if(!mRowsBind && !mStop && memo.size() < MaxMemoEntries)
+    {
+        int& completion = memo[key];
+        completion = std::max(completion, mBestCost - state.cost);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::vector<BnbOption> BranchAndBoundSearch::options(const BnbState& state) const
+{
+    const BnbClass& bnbClass = mClasses[state.depth];
+    const uint64_t colors = bnbClass.colors;
+    std::vector<BnbOption> result;
+    for(size_t p = 0; p < state.palettes.size(); p++)
+    {
+        // Keeping all colors with an unchanged palette is as good as any other choice
+        if((colors & ~state.palettes[p]) == 0)
+            return {BnbOption{BnbChoice{int(p), colors}, state.palettes[p], false, 0, 0}};
+    }
+    for(size_t p = 0; p < state.palettes.size(); p++)
+    {
+        const uint64_t palette = state.palettes[p];
+        // Palettes with the same colors give the same branches
+        if(std::find(state.palettes.begin(), state.palettes.begin() + p, palette) != state.palettes.begin() + p)
+            continue;
+        const uint64_t kept = colors & palette;
+        forEachSubset(colors & ~palette, mLimit - popcount(palette), [&](uint64_t added)
+        {
+            const uint64_t keep = kept | added;
+            result.push_back(BnbOption{BnbChoice{int(p), keep}, palette | added, false, bnbClass.movedWeight(colors & ~keep), popcount(added)});
+        });
+    }
+    // Only the next palette can be opened, which leaves out permutations of the palettes
+    if(int(state.palettes.size()) < mNumPalettes)
+    {
+        const int p = int(state.palettes.size());
+        forEachSubset(colors, mLimit, [&](uint64_t keep)
+        {
+            if(keep != 0)
+            {
+                result.push_back(BnbOption{BnbChoice{p, keep}, keep, true, bnbClass.movedWeight(colors & ~keep), popcount(keep)});
+            }
+        });
+    }
+    if(state.palettes.empty())
+    {
+        result.push_back(BnbOption{BnbChoice{0, 0}, 0, false, bnbClass.movedWeight(colors), 0});
+    }
+    std::stable_sort(result.begin(), result.end(), [](const BnbOption& a, const BnbOption& b)
+    {
+        return a.cost < b.cost || (a.cost == b.cost && a.addedColors < b.addedColors);
+    });
+    return result;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool BranchAndBoundSearch::apply(const BnbOption& option, BnbState& state) const
+{
+    const BnbClass& bnbClass = mClasses[state.depth];
+    const uint64_t movedColors = bnbClass.colors & ~option.choice.keep;
+    const uint64_t moved = state.moved | movedColors;
+    if(!mSecondPass && popcount(moved) > mMaxMovedColors)
+        return false;
+    const int p = option.choice.palette;
+    uint64_t previousPalette = 0;
+    if(option.opensPalette)
+    {
+        state.palettes.push_back(option.palette);
+    }
+    else if(p < int(state.palettes.size()))
+    {
+        previousPalette = state.palettes[p];
+        state.palettes[p] = option.palette;
+    }
+    auto restorePalettes = [&]()
+    {
+        if(option.opensPalette)
+            state.palettes.pop_back();
+        else if(p < int(state.palettes.size()))
+            state.palettes[p] = previousPalette;
+    };
+    // Free colors must still fit in the palettes
+    if(mSecondPass && popcount(unplacedColors(state, moved)) > paletteRoom(state))
+    {
+        restorePalettes();
+        return false;
+    }
+    if(mRowsBind)
+    {
+        const int usage = mSecondPass ? (option.choice.keep ? 1 : 0) + popcount(movedColors) : (movedColors ? 1 : 0);
+        bool withinLimits = true;
+        for(const auto& rowCount : bnbClass.rowCounts)
+        {
+            state.rowUsage[rowCount.first] += usage * rowCount.second;
+            withinLimits = withinLimits && state.rowUsage[rowCount.first] <= mRowLimits[rowCount.first];
+        }
+        if(!withinLimits)
+        {
+            for(const auto& rowCount : bnbClass.rowCounts)
+            {
+                state.rowUsage[rowCount.first] -= usage * rowCount.second;
+            }
+            restorePalettes();
+            return false;
+        }
+    }
+    state.choices[state.depth] = option.choice;
+    state.moved = moved;
+    state.cost += option.cost;
+    state.depth++;
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void BranchAndBoundSearch::undo(const BnbOption& option, const BnbState& parent, BnbState& state) const
+{
+    state.depth = parent.depth;
+    state.cost = parent.cost;
+    state.moved = parent.moved;
+    if(option.opensPalette)
+    {
+        state.palettes.pop_back();
+    }
+    else if(option.choice.palette < int(state.palettes.size()))
+    {
+        state.palettes[option.choice.palette] = parent.palettes[option.choice.palette];
+    }
+    if(mRowsBind)
+    {
+        const BnbClass& bnbClass = mClasses[state.depth];
+        for(const auto& rowCount : bnbClass.rowCounts)
+        {
+            state.rowUsage[rowCount.first] = parent.rowUsage[rowCount.first];
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int BranchAndBoundSearch::completionBound(const BnbState& state) const
+{
+    const bool canOpen = int(state.palettes.size()) < mNumPalettes;
+    uint64_t placed = 0;
+    for(uint64_t palette : state.palettes)
+    {
+        placed |= palette;
+    }
+    int classBound = 0;
+    // Column count of each color not yet in a palette, summed over the remaining classes
+    std::array<int, 64> unplacedWeights{};
+    uint64_t unplaced = 0;
+    for(size_t d = state.depth; d < mClasses.size(); d++)
+    {
+        const BnbClass& bnbClass = mClasses[d];
+        for(const auto& colorWeight : bnbClass.weights)
+        {
+            if((placed & (uint64_t(1) << colorWeight.first)) == 0)
+            {
+                unplacedWeights[colorWeight.first] += colorWeight.second;
+                unplaced |= uint64_t(1) << colorWeight.first;
+            }
+        }
+        if(canOpen)
+        {
+            // A new palette can take the heaviest colors, which no open palette can beat
+            classBound += bnbClass.minMoved;
+            continue;
+        }
+        int best = std::numeric_limits<int>::max();
+        for(uint64_t palette : state.palettes)
+        {
+            // Moved weight when keeping the palette colors plus the heaviest other colors that fit
+            const uint64_t missing = bnbClass.colors & ~palette;
+            int room = mLimit - popcount(palette);
+            int weight = 0;
+            for(const auto& colorWeight : bnbClass.weights)
+            {
+                if(missing & (uint64_t(1) << colorWeight.first))
+                {
+                    if(room > 0)
+                        room--;
+                    else
+                        weight += colorWeight.second;
+                }
+            }
+            best = std::min(best, weight);
+            if(best == bnbClass.minMoved)
+                break;
+        }
+        classBound += best;
+    }
+    // Only as many unplaced colors as there is palette room left can be kept, and the rest is moved everywhere
+    const int room = paletteRoom(state);
+    const int numUnplaced = popcount(unplaced);
+    if(numUnplaced <= room)
+        return classBound;
+    if(!mSecondPass && popcount(state.moved & ~unplaced) + numUnplaced - room > mMaxMovedColors)
+        return std::numeric_limits<int>::max() / 2;
+    std::sort(unplacedWeights.begin(), unplacedWeights.end());
+    int unionBound = 0;
+    for(int i = 0; i < numUnplaced - room; i++)
+    {
+        unionBound += unplacedWeights[64 - numUnplaced + i];
+    }
+    return std::max(classBound, unionBound);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool BranchAndBoundSearch::completeWithFullPalettes(const BnbState& state)
+{
+    if(mRowsBind || int(state.palettes.size()) < mNumPalettes)
+        return false;
+    const int paletteSize = std::min(mLimit, int(mColors.size()));
+    for(uint64_t palette : state.palettes)
+    {
+        if(popcount(palette) < paletteSize)
+            return false;
+    }
+    // Nothing but the choice of palette is left, and each class can take its best one
+    BnbState complete = state;
+    for(size_t d = state.depth; d < mClasses.size(); d++)
+    {
+        const BnbClass& bnbClass = mClasses[d];
+        int bestWeight = std::numeric_limits<int>::max();
+        BnbChoice bestChoice{0, 0};
+        for(size_t p = 0; p < state.palettes.size(); p++)
+        {
+            const uint64_t keep = bnbClass.colors & state.palettes[p];
+            const int weight = bnbClass.movedWeight(bnbClass.colors & ~keep);
+            if(weight < bestWeight)
+            {
+                bestWeight = weight;
+                bestChoice = BnbChoice{int(p), keep};
+            }
+        }
+        complete.choices[d] = bestChoice;
+        complete.moved |= bnbClass.colors & ~bestChoice.keep;
+        complete.cost += bestWeight;
+    }
+    complete.depth = mClasses.size();
+    if(!mSecondPass && popcount(complete.moved) > mMaxMovedColors)
+        return false;
+    if(mSecondPass && unplacedColors(complete, complete.moved) != 0)
+        return false;
+    recordIncumbent(complete);
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void BranchAndBoundSearch::recordIncumbent(const BnbState& state)
+{
+    if(state.cost >= mBestCost)
+        return;
+    std::vector<Colors> incumbentPalettes;
+    {
+        std::lock_guard<std::mutex> lock(mIncumbentMutex);
+        if(state.cost >= mBestCost)
+            return;
+        mBestChoices = state.choices;
+        mBestPalettes = state.palettes;
+        mHasIncumbent = true;
+        mBestCost = state.cost;
+        if(mIncumbentCallback)
+        {
+            incumbentPalettes = colorsFromMasks(paddedPalettes(mBestPalettes, mBestChoices));
+        }
+        // Reaching the lower bound proves optimality
+        if(state.cost <= mProblem.objectiveLowerBound)
+        {
+            mStop = true;
+        }
+    }
+    // The callback runs outside the lock so the other search threads are not held up. Incumbents may
+    // then arrive out of order, which the receiver handles by comparing objectives.
+    if(mIncumbentCallback)
+    {
+        mIncumbentCallback(incumbentPalettes);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+uint64_t BranchAndBoundSearch::unplacedColors(const BnbState& state, uint64_t moved) const
+{
+    uint64_t placed = 0;
+    for(uint64_t palette : state.palettes)
+    {
+        placed |= palette;
+    }
+    return moved & ~placed;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int BranchAndBoundSearch::paletteRoom(const BnbState& state) const
+{
+    int room = (mNumPalettes - int(state.palettes.size())) * mLimit;
+    for(uint64_t palette : state.palettes)
+    {
+        room += mLimit - popcount(palette);
+    }
+    return room;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::vector<uint64_t> BranchAndBoundSearch::paddedPalettes(const std::vector<uint64_t>& palettes, const std::vector<BnbChoice>& choices) const
+{
+    std::vector<uint64_t> padded = palettes;
+    if(!mSecondPass)
+        return padded;
+    // Second pass free colors must be in some palette, and are added where there is room
+    uint64_t moved = 0;
+    for(size_t d = 0; d < mClasses.size(); d++)
+    {
+        moved |= mClasses[d].colors & ~choices[d].keep;
+    }
+    for(uint64_t palette : padded)
+    {
+        moved &= ~palette;
+    }
+    for(int bit = 0; bit < 64 && moved != 0; bit++)
+    {
+        const uint64_t color = uint64_t(1) << bit;
+        if((moved & color) == 0)
+            continue;
+        auto it = std::find_if(padded.begin(), padded.end(), [&](uint64_t palette)
+        {
+            return popcount(palette) < mLimit;
+        });
+        if(it != padded.end())
+            *it |= color;
+        else
+            padded.push_back(color);
+        moved &= ~color;
+    }
+    return padded;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+Colors BranchAndBoundSearch::colorsFromMask(uint64_t mask) const
+{
+    Colors colors;
+    for(size_t i = 0; i < mColors.size(); i++)
+    {
+        if(mask & (uint64_t(1) << i))
+        {
+            colors.insert(mColors[i]);
+        }
+    }
+    return colors;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::vector<Colors> BranchAndBoundSearch::colorsFromMasks(const std::vector<uint64_t>& palettes) const
+{
+    std::vector<Colors> result;
+    for(uint64_t palette : palettes)
+    {
+        result.push_back(colorsFromMask(palette));
+    }
+    return result;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool BranchAndBoundSearch::hasIncumbent() const
+{
+    std::lock_guard<std::mutex> lock(mIncumbentMutex);
+    return mHasIncumbent;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+CellAssignment BranchAndBoundSearch::incumbent() const
+{
+    std::lock_guard<std::mutex> lock(mIncumbentMutex);
+    const std::vector<uint64_t> palettes = paddedPalettes(mBestPalettes, mBestChoices);
+    std::vector<BnbChoice> choices(mClasses.size());
+    for(size_t d = 0; d < mClasses.size(); d++)
+    {
+        choices[mClasses[d].index] = mBestChoices[d];
+    }
+    // Number palettes in order of first use by the cell classes of the problem, as symmetry breaking does
+    std::vector<int> paletteIndices(palettes.size(), -1);
+    std::vector<uint64_t> ordered;
+    for(const BnbChoice& choice : choices)
+    {
+        if(choice.palette < int(palettes.size()) && paletteIndices[choice.palette] < 0)
+        {
+            paletteIndices[choice.palette] = int(ordered.size());
+            ordered.push_back(palettes[choice.palette]);
+        }
+    }
+    for(size_t p = 0; p < palettes.size(); p++)
+    {
+        if(paletteIndices[p] < 0)
+        {
+            paletteIndices[p] = int(ordered.size());
+            ordered.push_back(palettes[p]);
+        }
+    }
+    CellAssignment assignment;
+    assignment.palettes = colorsFromMasks(ordered);
+    for(const BnbChoice& choice : choices)
+    {
+        assignment.grid.push_back(colorsFromMask(choice.keep));
+        assignment.palette.push_back(choice.palette < int(palettes.size()) ? paletteIndices[choice.palette] : 0);
+    }
+    return assignment;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+BranchAndBoundSolverBackend::BranchAndBoundSolverBackend(int numThreads):
+    mNumThreads(std::max(numThreads, 1))
+{
+
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::string BranchAndBoundSolverBackend::name() const
+{
+    return Name;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void BranchAndBoundSolverBackend::solve(const SolverProblem& problem, SolverSolution& solution)
+{
+    BranchAndBoundSearch search(problem, *this, [this](const std::vector<Colors>& palettes)
+    {
+        reportIncumbent(palettes);
+    });
+    const bool complete = search.run(mNumThreads);
+    if(cancelled())
+    {
+        throw Cancelled();
+    }
+    if(!search.hasIncumbent())
+    {
+        throw Error("No solution found");
+    }
+    solution = solutionFromAssignment(problem, search.incumbent());
+    solution.optimal = complete;
+}
@@ -0,0 +1,54 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef BRANCH_AND_BOUND_SOLVER_BACKEND_H
+#define BRANCH_AND_BOUND_SOLVER_BACKEND_H
+
+#include <string>
+
+#include "SolverBackend.h"
+
+//
+// Exact solver for the FirstPass / SecondPass problems that needs no external MIP solver.
+//
+// Cell classes are assigned one at a time, heaviest first, keeping color sets and palettes as 64-bit masks
+// of the problem colors. Each class either keeps colors with an open palette, adding colors to it while
+// there is room, or opens the next palette. Branches are cut by bounds from the lightest colors each
+// remaining class must move, and states reached again with the same palettes and moved colors are
+// cut by the completion bound stored for them.
+//
+// With more than one thread, the top of the search tree is split into subtrees that are searched in
+// parallel, sharing the incumbent.
+//
+class BranchAndBoundSolverBackend : public SolverBackend
+{
+public:
+    static constexpr const char* Name = "bnb";
+
+    BranchAndBoundSolverBackend(int numThreads = 1);
+
+    std::string name() const override;
+
+    void solve(const SolverProblem& problem, SolverSolution& solution) override;
+
+private:
+    int mNumThreads;
+};
+
+#endif // BRANCH_AND_BOUND_SOLVER_BACKEND_H
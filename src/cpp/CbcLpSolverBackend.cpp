@@ -0,0 +1,186 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <stdexcept>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <vector>
+
+#include "SubProcess.h"
+
+#include "CbcLpSolverBackend.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+
+CbcLpSolverBackend::CbcLpSolverBackend()
+{
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::string CbcLpSolverBackend::name() const
+{
+    return Name;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void CbcLpSolverBackend::solve(const SolverProblem& problem, SolverSolution& solution)
+{
+    const bool secondPass = problem.pass == SolverPass::Second;
+    const std::string modelFilename = workPathFilename(secondPass ? secondPassModelFilename : firstPassModelFilename);
+    const std::string solutionFilename = workPathFilename(secondPass ? secondPassSolutionFilename : firstPassSolutionFilename);
+    const std::string startFilename = workPathFilename(secondPass ? secondPassStartFilename : firstPassStartFilename);
+    // Remove old files
+    remove(modelFilename.c_str());
+    remove(solutionFilename.c_str());
+    remove(startFilename.c_str());
+    //
+    std::unique_ptr<PassFormulation> passModel = createPassFormulation(problem);
+    passModel->model().writeLp(modelFilename);
+    if(!problem.start.empty())
+    {
+        writeCbcStart(startFilename, passModel->model(), passModel->startValues(problem.start));
+    }
+    runCbcProgram(modelFilename,
+                  solutionFilename,
+                  problem.start.empty() ? std::string() : startFilename,
+                  problem.timeOut,
+                  problem.solverOptions);
+    std::vector<double> values;
+    initialiseSolution(problem, solution);
+    solution.optimal = parseCbcSolution(solutionFilename, passModel->model(), values);
+    passModel->decode(values, solution);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void CbcLpSolverBackend::writeCbcStart(const std::string& startFilename,
+                                       const MipModel& model,
+                                       const std::vector<double>& values)
+{
+    std::ofstream f(startFilename, std::ofstream::out);
+    if(!f)
+    {
+        throw std::runtime_error(std::string("Failed to open file '") + startFilename + "' for writing MIP start.");
+    }
+    // Same "index name value" lines as in CBC solution files. The first line is skipped by CBC.
+    f << "Feasible - objective value 0\n";
+    for(size_t i = 0; i < values.size(); i++)
+    {
+        f << i << " " << model.columns()[i].name << " " << values[i] << "\n";
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void CbcLpSolverBackend::runCbcProgram(const std::string& lpFilename,
+                                       const std::string& solutionFilename,
+                                       const std::string& startFilename,
+                                       int timeOut,
+                                       const std::vector<std::pair<std::string, std::string>>& solverOptions)
+{
+    std::vector<std::string> params;
+    params.push_back(quoteStringOnWindows(lpFilename));
+    params.push_back("-log");
+    params.push_back("0");
+    if(timeOut)
+    {
+        params.push_back("-sec");
+        params.push_back(std::to_string(timeOut));
+    }
+    for(const auto& option : solverOptions)
+    {
+        params.push_back("-" + option.first);
+        params.push_back(option.second);
+    }
+    if(!startFilename.empty())
+    {
+        params.push_back("-mips");
+        params.push_back(quoteStringOnWindows(startFilename));
+    }
+    params.push_back("-solve");
+    params.push_back("-solution");
+    params.push_back(quoteStringOnWindows(solutionFilename));
+    params.push_back("-quit");
+    int exitCode = runProcess(exePathFilename(cbcExecutable), params, timeOut);
+    if(exitCode != 0)
+    {
+        throw Error("Non-zero exit code from CBC");
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool CbcLpSolverBackend::parseCbcSolution(const std::string& solutionFilename,
+                                          const MipModel& model,
+                                          std::vector<double>& values)
+{
+    std::ifstream f;
+    f.open(solutionFilename, std::ifstream::in);
+    if(!f)
+    {
+        throw std::runtime_error(std::string("Failed to open solution file: ") + solutionFilename);
+    }
+    // First line has status, e.g. "Optimal - objective value 12.00000000" or "Stopped on time - objective value 14.00000000"
+    const std::string objectiveValuePrefix = "objective value";
+    std::string line;
+    std::getline(f, line);
+    if(line.rfind("Infeasible", 0) == 0 || line.rfind("Integer infeasible", 0) == 0)
+    {
+        throw std::runtime_error(std::string("No solution found"));
+    }
+    size_t objectiveValuePos = line.find(objectiveValuePrefix);
+    if(objectiveValuePos == std::string::npos)
+    {
+        throw std::runtime_error(std::string("Solution file header unrecognized"));
+    }
+    // CBC reports a huge objective value when stopped before finding any integer solution
+    const double NoSolutionObjective = 1e49;
+    double objectiveValue = NoSolutionObjective;
+    std::stringstream(line.substr(objectiveValuePos + objectiveValuePrefix.size())) >> objectiveValue;
+    if(objectiveValue >= NoSolutionObjective)
+    {
+        throw std::runtime_error(std::string("No solution found"));
+    }
+    const bool optimal = line.rfind("Optimal", 0) == 0;
+    // Remaining lines are "index name value reducedCost", listing only non-zero values
+    values.assign(model.columns().size(), 0.0);
+    while(std::getline(f, line))
+    {
+        // Values violating their bounds or integrality are prefixed with '**'
+        if(line.rfind("**", 0) == 0)
+        {
+            line.erase(0, 2);
+        }
+        std::stringstream ss(line);
+        int index;
+        std::string name;
+        double value;
+        if(!(ss >> index >> name >> value))
+            continue;
+        int column = model.findColumn(name);
+        if(column < 0)
+        {
+            throw std::runtime_error(std::string("Unknown variable in solution file: ") + name);
+        }
+        values[column] = value;
+    }
+    return optimal;
+}
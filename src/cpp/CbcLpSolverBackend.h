@@ -0,0 +1,73 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef CBC_LP_SOLVER_BACKEND_H
+#define CBC_LP_SOLVER_BACKEND_H
+
+#include <string>
+#include <vector>
+
+#include "SolverBackend.h"
+#include "MipModel.h"
+
+//
+// Solver backend writing the model as an LP file and solving it with the bundled cbc executable,
+// skipping the CMPL compiler entirely.
+//
+class CbcLpSolverBackend : public SolverBackend
+{
+public:
+    static constexpr const char* Name = "cbc-lp";
+
+    CbcLpSolverBackend();
+
+    std::string name() const override;
+
+    void solve(const SolverProblem& problem, SolverSolution& solution) override;
+
+protected:
+    static void writeCbcStart(const std::string& startFilename,
+                              const MipModel& model,
+                              const std::vector<double>& values);
+
+    void runCbcProgram(const std::string& lpFilename,
+                       const std::string& solutionFilename,
+                       const std::string& startFilename,
+                       int timeOut,
+                       const std::vector<std::pair<std::string, std::string>>& solverOptions);
+
+    static bool parseCbcSolution(const std::string& solutionFilename,
+                                 const MipModel& model,
+                                 std::vector<double>& values);
+
+private:
+#ifdef _WIN32
+    const char* cbcExecutable = "Cmpl/bin/cbc";
+#else
+    const char* cbcExecutable = "Cmpl/Thirdparty/CBC/cbc";
+#endif
+    const char* firstPassModelFilename = "firstpass_model.lp";
+    const char* firstPassSolutionFilename = "firstpass_solution.txt";
+    const char* firstPassStartFilename = "firstpass_start.txt";
+    const char* secondPassModelFilename = "secondpass_model.lp";
+    const char* secondPassSolutionFilename = "secondpass_solution.txt";
+    const char* secondPassStartFilename = "secondpass_start.txt";
+};
+
+#endif // CBC_LP_SOLVER_BACKEND_H
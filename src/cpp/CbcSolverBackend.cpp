@@ -0,0 +1,251 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "CbcSolverBackend.h"
+
+#ifdef OVERLAYPAL_LINK_CBC
+
+#include <CoinPackedMatrix.hpp>
+#include <CoinPackedVector.hpp>
+#include <OsiClpSolverInterface.hpp>
+#include <CbcModel.hpp>
+#include <CbcSolver.hpp>
+#include <CbcEventHandler.hpp>
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static int cbcCallback(CbcModel* /*currentSolver*/, int /*whereFrom*/)
+{
+    return 0;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+//
+// Stops the branch-and-bound search once the cancel flag of the backend is set,
+// and passes on the column values of each new incumbent
+//
+class SearchEventHandler : public CbcEventHandler
+{
+public:
+    SearchEventHandler(const SolverBackend& backend,
+                       int numColumns,
+                       double stopObjective,
+                       const std::function<void(const std::vector<double>&)>& incumbentValues):
+        mBackend(backend),
+        mNumColumns(numColumns),
+        mStopObjective(stopObjective),
+        mIncumbentValues(incumbentValues)
+    {}
+
+    CbcEventHandler* clone() const override
+    {
+        return new SearchEventHandler(*this);
+    }
+
+    CbcAction event(CbcEvent whichEvent) override
+    {
+        if(mBackend.cancelled())
+            return stop;
+        if(whichEvent == solution || whichEvent == heuristicSolution)
+        {
+            if(mIncumbentValues)
+            {
+                reportIncumbent();
+            }
+            // Objective values are integers, so an incumbent this close to the bound is optimal
+            if(model_->getObjValue() < mStopObjective + 0.5)
+                return stop;
+        }
+        return noAction;
+    }
+
+private:
+    void reportIncumbent() const
+    {
+        const double* bestSolution = model_->bestSolution();
+        if(bestSolution == nullptr)
+            return;
+        // CBC's preprocessing searches a reduced model, whose columns are mapped back to the original ones.
+        // Columns removed by preprocessing are left at zero. This is acceptable because incumbents are only used as previews.
+        const int* originalColumns = model_->originalColumns();
+        const int numColumns = model_->getNumCols();
+        if(originalColumns == nullptr && numColumns != mNumColumns)
+            return;
+        std::vector<double> values(mNumColumns, 0.0);
+        for(int i = 0; i < numColumns; i++)
+        {
+            const int column = originalColumns ? originalColumns[i] : i;
+            if(column >= 0 && column < mNumColumns)
+            {
+                values[column] = bestSolution[i];
+            }
+        }
+        mIncumbentValues(values);
+    }
+
+    const SolverBackend& mBackend;
+    int mNumColumns;
+    double mStopObjective;
+    std::function<void(const std::vector<double>&)> mIncumbentValues;
+};
+
+//---------------------------------------------------------------------------------------------------------------------
+
+CbcSolverBackend::CbcSolverBackend()
+{
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::string CbcSolverBackend::name() const
+{
+    return Name;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::vector<std::string> CbcSolverBackend::cbcArguments(const SolverProblem& problem) const
+{
+    std::vector<std::string> arguments;
+    arguments.push_back("OverlayPal");
+    arguments.push_back("-log");
+    arguments.push_back("0");
+    if(problem.timeOut)
+    {
+        arguments.push_back("-sec");
+        arguments.push_back(std::to_string(problem.timeOut));
+    }
+    for(const auto& option : problem.solverOptions)
+    {
+        arguments.push_back("-" + option.first);
+        arguments.push_back(option.second);
+    }
+    arguments.push_back("-solve");
+    arguments.push_back("-quit");
+    return arguments;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool CbcSolverBackend::solveModel(const MipModel& model,
+                                  const std::vector<std::string>& arguments,
+                                  const std::vector<double>& startValues,
+                                  double objectiveLowerBound,
+                                  const std::function<void(const std::vector<double>&)>& incumbentValues,
+                                  std::vector<double>& values)
+{
+    const std::vector<MipColumn>& columns = model.columns();
+    const std::vector<MipRow>& rows = model.rows();
+    OsiClpSolverInterface solver;
+    const double infinity = solver.getInfinity();
+    // Columns
+    std::vector<double> columnLower(columns.size());
+    std::vector<double> columnUpper(columns.size());
+    std::vector<double> objective(columns.size());
+    for(size_t i = 0; i < columns.size(); i++)
+    {
+        columnLower[i] = columns[i].lower;
+        columnUpper[i] = columns[i].upper;
+        objective[i] = columns[i].objective;
+    }
+    // Rows
+    CoinPackedMatrix matrix(false, 0, 0);
+    matrix.setDimensions(0, int(columns.size()));
+    std::vector<double> rowLower(rows.size());
+    std::vector<double> rowUpper(rows.size());
+    for(size_t i = 0; i < rows.size(); i++)
+    {
+        const MipRow& row = rows[i];
+        matrix.appendRow(CoinPackedVector(int(row.columns.size()), row.columns.data(), row.coefficients.data()));
+        rowLower[i] = row.sense == 'L' ? -infinity : row.rhs;
+        rowUpper[i] = row.sense == 'G' ? infinity : row.rhs;
+    }
+    solver.loadProblem(matrix, columnLower.data(), columnUpper.data(), objective.data(), rowLower.data(), rowUpper.data());
+    for(size_t i = 0; i < columns.size(); i++)
+    {
+        solver.setColName(int(i), columns[i].name);
+        if(columns[i].integer)
+        {
+            solver.setInteger(int(i));
+        }
+    }
+    // Solve using the same driver as the cbc executable
+    CbcModel cbcModel(solver);
+    if(!startValues.empty())
+    {
+        std::vector<std::pair<std::string, double>> start;
+        for(size_t i = 0; i < columns.size(); i++)
+        {
+            start.push_back({columns[i].name, startValues[i]});
+        }
+        cbcModel.setMIPStart(start);
+    }
+    SearchEventHandler searchEventHandler(*this, int(columns.size()), objectiveLowerBound, incumbentValues);
+    cbcModel.passInEventHandler(&searchEventHandler);
+    CbcSolverUsefulData solverData;
+    CbcMain0(cbcModel, solverData);
+    std::vector<const char*> argv;
+    for(const std::string& argument : arguments)
+    {
+        argv.push_back(argument.c_str());
+    }
+    CbcMain1(int(argv.size()), argv.data(), cbcModel, cbcCallback, solverData);
+    if(cancelled())
+    {
+        throw Cancelled();
+    }
+    const double* bestSolution = cbcModel.bestSolution();
+    if(bestSolution == nullptr)
+    {
+        throw Error("No solution found");
+    }
+    values.assign(bestSolution, bestSolution + columns.size());
+    return cbcModel.isProvenOptimal();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void CbcSolverBackend::solve(const SolverProblem& problem, SolverSolution& solution)
+{
+    std::unique_ptr<PassFormulation> passModel = createPassFormulation(problem);
+    std::vector<double> values;
+    initialiseSolution(problem, solution);
+    std::vector<double> startValues;
+    if(!problem.start.empty())
+    {
+        startValues = passModel->startValues(problem.start);
+    }
+    std::function<void(const std::vector<double>&)> incumbentValues;
+    if(mIncumbentCallback)
+    {
+        incumbentValues = [&](const std::vector<double>& incumbent)
+        {
+            reportIncumbent(passModel->decodePalettes(incumbent));
+        };
+    }
+    solution.optimal = solveModel(passModel->model(), cbcArguments(problem), startValues, problem.objectiveLowerBound, incumbentValues, values);
+    passModel->decode(values, solution);
+    // The search stops early when an incumbent reaches the lower bound, which proves it optimal
+    if(solutionObjective(problem, solution) <= problem.objectiveLowerBound)
+    {
+        solution.optimal = true;
+    }
+}
+
+#endif // OVERLAYPAL_LINK_CBC
@@ -0,0 +1,66 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef CBC_SOLVER_BACKEND_H
+#define CBC_SOLVER_BACKEND_H
+
+#ifdef OVERLAYPAL_LINK_CBC
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "SolverBackend.h"
+#include "MipModel.h"
+
+//
+// Solver backend building the model in memory and solving it with a linked-in CBC library.
+//
+// Only available when building with OVERLAYPAL_FEATURES += link_cbc
+//
+class CbcSolverBackend : public SolverBackend
+{
+public:
+    static constexpr const char* Name = "cbc";
+
+    CbcSolverBackend();
+
+    std::string name() const override;
+
+    void solve(const SolverProblem& problem, SolverSolution& solution) override;
+
+protected:
+    std::vector<std::string> cbcArguments(const SolverProblem& problem) const;
+
+    //
+    // Solve with CBC, optionally starting from the given column values (empty for no MIP start).
+    // The search stops as soon as an incumbent reaches objectiveLowerBound.
+    // incumbentValues, when set, is called with the column values of each new incumbent.
+    //
+    bool solveModel(const MipModel& model,
+                    const std::vector<std::string>& arguments,
+                    const std::vector<double>& startValues,
+                    double objectiveLowerBound,
+                    const std::function<void(const std::vector<double>&)>& incumbentValues,
+                    std::vector<double>& values);
+};
+
+#endif // OVERLAYPAL_LINK_CBC
+
+#endif // CBC_SOLVER_BACKEND_H
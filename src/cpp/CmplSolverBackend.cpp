@@ -0,0 +1,318 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <stdexcept>
+#include <fstream>
+#include <streambuf>
+#include <sstream>
+#include <cstdio>
+#include <array>
+#include <vector>
+#include <cassert>
+#include <algorithm>
+#include <charconv>
+
+#include "SubProcess.h"
+#include "MappedFile.h"
+
+#include "CmplSolverBackend.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+
+CmplSolverBackend::CmplSolverBackend()
+{
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::string CmplSolverBackend::name() const
+{
+    return Name;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void CmplSolverBackend::solve(const SolverProblem& problem, SolverSolution& solution)
+{
+    const bool secondPass = problem.pass == SolverPass::Second;
+    const char* programInputFilename = secondPass ? secondPassProgramInputFilename : firstPassProgramInputFilename;
+    const char* programOutputFilename = secondPass ? secondPassProgramOutputFilename : firstPassProgramOutputFilename;
+    const char* solutionFilename = secondPass ? secondPassSolutionFilename : firstPassSolutionFilename;
+    const char* dataFilename = secondPass ? secondPassDataFilename : firstPassDataFilename;
+    // Remove old files
+    std::array<const char*, 3> filenames = {
+        programOutputFilename,
+        dataFilename,
+        solutionFilename
+    };
+    for(const char* filename : filenames)
+    {
+        remove(workPathFilename(filename).c_str());
+    }
+    writeCmplDataFile(problem,
+                      secondPass ? 0 : problem.numPalettes,
+                      workPathFilename(dataFilename));
+    //
+    runCmplProgram(exePathFilename(programInputFilename),
+                   workPathFilename(programOutputFilename),
+                   workPathFilename(solutionFilename),
+                   problem.timeOut,
+                   problem.solverOptions);
+    initialiseSolution(problem, solution);
+    if(!parseCmplSolution(workPathFilename(solutionFilename),
+                          problem.cellClasses,
+                          problem.paletteIndexOffset,
+                          secondPass,
+                          solution))
+    {
+        throw Error(std::string("Failed to parse CMPL result (") + (secondPass ? "second" : "first") + " pass)");
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void CmplSolverBackend::writeCmplCellData(std::ofstream& f, const std::string& name, const std::vector<CellClass>& cellClasses, const Colors& colors, std::function<int(int, int)> const& callback)
+{
+    f << "%" << name.c_str() << "[CELLS, COLORS] <\n";
+    for(int k = 0; k < int(cellClasses.size()); k++)
+    {
+        for(auto c : colors)
+        {
+            int v = callback(k, c);
+            f << v << " ";
+        }
+        f << "\n";
+    }
+    f << ">\n";
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void CmplSolverBackend::writeCmplSymmetryBreakingData(std::ofstream& f, int numCells, bool symmetryBreaking)
+{
+    // Cells are ordered as in the cell class list. Left empty to disable symmetry breaking.
+    const int numOrderedCells = symmetryBreaking ? numCells : 0;
+    f << "%ORDERED_CELLS set < 0.." << numOrderedCells-1 << " >\n";
+    f << "%FIRST_ORDERED_CELL set < 0.." << std::min(numOrderedCells, 1)-1 << " >\n";
+    f << "%LATER_ORDERED_CELLS set < 1.." << numOrderedCells-1 << " >\n";
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void CmplSolverBackend::writeCmplDataFile(const SolverProblem& problem, int maxBackgroundPalettes, const std::string& filename)
+{
+    std::ofstream f(filename, std::ofstream::out);
+    if(!f)
+    {
+        throw std::runtime_error(std::string("Failed to open file '") + filename + "' for writing CMPL input data.");
+    }
+    const std::vector<CellClass>& cellClasses = problem.cellClasses;
+    const int height = int(problem.layer.height());
+    // Limits
+    f << "%CELL_COLOR_LIMIT < " << problem.gridCellColorLimit << " >\n";
+    f << "%MAX_BG_PALETTES < " << maxBackgroundPalettes << " >\n";
+    f << "%BG_PALETTES set < 0.." << maxBackgroundPalettes-1 << " >\n";
+    f << "%MAX_SPR_PALETTES < " << problem.maxSpritePalettes << " >\n";
+    f << "%SPR_PALETTES set < 0.." << problem.maxSpritePalettes-1 << " >\n";
+    f << "%OVERLAY_ROW_SIZE_LIMIT < " << problem.maxRowSize << " >\n";
+    // Cell / Y ranges
+    f << "%CELLS set < 0.." << int(cellClasses.size())-1 << " >\n";
+    f << "%YRANGE set < 0.." << height-1 << " >\n";
+    // All colors present in modelled cells
+    Colors colors;
+    for(const CellClass& cellClass : cellClasses)
+    {
+        colors.insert(cellClass.colors.begin(), cellClass.colors.end());
+    }
+    f << "%COLORS set < ";
+    for(auto c : colors)
+    {
+        f << int(c) << " ";
+    }
+    f << " >\n";
+    // layerColors
+    writeCmplCellData(f, "layerColors", cellClasses, colors, [&](int k, uint8_t c) { return cellClasses[k].colors.count(c) ? 1 : 0; });
+    writeCmplCellData(f, "layerColorColumnCount", cellClasses, colors, [&](int k, uint8_t c) { return cellClasses[k].colors.count(c) ? cellClasses[k].columnCount.at(c) : 0; });
+    // Number of member cells of each cell class in each row
+    f << "%cellRowCount[CELLS, YRANGE] <\n";
+    for(const CellClass& cellClass : cellClasses)
+    {
+        std::vector<int> rowCount(height, 0);
+        for(const auto& cell : cellClass.cells)
+        {
+            rowCount[cell.second]++;
+        }
+        for(int count : rowCount)
+        {
+            f << count << " ";
+        }
+        f << "\n";
+    }
+    f << ">\n";
+    f << "%rowReserved[YRANGE] < ";
+    for(int y = 0; y < height; y++)
+    {
+        f << (y < int(problem.rowReserved.size()) ? problem.rowReserved[y] : 0) << " ";
+    }
+    f << ">\n";
+    writeCmplSymmetryBreakingData(f, int(cellClasses.size()), problem.symmetryBreaking);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void CmplSolverBackend::runCmplProgram(const std::string& inputFilename,
+                                       const std::string& outputFilename,
+                                       const std::string& solutionCsvFilename,
+                                       int timeOut,
+                                       const std::vector<std::pair<std::string, std::string>>& solverOptions)
+{
+    // Make a copy of the original program and prepend timeOut and other CBC parameters to it
+    // This is an ugly work-around for there being no other way(?) to set the CBC timeout parameter :(
+    std::ifstream inputFile(inputFilename, std::ifstream::in);
+    std::string inputFileStr((std::istreambuf_iterator<char>(inputFile)),
+                              std::istreambuf_iterator<char>());
+    inputFile.close();
+    std::ofstream outputFile(outputFilename);
+    if(timeOut)
+    {
+        outputFile << "%opt cbc seconds " << timeOut << "\n";
+    }
+    for(const auto& option : solverOptions)
+    {
+        outputFile << "%opt cbc " << option.first << " " << option.second << "\n";
+    }
+    outputFile << inputFileStr;
+    outputFile.close();
+    // Execute process
+    std::string cmplExecutable("Cmpl/bin/cmpl");
+    std::vector<std::string> params;
+    params.push_back("-i");
+    params.push_back(quoteStringOnWindows(outputFilename));
+    params.push_back("-solutionCsv");
+    params.push_back(quoteStringOnWindows(solutionCsvFilename));
+    int exitCode = runProcess(exePathFilename(cmplExecutable), params, timeOut);
+    if(exitCode != 0)
+    {
+        throw Error("Non-zero exit code from CMPL");
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool CmplSolverBackend::parseSolutionValue(std::string_view line, int (&indices)[2], int& value)
+{
+    // Line is "name[i,j];type;activity;lowerBound;upperBound", with line positioned just after the '['
+    const char* p = line.data();
+    const char* end = p + line.size();
+    auto result = std::from_chars(p, end, indices[0]);
+    if(result.ec != std::errc() || result.ptr == end || *result.ptr != ',')
+        return false;
+    result = std::from_chars(result.ptr + 1, end, indices[1]);
+    if(result.ec != std::errc() || result.ptr == end || *result.ptr != ']')
+        return false;
+    const std::string_view rest(result.ptr + 1, size_t(end - result.ptr - 1));
+    // For currently unknown reasons, the CMPL solution will sometimes have
+    // binary variables changed to integer, so accept both 'B' and 'I'.
+    if(rest.size() < 4 || rest[0] != ';' || (rest[1] != 'B' && rest[1] != 'I') || rest[2] != ';')
+        return false;
+    return std::from_chars(rest.data() + 3, end, value).ec == std::errc();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool CmplSolverBackend::parseCmplSolution(const std::string& csvFilename,
+                                          const std::vector<CellClass>& cellClasses,
+                                          uint8_t paletteIndexOffset,
+                                          bool secondPass,
+                                          SolverSolution& solution)
+{
+    const MappedFile file(csvFilename);
+    std::string_view text = file.contents();
+    // Read data
+    const std::string_view noSolutionString = "No solution has been found";
+    const std::string_view objectiveStatusPrefix = "Objective status;";
+    const std::string_view colorsBackgroundName = secondPass ? "colorsOverlayGrid" : "colorsBG";
+    const std::string_view colorsOverlayName = secondPass ? "colorsOverlayFree" : "colorsOverlay";
+    const std::string_view palettesName = secondPass ? "palettesOverlay" : "palettesBG";
+    const std::string_view usesPaletteName = secondPass ? "usesPaletteOverlay" : "usesPaletteBG";
+    std::string_view line;
+    if(!MappedFile::nextLine(text, line) || line.find("Problem;") == std::string_view::npos)
+    {
+        throw std::runtime_error(std::string("Solution file header unrecognized"));
+    }
+    // Parse values
+    std::vector<Colors>& palettes = solution.palettes;
+    palettes.clear();
+    solution.optimal = false;
+    const int numCells = int(cellClasses.size());
+    int indices[2];
+    int value;
+    while(MappedFile::nextLine(text, line))
+    {
+        const size_t arrayStartPos = line.find('[');
+        if(arrayStartPos == std::string_view::npos)
+        {
+            if(line.substr(0, noSolutionString.size()) == noSolutionString)
+            {
+                throw std::runtime_error(std::string("No solution found"));
+            }
+            else if(line.substr(0, objectiveStatusPrefix.size()) == objectiveStatusPrefix)
+            {
+                solution.optimal = line.find("optimal", objectiveStatusPrefix.size()) != std::string_view::npos;
+            }
+            continue;
+        }
+        // Dispatch on the variable name once. Only variables set to 1 affect the solution.
+        const std::string_view name = line.substr(0, arrayStartPos);
+        const bool colorsBackground = name == colorsBackgroundName;
+        const bool colorsOverlay = name == colorsOverlayName;
+        const bool palette = name == palettesName;
+        const bool usesPalette = name == usesPaletteName;
+        if(!colorsBackground && !colorsOverlay && !palette && !usesPalette)
+            continue;
+        if(!parseSolutionValue(line.substr(arrayStartPos + 1), indices, value))
+            return false;
+        if(value != 1)
+            continue;
+        if(indices[0] < 0 || indices[1] < 0 || indices[1] > 255 || (!palette && indices[0] >= numCells))
+            return false;
+        if(colorsBackground || colorsOverlay)
+        {
+            const int k = indices[0];
+            const int c = indices[1];
+            solution.setCellClassColor(cellClasses[k], uint8_t(c), colorsOverlay);
+        }
+        else if(palette)
+        {
+            const int p = indices[0];
+            const int c = indices[1];
+            if(p >= int(palettes.size()))
+            {
+                palettes.resize(p + 1);
+            }
+            palettes[p].insert(uint8_t(c));
+        }
+        else
+        {
+            const int k = indices[0];
+            const int paletteIndex = indices[1];
+            solution.setCellClassPalette(cellClasses[k], uint8_t(paletteIndex + paletteIndexOffset));
+        }
+    }
+    return true;
+}
@@ -0,0 +1,80 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef CMPL_SOLVER_BACKEND_H
+#define CMPL_SOLVER_BACKEND_H
+
+#include <fstream>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "SolverBackend.h"
+
+//
+// Solver backend running the FirstPass.cmpl / SecondPass.cmpl models through the CMPL executable
+//
+class CmplSolverBackend : public SolverBackend
+{
+public:
+    static constexpr const char* Name = "cmpl";
+
+    CmplSolverBackend();
+
+    std::string name() const override;
+
+    void solve(const SolverProblem& problem, SolverSolution& solution) override;
+
+protected:
+
+    void writeCmplDataFile(const SolverProblem& problem, int maxBackgroundPalettes, const std::string& filename);
+    void writeCmplSymmetryBreakingData(std::ofstream& f, int numCells, bool symmetryBreaking);
+    void writeCmplCellData(std::ofstream& f, const std::string& name, const std::vector<CellClass>& cellClasses, const Colors& colors, std::function<int(int, int)> const& callback);
+
+    void runCmplProgram(const std::string& inputFilename,
+                        const std::string& outputFilename,
+                        const std::string& solutionCsvFilename,
+                        int timeOut,
+                        const std::vector<std::pair<std::string, std::string>>& solverOptions);
+
+    //
+    // Parse the two indices and the activity of a variable line, starting just after the '['.
+    // Returns false if the line is malformed.
+    //
+    static bool parseSolutionValue(std::string_view line, int (&indices)[2], int& value);
+
+    bool parseCmplSolution(const std::string& csvFilename,
+                           const std::vector<CellClass>& cellClasses,
+                           uint8_t paletteIndexOffset,
+                           bool secondPass,
+                           SolverSolution& solution);
+
+private:
+    const char* firstPassProgramInputFilename = "FirstPass.cmpl";
+    const char* firstPassProgramOutputFilename = "FirstPass_withTimeOut.cmpl";
+    const char* firstPassSolutionFilename = "firstpass_output.csv";
+    const char* firstPassDataFilename = "firstpass_input.cdat";
+    const char* secondPassProgramInputFilename = "SecondPass.cmpl";
+    const char* secondPassProgramOutputFilename = "SecondPass_withTimeOut.cmpl";
+    const char* secondPassSolutionFilename = "secondpass_output.csv";
+    const char* secondPassDataFilename = "secondpass_input.cdat";
+};
+
+#endif // CMPL_SOLVER_BACKEND_H
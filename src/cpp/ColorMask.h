@@ -0,0 +1,143 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef COLOR_MASK_H
+#define COLOR_MASK_H
+
+#include <cstdint>
+#include <cassert>
+#include <bitset>
+#include <set>
+
+using Colors = std::set<uint8_t>;
+
+//
+// Set of colors as a bit mask, with bit c set for color c.
+// Grid layers only hold NES colors, which are all below 64.
+//
+using ColorMask = uint64_t;
+
+inline ColorMask colorBit(uint8_t c)
+{
+    assert(c < 64);
+    return ColorMask(1) << c;
+}
+
+inline int colorCount(ColorMask mask)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(mask);
+#else
+    return int(std::bitset<64>(mask).count());
+#endif
+}
+
+//
+// Lowest color in a non-empty mask
+//
+inline uint8_t firstColor(ColorMask mask)
+{
+    assert(mask != 0);
+#if defined(__GNUC__)
+    return uint8_t(__builtin_ctzll(mask));
+#else
+    uint8_t c = 0;
+    while((mask & 1) == 0)
+    {
+        mask >>= 1;
+        c++;
+    }
+    return c;
+#endif
+}
+
+inline ColorMask colorMask(const Colors& colors)
+{
+    ColorMask mask = 0;
+    for(uint8_t c : colors)
+    {
+        mask |= colorBit(c);
+    }
+    return mask;
+}
+
+inline Colors maskColors(ColorMask mask)
+{
+    Colors colors;
+    for(; mask != 0; mask &= mask - 1)
+    {
+        colors.insert(colors.end(), firstColor(mask));
+    }
+    return colors;
+}
+
+//
+// Colors of a mask in increasing order, for iterating with range-based for loops
+//
+class ColorMaskRange
+{
+public:
+    class Iterator
+    {
+    public:
+        explicit Iterator(ColorMask mask):
+            mMask(mask)
+        {
+        }
+
+        uint8_t operator*() const
+        {
+            return firstColor(mMask);
+        }
+
+        Iterator& operator++()
+        {
+            mMask &= mMask - 1;
+            return *this;
+        }
+
+        bool operator!=(const Iterator& other) const
+        {
+            return mMask != other.mMask;
+        }
+
+    private:
+        ColorMask mMask;
+    };
+
+    explicit ColorMaskRange(ColorMask mask):
+        mMask(mask)
+    {
+    }
+
+    Iterator begin() const
+    {
+        return Iterator(mMask);
+    }
+
+    Iterator end() const
+    {
+        return Iterator(0);
+    }
+
+private:
+    ColorMask mMask;
+};
+
+#endif // COLOR_MASK_H
@@ -71,18 +71,21 @@ struct TileNES_8x16_equal
 
 //---------------------------------------------------------------------------------------------------------------------
 
-TileNES_8x8 extractTileNES_8x8(const Image2D& image, int paletteMask, int x, int y, int w, int h, uint8_t p)
+TileNES_8x8 extractTileNES_8x8(const Array2DView<const uint8_t>& tile, int paletteMask, uint8_t p)
 {
     TileNES_8x8 t;
     t.p0 = 0;
     t.p1 = 0;
     uint8_t* p0 = reinterpret_cast<uint8_t*>(&t.p0);
     uint8_t* p1 = reinterpret_cast<uint8_t*>(&t.p1);
+    const int w = tile.width();
+    const int h = tile.height();
     for(int i = 0; i < h; i++)
     {
+        const uint8_t* row = tile.row(i);
         for(int j = 0; j < w; j++)
         {
-            uint8_t c = image(x + j, y + i);
+            uint8_t c = row[j];
             int palIndex = c >> 2;
             bool enabled = (1 << palIndex) & paletteMask;
             if(enabled && palIndex == p)
@@ -118,7 +121,7 @@ static void OutputTileRow(int y,
     for(size_t x = 0; x < nametableGridWidth; x++)
     {
         uint8_t p = paletteIndicesBackground(x / scaleWidth, y / scaleHeight);
-        TileNES_8x8 t = extractTileNES_8x8(image, paletteMask, tileWidth * x, tileHeight * y, tileWidth, tileHeight, p);
+        TileNES_8x8 t = extractTileNES_8x8(Array2DView<const uint8_t>(image, tileWidth * x, tileHeight * y, tileWidth, tileHeight), paletteMask, p);
         if(!tileDataToIndex.count(t))
         {
             tileDataToIndex[t] = tileDataToIndex.size();
@@ -224,7 +227,7 @@ void buildDataNES_BGBanked(const Image2D& image,
         for(size_t x = 0; x < nametableGridWidth; x++)
         {
             uint8_t p = paletteIndicesBackground(x / scaleWidth, y / scaleHeight);
-            TileNES_8x8 t = extractTileNES_8x8(image, paletteMask, tileWidth * x, tileHeight * y, tileWidth, tileHeight, p);
+            TileNES_8x8 t = extractTileNES_8x8(Array2DView<const uint8_t>(image, tileWidth * x, tileHeight * y, tileWidth, tileHeight), paletteMask, p);
             if(!bankMap.count(t))
             {
                 bankMap[t] = bankMap.size();
@@ -260,7 +263,7 @@ void buildDataNES_OAM_8x8(const Image2D& image,
     std::unordered_map<TileNES_8x8, size_t, TileNES_8x8_hash, TileNES_8x8_equal> tileDataToIndex;
     for(const Sprite& s : sprites )
     {
-        TileNES_8x8 t = extractTileNES_8x8(image, paletteMask, s.x, s.y, 8, 8, s.p);
+        TileNES_8x8 t = extractTileNES_8x8(Array2DView<const uint8_t>(image, s.x, s.y, 8, 8), paletteMask, s.p);
         if(!tileDataToIndex.count(t))
         {
             tileDataToIndex[t] = tileDataToIndex.size();
@@ -281,7 +284,7 @@ void buildDataNES_OAM_8x8(const Image2D& image,
 
 void buildDataNES_OAM_8x16(const Image2D& image,
                            int paletteMask,
-                           const std::vector<Sprite> sprites,
+                           const std::vector<Sprite>& sprites,
                            std::vector<uint8_t>& oam,
                            std::vector<uint8_t>& oamCHR)
 {
@@ -290,8 +293,8 @@ void buildDataNES_OAM_8x16(const Image2D& image,
     std::unordered_map<TileNES_8x16, size_t, TileNES_8x16_hash, TileNES_8x16_equal> tileDataToIndex;
     for(const Sprite& s : sprites )
     {
-        TileNES_8x8 tU = extractTileNES_8x8(image, paletteMask, s.x, s.y, 8, 8, s.p);
-        TileNES_8x8 tL = extractTileNES_8x8(image, paletteMask, s.x, s.y + 8, 8, 8, s.p);
+        TileNES_8x8 tU = extractTileNES_8x8(Array2DView<const uint8_t>(image, s.x, s.y, 8, 8), paletteMask, s.p);
+        TileNES_8x8 tL = extractTileNES_8x8(Array2DView<const uint8_t>(image, s.x, s.y + 8, 8, 8), paletteMask, s.p);
         TileNES_8x16 t;
         t.tUp0 = tU.p0;
         t.tUp1 = tU.p1;
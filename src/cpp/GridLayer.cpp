@@ -16,45 +16,129 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 //
 
+#include <array>
+#include <thread>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define GRID_LAYER_AVX2
+#endif
+
 #include "GridLayer.h"
 
 //---------------------------------------------------------------------------------------------------------------------
 
 GridLayer::GridLayer():
-    Array2D()
+    mBackgroundColor(0),
+    mCellWidth(0),
+    mCellHeight(0),
+    mMaxColorsPerCell(0),
+    mColorsPerCellSum(0),
+    mColors(0)
 {
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
 GridLayer::GridLayer(int width, int height):
-    Array2D(width, height)
+    mBackgroundColor(0),
+    mCellWidth(0),
+    mCellHeight(0),
+    mMaxColorsPerCell(0),
+    mColorsPerCellSum(0),
+    mColors(0),
+    mCellColors(width, height, 0)
 {
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-GridLayer::GridLayer(uint8_t backgroundColor, size_t cellWidth, size_t cellHeight, const Image2D &image):
-    Array2D<GridCell>((image.width() + cellWidth - 1) / cellWidth, (image.height() + cellHeight - 1) / cellHeight),
+GridLayer::GridLayer(uint8_t backgroundColor, size_t cellWidth, size_t cellHeight, const Image2D &image, int numThreads,
+                     std::pmr::memory_resource* resource):
     mBackgroundColor(backgroundColor),
     mCellWidth(cellWidth),
     mCellHeight(cellHeight),
     mMaxColorsPerCell(0),
-    mColorsPerCellSum(0)
+    mColorsPerCellSum(0),
+    mColors(0),
+    mCellColors((image.width() + cellWidth - 1) / cellWidth, (image.height() + cellHeight - 1) / cellHeight, 0, resource),
+    mColumnCounts(resource)
 {
-    initializeFromImage(image);
+    initializeFromImage(image, numThreads);
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-GridLayer::GridLayer(uint8_t backgroundColor, size_t cellWidth, size_t cellHeight, size_t width, size_t height):
-    Array2D<GridCell>(width, height),
+GridLayer::GridLayer(uint8_t backgroundColor, size_t cellWidth, size_t cellHeight, size_t width, size_t height,
+                     std::pmr::memory_resource* resource):
     mBackgroundColor(backgroundColor),
     mCellWidth(cellWidth),
     mCellHeight(cellHeight),
     mMaxColorsPerCell(0),
-    mColorsPerCellSum(0)
+    mColorsPerCellSum(0),
+    mColors(0),
+    mCellColors(width, height, 0, resource),
+    mColumnCounts(resource)
+{
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+GridLayer::GridLayer(uint8_t backgroundColor, size_t cellWidth, size_t cellHeight, size_t width, size_t height,
+                     const std::vector<ColorMask>& cellColors, const std::vector<uint8_t>& columnCounts):
+    mBackgroundColor(backgroundColor),
+    mCellWidth(cellWidth),
+    mCellHeight(cellHeight),
+    mMaxColorsPerCell(0),
+    mColorsPerCellSum(0),
+    mColors(0),
+    mCellColors(width, height, 0)
+{
+    assert(cellColors.size() == width * height && columnCounts.size() == 64 * width * height);
+    for(size_t y = 0; y < height; y++)
+    {
+        for(size_t x = 0; x < width; x++)
+        {
+            const ColorMask colors = cellColors[y * width + x];
+            mCellColors(x, y) = colors;
+            mColors |= colors;
+            // Update caches
+            const size_t numColorsInCell = colorCount(colors);
+            mMaxColorsPerCell = std::max(mMaxColorsPerCell, numColorsInCell);
+            mColorsPerCellSum += numColorsInCell;
+        }
+    }
+    mColumnCounts.assign(colorCount(mColors) * width * height, 0);
+    size_t colorIndex = 0;
+    for(uint8_t c : ColorMaskRange(mColors))
+    {
+        for(size_t i = 0; i < width * height; i++)
+        {
+            mColumnCounts[colorIndex * width * height + i] = columnCounts[i * 64 + c];
+        }
+        colorIndex++;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+size_t GridLayer::width() const
 {
+    return mCellColors.width();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+size_t GridLayer::height() const
+{
+    return mCellColors.height();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+uint8_t GridLayer::backgroundColor() const
+{
+    return mBackgroundColor;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -87,55 +171,193 @@ size_t GridLayer::colorsPerCellSum() const
 
 //---------------------------------------------------------------------------------------------------------------------
 
-const std::set<uint8_t> &GridLayer::colors() const
+ColorMask GridLayer::colors() const
 {
     return mColors;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-void GridLayer::initializeFromImage(const Image2D &image)
+ColorMask GridLayer::cellColors(size_t x, size_t y) const
+{
+    return mCellColors(x, y);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void GridLayer::setCellColors(size_t x, size_t y, ColorMask colors)
+{
+    mCellColors(x, y) = colors;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void GridLayer::addCellColor(size_t x, size_t y, uint8_t c)
+{
+    mCellColors(x, y) |= colorBit(c);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int GridLayer::columnCount(size_t x, size_t y, uint8_t c) const
+{
+    if((mColors & colorBit(c)) == 0 || mColumnCounts.empty())
+        return 0;
+    // Colors below c come first
+    const size_t colorIndex = colorCount(mColors & (colorBit(c) - 1));
+    return mColumnCounts[(colorIndex * height() + y) * width() + x];
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+#ifdef GRID_LAYER_AVX2
+//
+// Four pixels at a time: widen their colors to 64-bit lanes and shift a bit into place in each lane
+//
+__attribute__((target("avx2")))
+static void addPixelColorsAvx2(const uint8_t* pixels, size_t numPixels, ColorMask* columnColors)
+{
+    const __m256i one = _mm256_set1_epi64x(1);
+    size_t x = 0;
+    for(; x + 16 <= numPixels; x += 16)
+    {
+        __m128i colors = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + x));
+        for(size_t i = 0; i < 16; i += 4)
+        {
+            __m256i* destination = reinterpret_cast<__m256i*>(columnColors + x + i);
+            const __m256i bits = _mm256_sllv_epi64(one, _mm256_cvtepu8_epi64(colors));
+            _mm256_storeu_si256(destination, _mm256_or_si256(_mm256_loadu_si256(destination), bits));
+            colors = _mm_srli_si128(colors, 4);
+        }
+    }
+    for(; x < numPixels; x++)
+    {
+        columnColors[x] |= colorBit(pixels[x]);
+    }
+}
+#endif
+
+//---------------------------------------------------------------------------------------------------------------------
+
+//
+// Add the color of each pixel in a row to the color mask of its column
+//
+static void addPixelColors(const uint8_t* pixels, size_t numPixels, ColorMask* columnColors)
 {
-    const int imageWidth = cellWidth() * width();
-    const int imageHeight = cellHeight() * height();
+#ifdef GRID_LAYER_AVX2
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+    if(hasAvx2)
+    {
+        addPixelColorsAvx2(pixels, numPixels, columnColors);
+        return;
+    }
+#endif
+    for(size_t x = 0; x < numPixels; x++)
+    {
+        columnColors[x] |= colorBit(pixels[x]);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+//
+// Call f with consecutive ranges of rows that together cover all rows, each range on its own thread
+//
+template<typename F>
+static void forEachRowRange(size_t numRows, int numThreads, F f)
+{
+    numThreads = std::max(1, std::min(numThreads, int(numRows)));
+    if(numThreads == 1)
+    {
+        f(0, numRows);
+        return;
+    }
+    std::vector<std::thread> threads;
+    for(int i = 1; i < numThreads; i++)
+    {
+        threads.emplace_back(f, numRows * i / numThreads, numRows * (i + 1) / numThreads);
+    }
+    f(0, numRows / numThreads);
+    for(std::thread& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void GridLayer::initializeFromImage(const Image2D &image, int numThreads)
+{
+    assert(cellWidth() <= 255 && "Column counts must fit in 8 bits");
+    // Threads only pay off for large images
+    const size_t MinPixelsPerThread = 64 * 1024;
+    const size_t imageWidth = std::min(image.width(), cellWidth() * width());
+    const size_t imageHeight = std::min(image.height(), cellHeight() * height());
+    numThreads = int(std::min(size_t(std::max(numThreads, 1)), std::max(imageWidth * imageHeight / MinPixelsPerThread, size_t(1))));
     mMaxColorsPerCell = 0;
     mColorsPerCellSum = 0;
-    mColors.clear();
-    for(int Y = 0; Y < height(); Y++)
+    mColors = 0;
+    // Colors of each pixel column of each cell row, from a single scan over the image rows.
+    // Background pixels are added along with all others and removed afterwards.
+    const ColorMask background = colorBit(mBackgroundColor);
+    Array2D<ColorMask> columnColors(cellWidth() * width(), height(), 0, mCellColors.resource());
+    forEachRowRange(height(), numThreads, [&](size_t firstRow, size_t lastRow)
     {
-        for(int X = 0; X < width(); X++)
+        for(size_t Y = firstRow; Y < lastRow; Y++)
         {
-            GridCell cell;
-            for(int x = 0; x < cellWidth(); x++)
+            ColorMask* rowColumnColors = columnColors.row(Y);
+            for(size_t srcY = Y * cellHeight(); srcY < std::min((Y + 1) * cellHeight(), imageHeight); srcY++)
             {
-                std::set<uint8_t> columnColors;
-                for(int y = 0; y < cellHeight(); y++)
-                {
-                    int srcX = X * cellWidth() + x;
-                    int srcY = Y * cellHeight() + y;
-                    if(srcX >= 0 && srcX < imageWidth && srcY >= 0 && srcY < imageHeight)
-                    {
-                        uint8_t c = image(srcX, srcY);
-                        if(c != mBackgroundColor)
-                        {
-                            cell.colors.insert(c);
-                            cell.pixelCount[c]++;
-                            columnColors.insert(c);
-                            mColors.insert(c);
-                        }
-                    }
-                }
-                for(uint8_t c : columnColors)
+                addPixelColors(image.row(srcY), imageWidth, rowColumnColors);
+            }
+            for(size_t x = 0; x < columnColors.width(); x++)
+            {
+                rowColumnColors[x] &= ~background;
+            }
+            for(size_t X = 0; X < width(); X++)
+            {
+                ColorMask colors = 0;
+                for(size_t x = 0; x < cellWidth(); x++)
                 {
-                    cell.columnCount[c]++;
+                    colors |= rowColumnColors[X * cellWidth() + x];
                 }
+                mCellColors(X, Y) = colors;
             }
-            (*this)(X, Y) = cell;
+        }
+    });
+    for(size_t Y = 0; Y < height(); Y++)
+    {
+        for(size_t X = 0; X < width(); X++)
+        {
+            const ColorMask colors = mCellColors(X, Y);
+            mColors |= colors;
             // Update caches
-            std::set<uint8_t> colors = cell.colors;
-            size_t numColorsInCell = colors.size();
+            const size_t numColorsInCell = colorCount(colors);
             mMaxColorsPerCell = std::max(mMaxColorsPerCell, numColorsInCell);
             mColorsPerCellSum += numColorsInCell;
         }
     }
+    // Index of each color among the layer colors, which is the array its column counts are kept in
+    std::array<uint8_t, 64> colorIndices{};
+    for(uint8_t c : ColorMaskRange(mColors))
+    {
+        colorIndices[c] = uint8_t(colorCount(mColors & (colorBit(c) - 1)));
+    }
+    mColumnCounts.assign(colorCount(mColors) * width() * height(), 0);
+    forEachRowRange(height(), numThreads, [&](size_t firstRow, size_t lastRow)
+    {
+        for(size_t Y = firstRow; Y < lastRow; Y++)
+        {
+            for(size_t X = 0; X < width(); X++)
+            {
+                for(size_t x = 0; x < cellWidth(); x++)
+                {
+                    for(uint8_t c : ColorMaskRange(columnColors(X * cellWidth() + x, Y)))
+                    {
+                        mColumnCounts[(colorIndices[c] * height() + Y) * width() + X]++;
+                    }
+                }
+            }
+        }
+    });
 }
@@ -20,42 +20,49 @@
 #ifndef GRID_LAYER_H
 #define GRID_LAYER_H
 
-#include <set>
-#include <unordered_map>
+#include <vector>
+#include <memory_resource>
 #include <algorithm>
 #include <cassert>
 
 #include "Array2D.h"
+#include "ColorMask.h"
 
-using Colors = std::set<uint8_t>;
-
-//
-// Represent a grid cell for color mapping purposes.
 //
-struct GridCell
-{
-    Colors colors;
-    std::unordered_map<uint8_t, int> pixelCount;
-    std::unordered_map<uint8_t, int> columnCount;
-    size_t numColors() const
-    {
-        return colors.size();
-    }
-};
-
+// Class to represent the division of an indexed image into discrete grid cells.
 //
-// Class to represent the division of an indexed image into discrete grid cells
+// Cells are stored as arrays of per-cell values rather than as cell objects: one array of color masks,
+// and for layers built from an image, one array of column counts per color of the layer.
 //
-class GridLayer : public Array2D<GridCell>
+class GridLayer
 {
 public:
     GridLayer();
 
     GridLayer(int width, int height);
 
-    GridLayer(uint8_t backgroundColor, size_t cellWidth, size_t cellHeight, const Image2D& image);
+    //
+    // Build a layer from an image, splitting the work between up to numThreads threads for large images.
+    // Cell storage is allocated from resource.
+    //
+    GridLayer(uint8_t backgroundColor, size_t cellWidth, size_t cellHeight, const Image2D& image, int numThreads = 1,
+              std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+    GridLayer(uint8_t backgroundColor, size_t cellWidth, size_t cellHeight, size_t width, size_t height,
+              std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+    //
+    // Build a layer from the colors of each cell and the number of pixel columns of each cell that contain
+    // each color, with cells in row order and counts indexed by cell index * 64 + color
+    //
+    GridLayer(uint8_t backgroundColor, size_t cellWidth, size_t cellHeight, size_t width, size_t height,
+              const std::vector<ColorMask>& cellColors, const std::vector<uint8_t>& columnCounts);
+
+    size_t width() const;
 
-    GridLayer(uint8_t backgroundColor, size_t cellWidth, size_t cellHeight, size_t width, size_t height);
+    size_t height() const;
+
+    uint8_t backgroundColor() const;
 
     size_t cellWidth() const;
 
@@ -65,10 +72,28 @@ public:
 
     size_t colorsPerCellSum() const;
 
-    const std::set<uint8_t>& colors() const;
+    //
+    // Colors of all cells of a layer built from an image
+    //
+    ColorMask colors() const;
+
+    //
+    // Colors of the cell at (x, y)
+    //
+    ColorMask cellColors(size_t x, size_t y) const;
+
+    void setCellColors(size_t x, size_t y, ColorMask colors);
+
+    void addCellColor(size_t x, size_t y, uint8_t c);
+
+    //
+    // Number of pixel columns of the cell at (x, y) that contain color c.
+    // Column counts are only kept for layers built from an image, and are 0 in all other layers.
+    //
+    int columnCount(size_t x, size_t y, uint8_t c) const;
 
 protected:
-    void initializeFromImage(const Image2D& image);
+    void initializeFromImage(const Image2D& image, int numThreads);
 
 private:
     uint8_t mBackgroundColor;
@@ -76,9 +101,10 @@ private:
     size_t mCellHeight;
     size_t mMaxColorsPerCell;
     size_t mColorsPerCellSum;
-    std::set<uint8_t> mColors;
+    ColorMask mColors;
+    Array2D<ColorMask> mCellColors;
+    // One array per color of mColors in increasing color order, each with a count for every cell
+    std::pmr::vector<uint8_t> mColumnCounts;
 };
 
-
-
 #endif // GRID_LAYER_H
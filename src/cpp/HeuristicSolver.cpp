@@ -0,0 +1,474 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <map>
+#include <bitset>
+#include <iterator>
+
+#include "HeuristicSolver.h"
+#include "PassBounds.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+
+HeuristicSolver::HeuristicSolver(const SolverProblem& problem):
+    mProblem(problem)
+{
+    for(const CellClass& cellClass : problem.cellClasses)
+    {
+        mColors.insert(cellClass.colors.begin(), cellClass.colors.end());
+        std::map<int, int> rowCount;
+        for(const auto& cell : cellClass.cells)
+        {
+            rowCount[cell.second]++;
+        }
+        mRowCounts.emplace_back(rowCount.begin(), rowCount.end());
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int HeuristicSolver::movedWeight(size_t k, const Colors& grid) const
+{
+    const CellClass& cellClass = mProblem.cellClasses[k];
+    int weight = 0;
+    for(uint8_t c : cellClass.colors)
+    {
+        if(grid.count(c) == 0)
+        {
+            weight += cellClass.columnCount.at(c);
+        }
+    }
+    return weight;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int HeuristicSolver::objective(const CellAssignment& assignment) const
+{
+    int weight = 0;
+    for(size_t k = 0; k < mProblem.cellClasses.size(); k++)
+    {
+        weight += movedWeight(k, assignment.grid[k]);
+    }
+    return weight;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool HeuristicSolver::feasible(const CellAssignment& assignment) const
+{
+    const std::vector<CellClass>& cellClasses = mProblem.cellClasses;
+    const bool secondPass = mProblem.pass == SolverPass::Second;
+    const size_t limit = size_t(mProblem.gridCellColorLimit);
+    if(assignment.grid.size() != cellClasses.size() ||
+       assignment.palette.size() != cellClasses.size() ||
+       assignment.palettes.size() > size_t(mProblem.numPalettes))
+    {
+        return false;
+    }
+    for(const Colors& palette : assignment.palettes)
+    {
+        if(palette.size() > limit)
+            return false;
+    }
+    std::vector<int> rowUsage(mProblem.layer.height(), 0);
+    for(size_t y = 0; y < mProblem.rowReserved.size() && y < rowUsage.size(); y++)
+    {
+        rowUsage[y] = mProblem.rowReserved[y];
+    }
+    Colors movedTotal;
+    int highestUsedPalette = -1;
+    for(size_t k = 0; k < cellClasses.size(); k++)
+    {
+        const Colors& colors = cellClasses[k].colors;
+        const Colors& grid = assignment.grid[k];
+        const int p = assignment.palette[k];
+        if(p < 0 || p >= mProblem.numPalettes || grid.size() > limit)
+            return false;
+        if(!std::includes(colors.begin(), colors.end(), grid.begin(), grid.end()))
+            return false;
+        if(!grid.empty())
+        {
+            if(size_t(p) >= assignment.palettes.size())
+                return false;
+            const Colors& palette = assignment.palettes[p];
+            if(!std::includes(palette.begin(), palette.end(), grid.begin(), grid.end()))
+                return false;
+        }
+        // Palettes must be numbered in order of first use
+        if(mProblem.symmetryBreaking)
+        {
+            if(p > highestUsedPalette + 1)
+                return false;
+            highestUsedPalette = std::max(highestUsedPalette, p);
+        }
+        const int numMoved = int(colors.size() - grid.size());
+        for(uint8_t c : colors)
+        {
+            if(grid.count(c) == 0)
+            {
+                movedTotal.insert(c);
+            }
+        }
+        const int usage = secondPass ? (grid.empty() ? 0 : 1) + numMoved : (numMoved > 0 ? 1 : 0);
+        for(const auto& rowCount : mRowCounts[k])
+        {
+            rowUsage[rowCount.first] += rowCount.second * usage;
+        }
+    }
+    for(int usage : rowUsage)
+    {
+        if(usage > mProblem.maxRowSize)
+            return false;
+    }
+    if(movedTotal.size() > size_t(mProblem.maxSpritePalettes * mProblem.gridCellColorLimit))
+        return false;
+    // Free colors must be available in some overlay palette
+    if(secondPass)
+    {
+        for(uint8_t c : movedTotal)
+        {
+            bool inPalette = std::any_of(assignment.palettes.begin(), assignment.palettes.end(), [c](const Colors& palette)
+            {
+                return palette.count(c) > 0;
+            });
+            if(!inPalette)
+                return false;
+        }
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool HeuristicSolver::addFreeColorsToPalettes(CellAssignment& assignment) const
+{
+    const size_t limit = size_t(mProblem.gridCellColorLimit);
+    for(size_t k = 0; k < mProblem.cellClasses.size(); k++)
+    {
+        for(uint8_t c : mProblem.cellClasses[k].colors)
+        {
+            if(assignment.grid[k].count(c))
+                continue;
+            bool inPalette = std::any_of(assignment.palettes.begin(), assignment.palettes.end(), [c](const Colors& palette)
+            {
+                return palette.count(c) > 0;
+            });
+            if(inPalette)
+                continue;
+            auto it = std::find_if(assignment.palettes.begin(), assignment.palettes.end(), [limit](const Colors& palette)
+            {
+                return palette.size() < limit;
+            });
+            if(it == assignment.palettes.end())
+                return false;
+            it->insert(c);
+        }
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void HeuristicSolver::orderPalettesByFirstUse(CellAssignment& assignment) const
+{
+    const int numPalettes = int(assignment.palettes.size());
+    std::vector<int> newIndex(numPalettes, -1);
+    int next = 0;
+    for(int p : assignment.palette)
+    {
+        if(newIndex[p] < 0)
+        {
+            newIndex[p] = next++;
+        }
+    }
+    for(int p = 0; p < numPalettes; p++)
+    {
+        if(newIndex[p] < 0)
+        {
+            newIndex[p] = next++;
+        }
+    }
+    std::vector<Colors> palettes(numPalettes);
+    for(int p = 0; p < numPalettes; p++)
+    {
+        palettes[newIndex[p]] = std::move(assignment.palettes[p]);
+    }
+    assignment.palettes = std::move(palettes);
+    for(int& p : assignment.palette)
+    {
+        p = newIndex[p];
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool HeuristicSolver::greedy(CellAssignment& assignment) const
+{
+    const std::vector<CellClass>& cellClasses = mProblem.cellClasses;
+    const size_t limit = size_t(mProblem.gridCellColorLimit);
+    if(mProblem.numPalettes <= 0)
+        return false;
+    assignment.palettes.assign(mProblem.numPalettes, Colors());
+    assignment.grid.assign(cellClasses.size(), Colors());
+    assignment.palette.assign(cellClasses.size(), 0);
+    // Heaviest cells get to shape the palettes first
+    std::vector<int> totalWeight(cellClasses.size());
+    for(size_t k = 0; k < cellClasses.size(); k++)
+    {
+        totalWeight[k] = movedWeight(k, Colors());
+    }
+    std::vector<size_t> order(cellClasses.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+    {
+        return totalWeight[a] > totalWeight[b];
+    });
+    // In the second pass, every color ends up in some palette, either as grid color or as free color.
+    // Duplicating a color in another palette is therefore only allowed while there are more free palette
+    // entries than colors missing from all palettes.
+    const bool secondPass = mProblem.pass == SolverPass::Second;
+    Colors covered;
+    int duplicateSlack = std::numeric_limits<int>::max();
+    if(secondPass)
+    {
+        duplicateSlack = mProblem.numPalettes * mProblem.gridCellColorLimit - int(mColors.size());
+        if(duplicateSlack < 0)
+            return false;
+    }
+    for(size_t k : order)
+    {
+        const CellClass& cellClass = cellClasses[k];
+        // Colors by decreasing weight, so that the heaviest ones are added to a palette first
+        std::vector<uint8_t> colors(cellClass.colors.begin(), cellClass.colors.end());
+        std::stable_sort(colors.begin(), colors.end(), [&](uint8_t a, uint8_t b)
+        {
+            return cellClass.columnCount.at(a) > cellClass.columnCount.at(b);
+        });
+        int bestPalette = 0;
+        int bestMoved = totalWeight[k] + 1;
+        size_t bestAdded = 0;
+        Colors bestGrid;
+        for(int p = 0; p < mProblem.numPalettes; p++)
+        {
+            const Colors& palette = assignment.palettes[p];
+            Colors grid;
+            size_t added = 0;
+            int duplicateBudget = duplicateSlack;
+            for(uint8_t c : colors)
+            {
+                if(palette.count(c))
+                {
+                    grid.insert(c);
+                }
+                else if(palette.size() + added < limit)
+                {
+                    if(secondPass && covered.count(c))
+                    {
+                        if(duplicateBudget == 0)
+                            continue;
+                        duplicateBudget--;
+                    }
+                    grid.insert(c);
+                    added++;
+                }
+            }
+            const int moved = movedWeight(k, grid);
+            if(moved < bestMoved || (moved == bestMoved && added < bestAdded))
+            {
+                bestPalette = p;
+                bestMoved = moved;
+                bestAdded = added;
+                bestGrid = std::move(grid);
+            }
+        }
+        for(uint8_t c : bestGrid)
+        {
+            if(secondPass && assignment.palettes[bestPalette].count(c) == 0 && !covered.insert(c).second)
+            {
+                duplicateSlack--;
+            }
+        }
+        assignment.palettes[bestPalette].insert(bestGrid.begin(), bestGrid.end());
+        assignment.grid[k] = std::move(bestGrid);
+        assignment.palette[k] = bestPalette;
+    }
+    if(secondPass && !addFreeColorsToPalettes(assignment))
+        return false;
+    orderPalettesByFirstUse(assignment);
+    return feasible(assignment);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void HeuristicSolver::assignCell(size_t k, CellAssignment& assignment) const
+{
+    const Colors& colors = mProblem.cellClasses[k].colors;
+    int bestMoved = std::numeric_limits<int>::max();
+    for(size_t p = 0; p < assignment.palettes.size(); p++)
+    {
+        const Colors& palette = assignment.palettes[p];
+        Colors grid;
+        std::set_intersection(colors.begin(), colors.end(),
+                              palette.begin(), palette.end(),
+                              std::inserter(grid, grid.end()));
+        const int moved = movedWeight(k, grid);
+        if(moved < bestMoved)
+        {
+            bestMoved = moved;
+            assignment.grid[k] = std::move(grid);
+            assignment.palette[k] = int(p);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void HeuristicSolver::assignCells(CellAssignment& assignment) const
+{
+    const size_t numCellClasses = mProblem.cellClasses.size();
+    assignment.grid.assign(numCellClasses, Colors());
+    assignment.palette.assign(numCellClasses, 0);
+    for(size_t k = 0; k < numCellClasses; k++)
+    {
+        assignCell(k, assignment);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool HeuristicSolver::fromPalettes(const std::vector<Colors>& palettes, CellAssignment& assignment) const
+{
+    if(mProblem.numPalettes <= 0 || palettes.size() > size_t(mProblem.numPalettes))
+        return false;
+    assignment.palettes = palettes;
+    assignment.palettes.resize(mProblem.numPalettes);
+    assignCells(assignment);
+    orderPalettesByFirstUse(assignment);
+    return feasible(assignment);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int HeuristicSolver::palettesObjective(const std::vector<Colors>& palettes) const
+{
+    std::vector<std::bitset<256>> paletteBits(palettes.size());
+    for(size_t p = 0; p < palettes.size(); p++)
+    {
+        for(uint8_t c : palettes[p])
+        {
+            paletteBits[p].set(c);
+        }
+    }
+    int objective = 0;
+    for(const CellClass& cellClass : mProblem.cellClasses)
+    {
+        int total = 0;
+        int bestKept = 0;
+        for(const auto& columnCount : cellClass.columnCount)
+        {
+            total += columnCount.second;
+        }
+        for(const std::bitset<256>& bits : paletteBits)
+        {
+            int kept = 0;
+            for(const auto& columnCount : cellClass.columnCount)
+            {
+                if(bits.test(columnCount.first))
+                {
+                    kept += columnCount.second;
+                }
+            }
+            bestKept = std::max(bestKept, kept);
+        }
+        objective += total - bestKept;
+    }
+    return objective;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void HeuristicSolver::localSearch(CellAssignment& assignment) const
+{
+    const size_t limit = size_t(mProblem.gridCellColorLimit);
+    const int MaxIterations = 100;
+    // Palettes are padded to the full palette count, so that unused palettes can also receive colors
+    std::vector<Colors> palettes = assignment.palettes;
+    palettes.resize(mProblem.numPalettes);
+    int bestObjective = objective(assignment);
+    // Each iteration accepts the first improving change of a single palette color
+    for(int iteration = 0; iteration < MaxIterations && bestObjective > 0; iteration++)
+    {
+        bool improved = false;
+        auto tryPalettes = [&](const std::vector<Colors>& candidate)
+        {
+            const int candidateObjective = palettesObjective(candidate);
+            if(candidateObjective >= bestObjective)
+                return false;
+            CellAssignment candidateAssignment;
+            candidateAssignment.palettes = candidate;
+            assignCells(candidateAssignment);
+            orderPalettesByFirstUse(candidateAssignment);
+            if(!feasible(candidateAssignment))
+                return false;
+            assignment = std::move(candidateAssignment);
+            palettes = candidate;
+            bestObjective = candidateObjective;
+            return true;
+        };
+        for(size_t p = 0; p < palettes.size() && !improved; p++)
+        {
+            for(uint8_t c : mColors)
+            {
+                if(palettes[p].count(c))
+                    continue;
+                std::vector<Colors> candidate = palettes;
+                if(palettes[p].size() < limit)
+                {
+                    candidate[p].insert(c);
+                    if((improved = tryPalettes(candidate)))
+                        break;
+                    candidate[p].erase(c);
+                }
+                for(uint8_t d : palettes[p])
+                {
+                    candidate[p].erase(d);
+                    candidate[p].insert(c);
+                    if((improved = tryPalettes(candidate)))
+                        break;
+                    candidate[p].erase(c);
+                    candidate[p].insert(d);
+                }
+                if(improved)
+                    break;
+            }
+        }
+        if(!improved)
+            break;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int HeuristicSolver::lowerBound() const
+{
+    return movedColumnsLowerBound(mProblem);
+}
@@ -0,0 +1,107 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef HEURISTIC_SOLVER_H
+#define HEURISTIC_SOLVER_H
+
+#include <vector>
+#include <utility>
+
+#include "SolverBackend.h"
+
+//
+// Fast non-optimal solving of the FirstPass / SecondPass problems, working directly on the cell classes.
+//
+class HeuristicSolver
+{
+public:
+    HeuristicSolver(const SolverProblem& problem);
+
+    //
+    // Build palettes greedily, visiting cell classes in order of decreasing weight and giving each the
+    // palette that lets it keep the most weight in the grid.
+    // Returns false if the result breaks any constraint of the problem.
+    //
+    bool greedy(CellAssignment& assignment) const;
+
+    //
+    // Improve a feasible assignment by adding colors to palettes and swapping palette colors,
+    // moving every cell class to its best palette after each change.
+    // Changes are only kept when they lower the objective and the result stays feasible.
+    //
+    void localSearch(CellAssignment& assignment) const;
+
+    //
+    // Assignment with the given palettes, moving every cell class to its best palette.
+    // Returns false if the result breaks any constraint of the problem.
+    //
+    bool fromPalettes(const std::vector<Colors>& palettes, CellAssignment& assignment) const;
+
+    //
+    // Move a single cell class to the palette that lets it keep the most weight in the grid
+    //
+    void assignCell(size_t k, CellAssignment& assignment) const;
+
+    //
+    // Lower bound on the objective, as given by movedColumnsLowerBound()
+    //
+    int lowerBound() const;
+
+    //
+    // Check an assignment against all constraints of the problem
+    //
+    bool feasible(const CellAssignment& assignment) const;
+
+    //
+    // Summed column count of moved colors
+    //
+    int objective(const CellAssignment& assignment) const;
+
+protected:
+    //
+    // Add moved colors that are missing from all palettes to palettes with room left (second pass only)
+    //
+    bool addFreeColorsToPalettes(CellAssignment& assignment) const;
+
+    //
+    // Renumber palettes in order of first use by the cell classes, as required by the symmetry breaking constraints
+    //
+    void orderPalettesByFirstUse(CellAssignment& assignment) const;
+
+    //
+    // Give every cell class the palette that lets it keep the most weight in the grid
+    //
+    void assignCells(CellAssignment& assignment) const;
+
+    //
+    // Objective of assignCells() for the given palettes, without building the assignment
+    //
+    int palettesObjective(const std::vector<Colors>& palettes) const;
+
+    int movedWeight(size_t k, const Colors& grid) const;
+
+private:
+    const SolverProblem& mProblem;
+    // All colors of the modelled cells
+    Colors mColors;
+    // Number of member cells of each cell class in each row, as (row, count) pairs
+    std::vector<std::vector<std::pair<int, int>>> mRowCounts;
+};
+
+#endif // HEURISTIC_SOLVER_H
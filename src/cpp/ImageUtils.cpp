@@ -24,6 +24,7 @@
 
 #include "Array2D.h"
 #include "GridLayer.h"
+#include "ShiftedGridLayers.h"
 
 //---------------------------------------------------------------------------------------------------------------------
 
@@ -59,6 +60,23 @@ std::unordered_map<uint8_t, size_t> colorCounts(const Image2D& image)
 
 //---------------------------------------------------------------------------------------------------------------------
 
+bool imagesEqual(const Image2D& a, const Image2D& b)
+{
+    if(a.width() != b.width() || a.height() != b.height())
+        return false;
+    for(size_t y = 0; y < a.height(); y++)
+    {
+        for(size_t x = 0; x < a.width(); x++)
+        {
+            if(a(x, y) != b(x, y))
+                return false;
+        }
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
 Image2D shiftImage(const Image2D& image, int shiftX, int shiftY)
 {
     const int w = image.width();
@@ -80,27 +98,22 @@ Image2D shiftImage(const Image2D& image, int shiftX, int shiftY)
 
 Image2D shiftImageOptimal(const Image2D& image, uint8_t backgroundColor, int cellWidth, int cellHeight, int minX, int maxX, int minY, int maxY, int& shiftX, int& shiftY)
 {
-    const int w = image.width();
-    const int h = image.height();
     std::map<std::pair<int, int>, int> shiftCosts;
     auto bestCostXY = std::make_pair(minX, minY);
     shiftCosts[bestCostXY] = std::numeric_limits<int>::max();
-    for(int y = minY; y <= maxY; y++)
+    ShiftedGridLayers layers(backgroundColor, cellWidth, cellHeight, image, minX, maxX, minY, maxY);
+    do
     {
-        for(int x = minX; x <= maxX; x++)
+        // Just use sum of colors per cell as cost for now
+        int cost = layers.colorsPerCellSum();
+        auto costXY = std::make_pair(layers.shiftX(), layers.shiftY());
+        shiftCosts[costXY] = cost;
+        if(cost < shiftCosts[bestCostXY])
         {
-            Image2D shiftedImage = shiftImage(image, x, y);
-            GridLayer layer(backgroundColor, cellWidth, cellHeight, shiftedImage);
-            // Just use sum of colors per cell as cost for now
-            int cost = layer.colorsPerCellSum();
-            auto costXY = std::make_pair(x, y);
-            shiftCosts[costXY] = cost;
-            if(cost < shiftCosts[bestCostXY])
-            {
-                bestCostXY = costXY;
-            }
+            bestCostXY = costXY;
         }
     }
+    while(layers.next());
     shiftX = bestCostXY.first;
     shiftY = bestCostXY.second;
     Image2D shiftedImage = shiftImage(image, shiftX, shiftY);
@@ -109,16 +122,21 @@ Image2D shiftImageOptimal(const Image2D& image, uint8_t backgroundColor, int cel
 
 //---------------------------------------------------------------------------------------------------------------------
 
-bool isSubSet(const std::set<uint8_t>& s1, const std::set<uint8_t>& s2)
+bool isSubSet(ColorMask s1, ColorMask s2)
 {
-    for(uint8_t c : s1)
+    return (s1 & ~s2) == 0;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static std::vector<ColorMask> paletteColorMasks(const std::vector<Colors>& palettes)
+{
+    std::vector<ColorMask> masks;
+    for(const Colors& palette : palettes)
     {
-        if(s2.count(c) == 0)
-        {
-            return false;
-        }
+        masks.push_back(colorMask(palette));
     }
-    return true;
+    return masks;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -131,13 +149,14 @@ std::vector<ContinuousPaletteRange> getBestContinuousRanges(const GridLayer& lay
 {
     std::vector<ContinuousPaletteRange> ranges;
     std::map<size_t, std::set<size_t>> validPaletteIndices;
+    const std::vector<ColorMask> paletteColors = paletteColorMasks(palettes);
     for(size_t x = 0; x < layer.width(); x++)
     {
         for(size_t i = paletteIndicesOffset; i < palettes.size(); i++)
         {
-            const std::set<uint8_t>& cellColors = layer(x, y).colors;
-            if(cellColors.size() > 0 &&
-               isSubSet(cellColors, palettes[i]))
+            const ColorMask cellColors = layer.cellColors(x, y);
+            if(cellColors != 0 &&
+               isSubSet(cellColors, paletteColors[i]))
             {
                 validPaletteIndices[x].insert(i);
             }
@@ -222,24 +241,21 @@ void optimizeUnnecessaryOverlayColors(GridLayer& layerBackground,
     assert(paletteIndices.width() == layerBackground.width());
     assert(paletteIndices.height() == layerBackground.height());
     assert(paletteIndicesOffset < palettes.size());
+    const std::vector<ColorMask> paletteColors = paletteColorMasks(palettes);
     for(size_t y = 0; y < layerBackground.height(); y++)
     {
         for(size_t x = 0; x < layerBackground.width(); x++)
         {
-            Colors& colorsBackground = layerBackground(x, y).colors;
-            Colors& colorsOverlay = layerOverlay(x, y).colors;
             // Get union
-            Colors colorsAll = colorsBackground;
-            colorsAll.insert(colorsOverlay.begin(), colorsOverlay.end());
+            const ColorMask colorsAll = layerBackground.cellColors(x, y) | layerOverlay.cellColors(x, y);
             // If any palette is a superset of all colors, use it and
             // move colors into background layer
             for(size_t i = paletteIndicesOffset; i < palettes.size(); i++)
             {
-                const Colors& paletteColors = palettes[i];
-                if(isSubSet(colorsAll, paletteColors))
+                if(isSubSet(colorsAll, paletteColors[i]))
                 {
-                    colorsBackground = colorsAll;
-                    colorsOverlay.clear();
+                    layerBackground.setCellColors(x, y, colorsAll);
+                    layerOverlay.setCellColors(x, y, 0);
                     paletteIndices(x, y) = i;
                     break;
                 }
@@ -31,6 +31,11 @@
 //
 std::unordered_map<uint8_t, size_t> colorCounts(const Image2D& image);
 
+//
+// Check whether two images have the same size and pixels
+//
+bool imagesEqual(const Image2D& a, const Image2D& b);
+
 //
 // Created a shifted image from an original image
 //
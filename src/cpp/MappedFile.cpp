@@ -0,0 +1,168 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "MappedFile.h"
+
+#ifdef _WIN32
+
+//---------------------------------------------------------------------------------------------------------------------
+
+MappedFile::MappedFile(const std::string& filename):
+    mData(nullptr),
+    mSize(0),
+    mFileHandle(INVALID_HANDLE_VALUE),
+    mMappingHandle(nullptr)
+{
+    mFileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LARGE_INTEGER size;
+    if(mFileHandle == INVALID_HANDLE_VALUE || !GetFileSizeEx(mFileHandle, &size))
+    {
+        release();
+        throw Error(std::string("Failed to open file: ") + filename);
+    }
+    mSize = size_t(size.QuadPart);
+    // Empty files cannot be mapped
+    if(mSize == 0)
+        return;
+    mMappingHandle = CreateFileMappingA(mFileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(mMappingHandle)
+    {
+        mData = static_cast<const char*>(MapViewOfFile(mMappingHandle, FILE_MAP_READ, 0, 0, 0));
+    }
+    if(!mData)
+    {
+        release();
+        throw Error(std::string("Failed to map file: ") + filename);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void MappedFile::release()
+{
+    if(mData)
+    {
+        UnmapViewOfFile(mData);
+        mData = nullptr;
+    }
+    if(mMappingHandle)
+    {
+        CloseHandle(mMappingHandle);
+        mMappingHandle = nullptr;
+    }
+    if(mFileHandle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(mFileHandle);
+        mFileHandle = INVALID_HANDLE_VALUE;
+    }
+}
+
+#else
+
+//---------------------------------------------------------------------------------------------------------------------
+
+MappedFile::MappedFile(const std::string& filename):
+    mData(nullptr),
+    mSize(0)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat fileStatus;
+    if(fd < 0 || fstat(fd, &fileStatus) != 0)
+    {
+        if(fd >= 0)
+            close(fd);
+        throw Error(std::string("Failed to open file: ") + filename);
+    }
+    mSize = size_t(fileStatus.st_size);
+    // Empty files cannot be mapped
+    if(mSize > 0)
+    {
+        void* data = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data == MAP_FAILED)
+        {
+            close(fd);
+            throw Error(std::string("Failed to map file: ") + filename);
+        }
+        // Files are parsed front to back
+        madvise(data, mSize, MADV_SEQUENTIAL);
+        mData = static_cast<const char*>(data);
+    }
+    // The mapping stays valid after closing the file
+    close(fd);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void MappedFile::release()
+{
+    if(mData)
+    {
+        munmap(const_cast<char*>(mData), mSize);
+        mData = nullptr;
+    }
+}
+
+#endif
+
+//---------------------------------------------------------------------------------------------------------------------
+
+MappedFile::~MappedFile()
+{
+    release();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::string_view MappedFile::contents() const
+{
+    return mData ? std::string_view(mData, mSize) : std::string_view();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool MappedFile::nextLine(std::string_view& text, std::string_view& line)
+{
+    if(text.empty())
+        return false;
+    size_t end = text.find('\n');
+    if(end == std::string_view::npos)
+    {
+        line = text;
+        text = std::string_view();
+    }
+    else
+    {
+        line = text.substr(0, end);
+        text.remove_prefix(end + 1);
+    }
+    if(!line.empty() && line.back() == '\r')
+    {
+        line.remove_suffix(1);
+    }
+    return true;
+}
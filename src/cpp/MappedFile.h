@@ -0,0 +1,68 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+
+//
+// Read-only memory mapping of a whole file, for parsing large solver output without copying it
+//
+class MappedFile
+{
+public:
+
+    class Error: public std::runtime_error
+    {
+    public:
+        Error(const std::string& description):
+            std::runtime_error(description)
+        {}
+    };
+
+    MappedFile(const std::string& filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view contents() const;
+
+    //
+    // Split the next line off the front of text, without its line ending.
+    // Returns false when text is empty.
+    //
+    static bool nextLine(std::string_view& text, std::string_view& line);
+
+private:
+    void release();
+
+    const char* mData;
+    size_t mSize;
+#ifdef _WIN32
+    void* mFileHandle;
+    void* mMappingHandle;
+#endif
+};
+
+#endif // MAPPED_FILE_H
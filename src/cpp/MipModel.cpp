@@ -0,0 +1,564 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <array>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+#include "MipModel.h"
+#include "PaletteCoverModel.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+
+MipModel::MipModel()
+{
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int MipModel::addColumn(const std::string& name, double lower, double upper, double objective, bool integer)
+{
+    assert(mColumnIndices.count(name) == 0 && "Column names must be unique");
+    mColumns.push_back(MipColumn{name, lower, upper, objective, integer});
+    mColumnIndices[name] = int(mColumns.size()) - 1;
+    return int(mColumns.size()) - 1;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int MipModel::addBinary(const std::string& name, double objective)
+{
+    return addColumn(name, 0.0, 1.0, objective, true);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int MipModel::addRow(const std::string& name,
+                     const std::vector<int>& columns,
+                     const std::vector<double>& coefficients,
+                     char sense,
+                     double rhs)
+{
+    assert(columns.size() == coefficients.size());
+    assert(sense == 'L' || sense == 'G' || sense == 'E');
+    mRows.push_back(MipRow{name, columns, coefficients, sense, rhs});
+    return int(mRows.size()) - 1;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+const std::vector<MipColumn>& MipModel::columns() const
+{
+    return mColumns;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+const std::vector<MipRow>& MipModel::rows() const
+{
+    return mRows;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int MipModel::findColumn(const std::string& name) const
+{
+    auto it = mColumnIndices.find(name);
+    return it != mColumnIndices.end() ? it->second : -1;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static void writeLpTerms(std::ofstream& f, const std::vector<int>& columns, const std::vector<double>& coefficients, const std::vector<MipColumn>& modelColumns)
+{
+    const size_t TermsPerLine = 8;
+    for(size_t i = 0; i < columns.size(); i++)
+    {
+        if(i > 0 && i % TermsPerLine == 0)
+        {
+            f << "\n   ";
+        }
+        f << (coefficients[i] < 0.0 ? " - " : " + ") << std::abs(coefficients[i]) << " " << modelColumns[columns[i]].name;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void MipModel::writeLp(const std::string& filename) const
+{
+    std::ofstream f(filename, std::ofstream::out);
+    if(!f)
+    {
+        throw std::runtime_error(std::string("Failed to open file '") + filename + "' for writing LP model.");
+    }
+    // Objective
+    std::vector<int> objectiveColumns;
+    std::vector<double> objectiveCoefficients;
+    for(size_t i = 0; i < mColumns.size(); i++)
+    {
+        if(mColumns[i].objective != 0.0)
+        {
+            objectiveColumns.push_back(int(i));
+            objectiveCoefficients.push_back(mColumns[i].objective);
+        }
+    }
+    if(objectiveColumns.empty() && !mColumns.empty())
+    {
+        // LP format needs at least one term in the objective
+        objectiveColumns.push_back(0);
+        objectiveCoefficients.push_back(0.0);
+    }
+    f << "Minimize\n obj:";
+    writeLpTerms(f, objectiveColumns, objectiveCoefficients, mColumns);
+    f << "\nSubject To\n";
+    // Constraints
+    for(const MipRow& row : mRows)
+    {
+        // Rows without columns are always satisfied in the models built by PassModel, and cannot be expressed in LP format
+        if(row.columns.empty())
+            continue;
+        f << " " << row.name << ":";
+        writeLpTerms(f, row.columns, row.coefficients, mColumns);
+        f << (row.sense == 'L' ? " <= " : (row.sense == 'G' ? " >= " : " = ")) << row.rhs << "\n";
+    }
+    // Bounds and integrality, leaving out empty sections
+    std::vector<const MipColumn*> bounded;
+    std::vector<const MipColumn*> binaries;
+    std::vector<const MipColumn*> generals;
+    for(const MipColumn& column : mColumns)
+    {
+        const bool binary = column.integer && column.lower == 0.0 && column.upper == 1.0;
+        if(binary)
+        {
+            binaries.push_back(&column);
+        }
+        else
+        {
+            bounded.push_back(&column);
+            if(column.integer)
+                generals.push_back(&column);
+        }
+    }
+    if(!bounded.empty())
+    {
+        f << "Bounds\n";
+        for(const MipColumn* column : bounded)
+        {
+            f << " " << column->lower << " <= " << column->name << " <= " << column->upper << "\n";
+        }
+    }
+    if(!binaries.empty())
+    {
+        f << "Binaries\n";
+        for(const MipColumn* column : binaries)
+        {
+            f << " " << column->name << "\n";
+        }
+    }
+    if(!generals.empty())
+    {
+        f << "Generals\n";
+        for(const MipColumn* column : generals)
+        {
+            f << " " << column->name << "\n";
+        }
+    }
+    f << "End\n";
+    if(!f)
+    {
+        throw std::runtime_error(std::string("Failed to write LP model to '") + filename + "'.");
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::string PassFormulation::variableName(const char* name, std::initializer_list<int> indices)
+{
+    std::string s(name);
+    for(int i : indices)
+    {
+        s += "_";
+        s += std::to_string(i);
+    }
+    return s;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::unique_ptr<PassFormulation> createPassFormulation(const SolverProblem& problem)
+{
+    Formulation formulation = problem.formulation;
+    if(formulation == Formulation::Automatic)
+    {
+        // Enumerating palettes pays off for few colors, but grows quickly with the colors per cell
+        const bool smaller = PaletteCoverModel::estimatedColumns(problem) < PassModel::estimatedColumns(problem);
+        formulation = smaller ? Formulation::PaletteCover : Formulation::Assignment;
+    }
+    if(formulation == Formulation::PaletteCover)
+    {
+        return std::make_unique<PaletteCoverModel>(problem);
+    }
+    return std::make_unique<PassModel>(problem);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+PassModel::PassModel(const SolverProblem& problem):
+    mPass(problem.pass),
+    mPaletteIndexOffset(problem.paletteIndexOffset)
+{
+    const bool secondPass = mPass == SolverPass::Second;
+    const char* gridName = secondPass ? "colorsOverlayGrid" : "colorsBG";
+    const char* movedName = secondPass ? "colorsOverlayFree" : "colorsOverlay";
+    const char* palettesName = secondPass ? "palettesOverlay" : "palettesBG";
+    const char* usesPaletteName = secondPass ? "usesPaletteOverlay" : "usesPaletteBG";
+    const char* paletteUsedName = secondPass ? "paletteUsedOverlay" : "paletteUsedBG";
+    mCellClasses = problem.cellClasses;
+    // All colors present in modelled cells
+    std::array<int, 256> colorIndex;
+    colorIndex.fill(-1);
+    for(const CellClass& cellClass : mCellClasses)
+    {
+        for(uint8_t c : cellClass.colors)
+        {
+            if(colorIndex[c] < 0)
+            {
+                colorIndex[c] = 0;
+                mColors.push_back(c);
+            }
+        }
+    }
+    std::sort(mColors.begin(), mColors.end());
+    for(size_t i = 0; i < mColors.size(); i++)
+    {
+        colorIndex[mColors[i]] = int(i);
+    }
+    // Global variables
+    for(uint8_t c : mColors)
+    {
+        mColorsTotal.push_back(mModel.addBinary(variableName("colorsOverlayTotal", {c})));
+    }
+    mPalettes.resize(problem.numPalettes);
+    for(int p = 0; p < problem.numPalettes; p++)
+    {
+        for(uint8_t c : mColors)
+        {
+            mPalettes[p].push_back(mModel.addBinary(variableName(palettesName, {p, c})));
+        }
+    }
+    // Per-cell variables and constraints
+    const int height = int(problem.layer.height());
+    std::vector<std::vector<int>> movedPerColor(mColors.size());
+    std::vector<std::vector<int>> rowColumns(height);
+    std::vector<std::vector<double>> rowCoefficients(height);
+    for(int k = 0; k < int(mCellClasses.size()); k++)
+    {
+        const CellClass& cellClass = mCellClasses[k];
+        CellVariables v;
+        for(uint8_t c : cellClass.colors)
+        {
+            v.colors.push_back(c);
+            v.grid.push_back(mModel.addBinary(variableName(gridName, {k, c})));
+            v.moved.push_back(mModel.addBinary(variableName(movedName, {k, c}), cellClass.columnCount.at(c)));
+            movedPerColor[colorIndex[c]].push_back(v.moved.back());
+        }
+        v.occupancy = mModel.addBinary(variableName("occupancy", {k}));
+        for(int p = 0; p < problem.numPalettes; p++)
+        {
+            v.usesPalette.push_back(mModel.addBinary(variableName(usesPaletteName, {k, p})));
+        }
+        // Member cells count towards the row size limit of their own row
+        std::vector<int> rowCount(height, 0);
+        for(const auto& cell : cellClass.cells)
+        {
+            rowCount[cell.second]++;
+        }
+        for(int y = 0; y < height; y++)
+        {
+            if(rowCount[y] == 0)
+                continue;
+            rowColumns[y].push_back(v.occupancy);
+            rowCoefficients[y].push_back(rowCount[y]);
+            if(secondPass)
+            {
+                for(int moved : v.moved)
+                {
+                    rowColumns[y].push_back(moved);
+                    rowCoefficients[y].push_back(rowCount[y]);
+                }
+            }
+        }
+        const size_t n = v.colors.size();
+        // Grid cell color limit
+        if(n > size_t(problem.gridCellColorLimit))
+        {
+            mModel.addRow(variableName("cellColorLimit", {k}), v.grid, std::vector<double>(n, 1.0), 'L', problem.gridCellColorLimit);
+        }
+        // Each color is either kept in the grid or moved
+        for(size_t i = 0; i < n; i++)
+        {
+            mModel.addRow(variableName("colorInEitherGridOrMoved", {k, v.colors[i]}), {v.grid[i], v.moved[i]}, {1.0, 1.0}, 'E', 1.0);
+        }
+        // Occupancy is the logical OR of moved colors (first pass) or grid colors (second pass)
+        const std::vector<int>& occupants = secondPass ? v.grid : v.moved;
+        {
+            std::vector<int> columns = occupants;
+            std::vector<double> coefficients(n, -1.0);
+            columns.push_back(v.occupancy);
+            coefficients.push_back(1.0);
+            mModel.addRow(variableName("occupancy_ltSUM", {k}), columns, coefficients, 'L', 0.0);
+        }
+        for(size_t i = 0; i < n; i++)
+        {
+            mModel.addRow(variableName("occupancy_gt", {k, v.colors[i]}), {v.occupancy, occupants[i]}, {1.0, -1.0}, 'G', 0.0);
+        }
+        // Moved colors contribute to the global overlay color set
+        for(size_t i = 0; i < n; i++)
+        {
+            mModel.addRow(variableName("colorsOverlayTotalFromMoved", {k, v.colors[i]}), {mColorsTotal[colorIndex[v.colors[i]]], v.moved[i]}, {1.0, -1.0}, 'G', 0.0);
+        }
+        // Grid colors must be a subset of the used palette
+        for(int p = 0; p < problem.numPalettes; p++)
+        {
+            for(size_t i = 0; i < n; i++)
+            {
+                mModel.addRow(variableName("colorsMustBeSubsetOfPalette", {k, p, v.colors[i]}),
+                              {v.usesPalette[p], v.grid[i], mPalettes[p][colorIndex[v.colors[i]]]},
+                              {1.0, 1.0, -1.0},
+                              'L',
+                              1.0);
+            }
+        }
+        // Every cell uses exactly one palette
+        mModel.addRow(variableName("cellColorsInPalette", {k}), v.usesPalette, std::vector<double>(v.usesPalette.size(), 1.0), 'E', 1.0);
+        mCells.push_back(std::move(v));
+    }
+    // Symmetry breaking: palettes are numbered in order of first use by the cell classes,
+    // i.e. a cell can only use palette p if palette p-1 is used by an earlier cell.
+    // paletteUsed[k, p] is an upper bound on whether palette p is used by any of the cells 0..k
+    if(problem.symmetryBreaking)
+    {
+        std::vector<int> previousUsed;
+        for(size_t k = 0; k < mCells.size(); k++)
+        {
+            CellVariables& v = mCells[k];
+            std::vector<int> used;
+            for(int p = 0; p < problem.numPalettes; p++)
+            {
+                used.push_back(mModel.addColumn(variableName(paletteUsedName, {int(k), p}), 0.0, 1.0, 0.0, false));
+                if(k == 0)
+                {
+                    mModel.addRow(variableName("paletteUsed", {int(k), p}), {used[p], v.usesPalette[p]}, {1.0, -1.0}, 'L', 0.0);
+                }
+                else
+                {
+                    mModel.addRow(variableName("paletteUsed", {int(k), p}), {used[p], previousUsed[p], v.usesPalette[p]}, {1.0, -1.0, -1.0}, 'L', 0.0);
+                }
+                if(p > 0)
+                {
+                    if(k == 0)
+                    {
+                        mModel.addRow(variableName("paletteFirstUse", {int(k), p}), {v.usesPalette[p]}, {1.0}, 'E', 0.0);
+                    }
+                    else
+                    {
+                        mModel.addRow(variableName("paletteFirstUse", {int(k), p}), {v.usesPalette[p], previousUsed[p - 1]}, {1.0, -1.0}, 'L', 0.0);
+                    }
+                }
+            }
+            v.paletteUsed = used;
+            previousUsed = std::move(used);
+        }
+    }
+    // Row size limit, minus the usage of cells left out of the model
+    for(int y = 0; y < height; y++)
+    {
+        const int reserved = y < int(problem.rowReserved.size()) ? problem.rowReserved[y] : 0;
+        double maxUsage = 0.0;
+        for(double coefficient : rowCoefficients[y])
+        {
+            maxUsage += coefficient;
+        }
+        if(maxUsage > problem.maxRowSize - reserved)
+        {
+            mModel.addRow(variableName("rowLimit", {y}), rowColumns[y], rowCoefficients[y], 'L', problem.maxRowSize - reserved);
+        }
+    }
+    if(secondPass)
+    {
+        for(size_t i = 0; i < mColors.size(); i++)
+        {
+            // Overlay total can only be set when color is actually free somewhere
+            std::vector<int> columns = movedPerColor[i];
+            std::vector<double> coefficients(columns.size(), -1.0);
+            columns.push_back(mColorsTotal[i]);
+            coefficients.push_back(1.0);
+            mModel.addRow(variableName("colorsOverlayTotalClampToFree", {mColors[i]}), columns, coefficients, 'L', 0.0);
+            // Each free color must be present in at least one palette
+            columns.clear();
+            coefficients.clear();
+            for(int p = 0; p < problem.numPalettes; p++)
+            {
+                columns.push_back(mPalettes[p][i]);
+                coefficients.push_back(1.0);
+            }
+            columns.push_back(mColorsTotal[i]);
+            coefficients.push_back(-1.0);
+            mModel.addRow(variableName("freeColorInAnyPalette", {mColors[i]}), columns, coefficients, 'G', 0.0);
+        }
+    }
+    // Palette color limit
+    for(int p = 0; p < problem.numPalettes; p++)
+    {
+        mModel.addRow(variableName("paletteColorLimit", {p}), mPalettes[p], std::vector<double>(mPalettes[p].size(), 1.0), 'L', problem.gridCellColorLimit);
+    }
+    // Overlay color limit
+    mModel.addRow("overlayColorLimit", mColorsTotal, std::vector<double>(mColorsTotal.size(), 1.0), 'L', problem.maxSpritePalettes * problem.gridCellColorLimit);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+size_t PassModel::estimatedColumns(const SolverProblem& problem)
+{
+    const size_t numPalettes = size_t(problem.numPalettes);
+    Colors colors;
+    size_t columns = 0;
+    for(const CellClass& cellClass : problem.cellClasses)
+    {
+        colors.insert(cellClass.colors.begin(), cellClass.colors.end());
+        // grid / moved per color, occupancy, and usesPalette / paletteUsed per palette
+        columns += 2 * cellClass.colors.size() + 1 + (problem.symmetryBreaking ? 2 : 1) * numPalettes;
+    }
+    return columns + (1 + numPalettes) * colors.size();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+const MipModel& PassModel::model() const
+{
+    return mModel;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void PassModel::decode(const std::vector<double>& values, SolverSolution& solution) const
+{
+    assert(values.size() == mModel.columns().size());
+    auto isSet = [&](int column) { return values[column] > 0.5; };
+    solution.palettes = decodePalettes(values);
+    for(size_t k = 0; k < mCells.size(); k++)
+    {
+        const CellVariables& v = mCells[k];
+        const CellClass& cellClass = mCellClasses[k];
+        for(size_t i = 0; i < v.colors.size(); i++)
+        {
+            if(isSet(v.grid[i]))
+            {
+                solution.setCellClassColor(cellClass, v.colors[i], false);
+            }
+            if(isSet(v.moved[i]))
+            {
+                solution.setCellClassColor(cellClass, v.colors[i], true);
+            }
+        }
+        for(size_t p = 0; p < v.usesPalette.size(); p++)
+        {
+            if(isSet(v.usesPalette[p]))
+            {
+                solution.setCellClassPalette(cellClass, p + mPaletteIndexOffset);
+            }
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::vector<Colors> PassModel::decodePalettes(const std::vector<double>& values) const
+{
+    assert(values.size() == mModel.columns().size());
+    std::vector<Colors> palettes;
+    for(size_t p = 0; p < mPalettes.size(); p++)
+    {
+        for(size_t i = 0; i < mColors.size(); i++)
+        {
+            if(values[mPalettes[p][i]] > 0.5)
+            {
+                if(p >= palettes.size())
+                {
+                    palettes.resize(p + 1);
+                }
+                palettes[p].insert(mColors[i]);
+            }
+        }
+    }
+    return palettes;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::vector<double> PassModel::startValues(const CellAssignment& assignment) const
+{
+    std::vector<double> values(mModel.columns().size(), 0.0);
+    if(assignment.empty())
+    {
+        return values;
+    }
+    const bool secondPass = mPass == SolverPass::Second;
+    for(size_t p = 0; p < mPalettes.size() && p < assignment.palettes.size(); p++)
+    {
+        for(size_t i = 0; i < mColors.size(); i++)
+        {
+            values[mPalettes[p][i]] = assignment.palettes[p].count(mColors[i]) ? 1.0 : 0.0;
+        }
+    }
+    std::vector<double> used(mPalettes.size(), 0.0);
+    for(size_t k = 0; k < mCells.size(); k++)
+    {
+        const CellVariables& v = mCells[k];
+        const Colors& grid = assignment.grid[k];
+        bool anyGrid = false;
+        bool anyMoved = false;
+        for(size_t i = 0; i < v.colors.size(); i++)
+        {
+            const bool inGrid = grid.count(v.colors[i]) > 0;
+            values[v.grid[i]] = inGrid ? 1.0 : 0.0;
+            values[v.moved[i]] = inGrid ? 0.0 : 1.0;
+            anyGrid = anyGrid || inGrid;
+            anyMoved = anyMoved || !inGrid;
+            if(!inGrid)
+            {
+                const size_t colorIndex = std::lower_bound(mColors.begin(), mColors.end(), v.colors[i]) - mColors.begin();
+                values[mColorsTotal[colorIndex]] = 1.0;
+            }
+        }
+        values[v.occupancy] = (secondPass ? anyGrid : anyMoved) ? 1.0 : 0.0;
+        for(size_t p = 0; p < v.usesPalette.size(); p++)
+        {
+            values[v.usesPalette[p]] = int(p) == assignment.palette[k] ? 1.0 : 0.0;
+            if(!v.paletteUsed.empty())
+            {
+                used[p] = std::max(used[p], values[v.usesPalette[p]]);
+                values[v.paletteUsed[p]] = used[p];
+            }
+        }
+    }
+    return values;
+}
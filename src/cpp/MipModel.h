@@ -0,0 +1,178 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef MIP_MODEL_H
+#define MIP_MODEL_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <initializer_list>
+
+#include "SolverBackend.h"
+
+//
+// Single variable of a mixed-integer program
+//
+struct MipColumn
+{
+    std::string name;
+    double lower;
+    double upper;
+    double objective;
+    bool integer;
+};
+
+//
+// Single linear constraint of a mixed-integer program
+//
+// sense is 'L' for <=, 'G' for >= and 'E' for ==
+//
+struct MipRow
+{
+    std::string name;
+    std::vector<int> columns;
+    std::vector<double> coefficients;
+    char sense;
+    double rhs;
+};
+
+//
+// Solver-independent in-memory representation of a minimisation MIP
+//
+class MipModel
+{
+public:
+    MipModel();
+
+    int addColumn(const std::string& name, double lower, double upper, double objective, bool integer);
+    int addBinary(const std::string& name, double objective = 0.0);
+
+    int addRow(const std::string& name,
+               const std::vector<int>& columns,
+               const std::vector<double>& coefficients,
+               char sense,
+               double rhs);
+
+    const std::vector<MipColumn>& columns() const;
+    const std::vector<MipRow>& rows() const;
+
+    //
+    // Index of column with given name, or -1 if there is no such column
+    //
+    int findColumn(const std::string& name) const;
+
+    //
+    // Write model in CPLEX LP format, as read by the cbc executable
+    //
+    void writeLp(const std::string& filename) const;
+
+private:
+    std::vector<MipColumn> mColumns;
+    std::vector<MipRow> mRows;
+    std::unordered_map<std::string, int> mColumnIndices;
+};
+
+//
+// Interface of the MIP formulations of a FirstPass / SecondPass problem, which build a MipModel
+// and translate variable values back into a SolverSolution.
+//
+class PassFormulation
+{
+public:
+    virtual ~PassFormulation() = default;
+
+    virtual const MipModel& model() const = 0;
+
+    //
+    // Fill in a solution from the values of all model columns.
+    // The solution layers must already be initialised to the size of the problem layer.
+    //
+    virtual void decode(const std::vector<double>& values, SolverSolution& solution) const = 0;
+
+    //
+    // Palettes set by the values of all model columns, with trailing empty palettes left out
+    //
+    virtual std::vector<Colors> decodePalettes(const std::vector<double>& values) const = 0;
+
+    //
+    // Values of all model columns for a cell assignment, for passing to the solver as a MIP start
+    //
+    virtual std::vector<double> startValues(const CellAssignment& assignment) const = 0;
+
+protected:
+    static std::string variableName(const char* name, std::initializer_list<int> indices);
+};
+
+//
+// Build the formulation selected by the problem
+//
+std::unique_ptr<PassFormulation> createPassFormulation(const SolverProblem& problem);
+
+//
+// Builds the FirstPass / SecondPass formulation for a SolverProblem as a MipModel.
+//
+// The formulation is the same as FirstPass.cmpl / SecondPass.cmpl, except that variables
+// are only created for colors actually present in each cell class.
+//
+class PassModel: public PassFormulation
+{
+public:
+    PassModel(const SolverProblem& problem);
+
+    //
+    // Number of columns the model of a problem would have
+    //
+    static size_t estimatedColumns(const SolverProblem& problem);
+
+    const MipModel& model() const override;
+
+    void decode(const std::vector<double>& values, SolverSolution& solution) const override;
+
+    std::vector<Colors> decodePalettes(const std::vector<double>& values) const override;
+
+    std::vector<double> startValues(const CellAssignment& assignment) const override;
+
+private:
+    //
+    // Variable indices for a single cell class
+    //
+    struct CellVariables
+    {
+        std::vector<uint8_t> colors;
+        std::vector<int> grid;
+        std::vector<int> moved;
+        std::vector<int> usesPalette;
+        // Symmetry breaking columns. Empty when symmetry breaking is disabled.
+        std::vector<int> paletteUsed;
+        int occupancy;
+    };
+
+    SolverPass mPass;
+    uint8_t mPaletteIndexOffset;
+    MipModel mModel;
+    std::vector<uint8_t> mColors;
+    std::vector<int> mColorsTotal;
+    std::vector<std::vector<int>> mPalettes;
+    std::vector<CellClass> mCellClasses;
+    std::vector<CellVariables> mCells;
+};
+
+#endif // MIP_MODEL_H
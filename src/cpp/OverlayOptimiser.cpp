@@ -26,19 +26,44 @@
 #include <array>
 #include <functional>
 #include <vector>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <chrono>
+#include <thread>
+#include <filesystem>
 
 #include "ImageUtils.h"
-#include "SubProcess.h"
+#include "Presolve.h"
+#include "HeuristicSolver.h"
+#include "PassBounds.h"
+#include "ShiftedGridLayers.h"
+#include "Palette.h"
 
 #include "OverlayOptimiser.h"
 
 //---------------------------------------------------------------------------------------------------------------------
 
 OverlayOptimiser::OverlayOptimiser():
+    mSolverBackend(createSolverBackend(defaultSolverBackendName())),
+    mCancelFlag(false),
+    mStatus(Status::Idle),
+    mPortfolioSize(1),
+    mSymmetryBreaking(true),
+    mPresolve(true),
+    mFormulation(Formulation::Automatic),
+    mIncremental(false),
+    mPipelined(false),
+    mIncumbentObjective(std::numeric_limits<int>::max()),
+    mDeadline(std::chrono::steady_clock::time_point::max()),
+    mPostProcessingReserve(std::chrono::steady_clock::duration::zero()),
+    mFixedPassSolutions{nullptr, nullptr},
+    mHeuristicOnly(false),
+    mPassObjectives{0, 0},
     mBackgroundColor(0),
     mSpriteHeight(16)
 {
-
+    mSolverBackend->setCancelFlag(&mCancelFlag);
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -46,6 +71,7 @@ OverlayOptimiser::OverlayOptimiser():
 void OverlayOptimiser::setExecutablePath(const std::string& executablePath)
 {
     mExecutablePath = executablePath;
+    mSolverBackend->setExecutablePath(mExecutablePath);
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -53,6 +79,7 @@ void OverlayOptimiser::setExecutablePath(const std::string& executablePath)
 void OverlayOptimiser::setWorkPath(const std::string& workPath)
 {
     mWorkPath = workPath;
+    mSolverBackend->setWorkPath(mWorkPath);
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -71,227 +98,542 @@ std::string OverlayOptimiser::workPathFilename(const std::string& workFilename)
 
 //---------------------------------------------------------------------------------------------------------------------
 
-void OverlayOptimiser::writeCmplLayerData(std::ofstream& f, const std::string& name, const GridLayer& layer, std::function<int(int, int, int)> const& callback)
+void OverlayOptimiser::setSolverBackend(const std::string& name, int portfolioSize)
+{
+    if(name == mSolverBackend->name() && portfolioSize == mPortfolioSize)
+        return;
+    mSolverBackend = createSolverBackend(name, portfolioSize);
+    mPortfolioSize = portfolioSize;
+    mSolverBackend->setExecutablePath(mExecutablePath);
+    mSolverBackend->setWorkPath(mWorkPath);
+    mSolverBackend->setCancelFlag(&mCancelFlag);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::string OverlayOptimiser::solverBackend() const
+{
+    return mSolverBackend->name();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int OverlayOptimiser::portfolioSize() const
+{
+    return mPortfolioSize;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::setSymmetryBreaking(bool symmetryBreaking)
+{
+    mSymmetryBreaking = symmetryBreaking;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool OverlayOptimiser::symmetryBreaking() const
+{
+    return mSymmetryBreaking;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::setPresolve(bool presolve)
+{
+    mPresolve = presolve;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool OverlayOptimiser::presolve() const
+{
+    return mPresolve;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::setFormulation(Formulation formulation)
+{
+    mFormulation = formulation;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+Formulation OverlayOptimiser::formulation() const
+{
+    return mFormulation;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::setIncremental(bool incremental)
+{
+    mIncremental = incremental;
+    if(!mIncremental)
+    {
+        mPreviousPasses[0] = PassResult();
+        mPreviousPasses[1] = PassResult();
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool OverlayOptimiser::incremental() const
+{
+    return mIncremental;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::setPipelined(bool pipelined)
+{
+    mPipelined = pipelined;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool OverlayOptimiser::pipelined() const
+{
+    return mPipelined;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::setCachePath(const std::string& cachePath)
 {
-    f << "%" << name.c_str() << "[XRANGE, YRANGE, COLORS] <\n";
-    for(int x = 0; x < layer.width(); x++)
+    mSolutionCache.setPath(cachePath);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::setCacheRequireOptimal(bool cacheRequireOptimal)
+{
+    mSolutionCache.setRequireOptimal(cacheRequireOptimal);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool OverlayOptimiser::cacheRequireOptimal() const
+{
+    return mSolutionCache.requireOptimal();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static bool sameProblemParameters(const SolverProblem& a, const SolverProblem& b)
+{
+    return a.pass == b.pass &&
+           a.layer.width() == b.layer.width() &&
+           a.layer.height() == b.layer.height() &&
+           a.layer.cellWidth() == b.layer.cellWidth() &&
+           a.layer.cellHeight() == b.layer.cellHeight() &&
+           a.layer.backgroundColor() == b.layer.backgroundColor() &&
+           a.gridCellColorLimit == b.gridCellColorLimit &&
+           a.numPalettes == b.numPalettes &&
+           a.maxSpritePalettes == b.maxSpritePalettes &&
+           a.maxRowSize == b.maxRowSize &&
+           a.paletteIndexOffset == b.paletteIndexOffset;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static bool sameCell(const GridLayer& a, const GridLayer& b, size_t x, size_t y)
+{
+    const ColorMask colors = a.cellColors(x, y);
+    if(colors != b.cellColors(x, y))
+        return false;
+    for(uint8_t c : ColorMaskRange(colors))
     {
-        for(int y = 0; y < layer.height(); y++)
+        if(a.columnCount(x, y, c) != b.columnCount(x, y, c))
+            return false;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static bool sameLayerCells(const GridLayer& a, const GridLayer& b)
+{
+    if(a.width() != b.width() || a.height() != b.height())
+        return false;
+    for(size_t y = 0; y < a.height(); y++)
+    {
+        for(size_t x = 0; x < a.width(); x++)
         {
-            for(auto c : layer.colors())
-            {
-                int v = callback(x, y, c);
-                f << v << " ";
-            }
-            f << "\n";
+            if(!sameCell(a, b, x, y))
+                return false;
         }
     }
-    f << ">\n";
+    return true;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-void OverlayOptimiser::writeCmplDataFile(const GridLayer& layer, int gridCellColorLimit, int maxBackgroundPalettes, int maxSpritePalettes, int maxRowSize, const std::string& filename)
+const OverlayOptimiser::PassResult* OverlayOptimiser::previousPass(const SolverProblem& problem) const
 {
-    std::ofstream f(filename, std::ofstream::out);
-    if(!f)
+    const PassResult& previous = mPreviousPasses[problem.pass == SolverPass::Second ? 1 : 0];
+    if(!mIncremental || !previous.valid || !sameProblemParameters(previous.problem, problem))
+        return nullptr;
+    return &previous;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool OverlayOptimiser::solvePassIncrementally(const SolverProblem& problem, SolverSolution& solution) const
+{
+    const PassResult* previous = previousPass(problem);
+    if(!previous)
+        return false;
+    // Cells keep their previous decisions unless their colors changed. Changed cells
+    // are moved to their best palette, with the palettes of the previous solution fixed.
+    SolverProblem cellProblem = problem;
+    cellProblem.symmetryBreaking = false;
+    Presolve(problem, false).apply(cellProblem);
+    HeuristicSolver heuristicSolver(cellProblem);
+    CellAssignment assignment;
+    assignment.palettes = previous->solution.palettes;
+    assignment.palettes.resize(problem.numPalettes);
+    assignment.grid.resize(cellProblem.cellClasses.size());
+    assignment.palette.resize(cellProblem.cellClasses.size());
+    int numChangedCells = 0;
+    for(size_t k = 0; k < cellProblem.cellClasses.size(); k++)
     {
-        throw std::runtime_error(std::string("Failed to open file '") + filename + "' for writing CMPL input data.");
+        const CellClass& cellClass = cellProblem.cellClasses[k];
+        // Member cells may come from different classes of the previous problem, so all of them are compared
+        const bool unchanged = std::all_of(cellClass.cells.begin(), cellClass.cells.end(), [&](const std::pair<int, int>& cell)
+        {
+            return sameCell(problem.layer, previous->problem.layer, cell.first, cell.second);
+        });
+        const int x = cellClass.cells.front().first;
+        const int y = cellClass.cells.front().second;
+        if(unchanged)
+        {
+            assignment.grid[k] = maskColors(previous->solution.layerGrid.cellColors(x, y));
+            assignment.palette[k] = previous->solution.paletteIndices(x, y) - problem.paletteIndexOffset;
+        }
+        else
+        {
+            heuristicSolver.assignCell(k, assignment);
+            numChangedCells++;
+        }
     }
-    // Limits
-    f << "%CELL_COLOR_LIMIT < " << gridCellColorLimit << " >\n";
-    f << "%MAX_BG_PALETTES < " << maxBackgroundPalettes << " >\n";
-    f << "%BG_PALETTES set < 0.." << maxBackgroundPalettes-1 << " >\n";
-    f << "%MAX_SPR_PALETTES < " << maxSpritePalettes << " >\n";
-    f << "%SPR_PALETTES set < 0.." << maxSpritePalettes-1 << " >\n";
-    f << "%OVERLAY_ROW_SIZE_LIMIT < " << maxRowSize << " >\n";
-    // X / Y ranges
-    f << "%XRANGE set < 0.." << layer.width()-1 << " >\n";
-    f << "%YRANGE set < 0.." << layer.height()-1 << " >\n";
-    // All colors present in layer
-    f << "%COLORS set < ";
-    for(auto c : layer.colors())
-    {
-        f << int(c) << " ";
+    // Large edits are better served by a full solve than by palettes chosen for another image
+    const int MaxChangedCellsFraction = 4;
+    if(numChangedCells * MaxChangedCellsFraction > int(cellProblem.cellClasses.size()))
+        return false;
+    if(!heuristicSolver.feasible(assignment))
+        return false;
+    solution = solutionFromAssignment(cellProblem, assignment);
+    // Cells left out of the classes, such as emptied ones, also count as changes
+    solution.optimal = previous->solution.optimal && sameLayerCells(problem.layer, previous->problem.layer);
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::solvePassHeuristically(SolverProblem& problem, SolverSolution& solution) const
+{
+    // No dominated cells are left out, as there is no solver run to put them back in with
+    Presolve(problem, false).apply(problem);
+    HeuristicSolver heuristicSolver(problem);
+    CellAssignment assignment;
+    if(!heuristicSolver.greedy(assignment))
+    {
+        throw Error("No heuristic solution found.");
     }
-    f << " >\n";
-    // layerColors
-    writeCmplLayerData(f, "layerColors", layer, [&](int x, int y, uint8_t c) { return layer(x, y).colors.count(c) ? 1 : 0; });
-    writeCmplLayerData(f, "layerColorColumnCount", layer, [&](int x, int y, uint8_t c) { return layer(x, y).colors.count(c) ? layer(x, y).columnCount.at(c) : 0; });
+    heuristicSolver.localSearch(assignment);
+    solution = solutionFromAssignment(problem, assignment);
+    solution.optimal = heuristicSolver.objective(assignment) <= heuristicSolver.lowerBound();
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-void OverlayOptimiser::runCmplProgram(const std::string& inputFilename,
-                                      const std::string& outputFilename,
-                                      const std::string& solutionCsvFilename,
-                                      int timeOut)
+void OverlayOptimiser::handleIncumbent(const SolverProblem& problem,
+                                       const Presolve& presolve,
+                                       const CellAssignment& assignment,
+                                       int objective)
 {
-    // Make a copy of the original program and prepend timeOut parameter to it
-    // This is an ugly work-around for there being no other way(?) to set the CBC timeout parameter :(
-    std::ifstream inputFile(inputFilename, std::ifstream::in);
-    std::string inputFileStr((std::istreambuf_iterator<char>(inputFile)),
-                              std::istreambuf_iterator<char>());
-    inputFile.close();
-    std::ofstream outputFile(outputFilename);
-    if(timeOut)
+    std::lock_guard<std::mutex> lock(mIncumbentMutex);
+    if(objective >= mIncumbentObjective)
+        return;
+    mIncumbentObjective = objective;
+    SolverSolution solution = solutionFromAssignment(problem, assignment);
+    // Expanding changes the presolve state when dominated cells are left uncovered, so a copy is used
+    Presolve incumbentPresolve = presolve;
+    if(!incumbentPresolve.expand(solution))
+        return;
+    if(mSpeculator && problem.pass == SolverPass::First)
     {
-        outputFile << "%opt cbc seconds " << timeOut << "\n";
+        queueSpeculativePass(solution);
     }
-    outputFile << inputFileStr;
-    outputFile.close();
-    // Execute process
-    std::string cmplExecutable("Cmpl/bin/cmpl");
-    std::vector<std::string> params;
-    params.push_back("-i");
-    params.push_back(quoteStringOnWindows(outputFilename));
-    params.push_back("-solutionCsv");
-    params.push_back(quoteStringOnWindows(solutionCsvFilename));
-    int exitCode = executeProcess(exePathFilename(cmplExecutable), params, timeOut, mWorkPath);
-    if(exitCode != 0)
-    {
-        throw Error("Non-zero exit code from CMPL");
+    if(mProvisionalPublisher)
+    {
+        queueProvisional(problem.pass, solution);
     }
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-void OverlayOptimiser::parseSolutionValue(const std::string& line, std::vector<int>& indices, int& value)
+void OverlayOptimiser::publishProvisional(SolverPass pass,
+                                          const SolverSolution& solution,
+                                          const SolverSolution& firstPassSolution)
 {
-    indices.clear();
-    size_t arrayStartPos = line.find("[", 0);
-    size_t arrayEndPos = line.find("]", 0);
-    size_t activityPos = line.find(";B;", 0);
-    if(activityPos == std::string::npos)
+    OverlayOptimiser provisional;
+    provisional.mHeuristicOnly = true;
+    provisional.mFixedPassSolutions[0] = pass == SolverPass::First ? &solution : &firstPassSolution;
+    provisional.mFixedPassSolutions[1] = pass == SolverPass::Second ? &solution : nullptr;
+    const ConvertParameters& p = mConvertParameters;
+    try
     {
-        // For currently unknown reasons, the CMPL solution will sometimes have
-        // binary variables changed to integer.
-        // Work around this bug by re-trying a second time with 'I' instead of 'B'.
-        activityPos = line.find(";I;", 0);
+        provisional.convert(p.image,
+                            p.backgroundColor,
+                            p.gridCellWidth,
+                            p.gridCellHeight,
+                            p.spriteHeight,
+                            p.gridCellColorLimit,
+                            p.maxBackgroundPalettes,
+                            p.maxSpritePalettes,
+                            p.maxSpritesPerScanline,
+                            p.timeOut);
     }
-    if(arrayStartPos != std::string::npos &&
-       arrayEndPos != std::string::npos &&
-       activityPos != std::string::npos)
-    {
-        assert(arrayStartPos+1 < line.size());
-        assert(arrayEndPos+1 < line.size());
-        assert(activityPos+3 < line.size());
-        assert(arrayStartPos < arrayEndPos);
-        // Read indices
+    catch(const std::runtime_error&)
+    {
+        // Provisional results are best-effort, the final result reports any error
+        return;
+    }
+    mProvisionalCallback(provisional);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::startProvisionalPublisher()
+{
+    mProvisionalPublisher.reset(new ProvisionalPublisher());
+    mProvisionalPublisher->thread = std::thread(&OverlayOptimiser::runProvisionalPublisher, this);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::queueProvisional(SolverPass pass, const SolverSolution& solution)
+{
+    ProvisionalPublisher& publisher = *mProvisionalPublisher;
+    std::lock_guard<std::mutex> lock(publisher.mutex);
+    publisher.pass = pass;
+    publisher.solution = solution;
+    // Second pass incumbents only arrive once the first pass is final
+    if(pass == SolverPass::Second)
+    {
+        publisher.firstPassSolution = mFirstPassSolution;
+    }
+    publisher.pending = true;
+    publisher.wakeUp.notify_one();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::runProvisionalPublisher()
+{
+    // Shortest time between two provisional results
+    const std::chrono::milliseconds MinPublishInterval(250);
+    ProvisionalPublisher& publisher = *mProvisionalPublisher;
+    std::unique_lock<std::mutex> lock(publisher.mutex);
+    for(;;)
+    {
+        publisher.wakeUp.wait(lock, [&publisher] { return publisher.pending || publisher.stop; });
+        if(publisher.stop)
+            return;
+        const SolverPass pass = publisher.pass;
+        const SolverSolution solution = std::move(publisher.solution);
+        const SolverSolution firstPassSolution = std::move(publisher.firstPassSolution);
+        publisher.pending = false;
+        const auto nextPublish = std::chrono::steady_clock::now() + MinPublishInterval;
+        lock.unlock();
+        publishProvisional(pass, solution, firstPassSolution);
+        lock.lock();
+        if(publisher.wakeUp.wait_until(lock, nextPublish, [&publisher] { return publisher.stop; }))
+            return;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::stopProvisionalPublisher()
+{
+    if(!mProvisionalPublisher)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mProvisionalPublisher->mutex);
+        mProvisionalPublisher->stop = true;
+        mProvisionalPublisher->wakeUp.notify_one();
+    }
+    mProvisionalPublisher->thread.join();
+    mProvisionalPublisher.reset();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::solvePass(SolverProblem& problem, SolverSolution& solution)
+{
+    const int passIndex = problem.pass == SolverPass::Second ? 1 : 0;
+    if(mFixedPassSolutions[passIndex] || mHeuristicOnly)
+    {
+        if(mFixedPassSolutions[passIndex])
         {
-            std::string indicesStr = line.substr(arrayStartPos + 1, arrayEndPos - arrayStartPos + 1); //arrayStartPos
-            char c;
-            int i;
-            std::stringstream ss(indicesStr);
-            while(true)
-            {
-                ss >> i >> c;
-                indices.push_back(i);
-                if(c != ',')
-                    break;
-            }
+            solution = *mFixedPassSolutions[passIndex];
         }
-        // Read activity
+        else
         {
-            std::string activityStr = line.substr(activityPos+3, line.size() - (activityPos + 3));
-            std::stringstream ss(activityStr);
-            ss >> value;
+            solvePassHeuristically(problem, solution);
         }
+        mPassObjectives[passIndex] = solutionObjective(problem, solution);
+        return;
+    }
+    if(mCancelFlag)
+    {
+        throw SolverBackend::Cancelled();
+    }
+    const std::string cacheKey = SolutionCache::key(problem, mConvertParameters.timeOut, mSolverBackend->name(), mPortfolioSize);
+    if(!mSolutionCache.load(cacheKey, problem, solution))
+    {
+        // Incremental and speculative solutions depend on earlier solves rather than only on the cache key,
+        // so they are only cached once proven optimal
+        bool solvedFully = false;
+        if(!solvePassIncrementally(problem, solution) && !takeSpeculativePass(problem, solution))
+        {
+            const bool reportIncumbents = mProvisionalCallback || (mPipelined && problem.pass == SolverPass::First);
+            solvePassFully(*mSolverBackend, problem, solution, reportIncumbents);
+            solvedFully = true;
+        }
+        if(solvedFully || solution.optimal)
+        {
+            mSolutionCache.store(cacheKey, solution);
+        }
+    }
+    if(problem.pass == SolverPass::Second)
+    {
+        stopSpeculativePass();
+    }
+    mPassObjectives[passIndex] = solutionObjective(problem, solution);
+    if(mProvisionalCallback && problem.pass == SolverPass::First)
+    {
+        mFirstPassSolution = solution;
+    }
+    if(mIncremental)
+    {
+        PassResult& result = mPreviousPasses[passIndex];
+        result.problem = problem;
+        result.solution = solution;
+        result.valid = true;
     }
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-bool OverlayOptimiser::parseCmplSolution(const std::string& csvFilename,
-                                         std::vector<std::set<uint8_t>>& palettes,
-                                         GridLayer& colorsBackground,
-                                         GridLayer& colorsOverlay,
-                                         Array2D<uint8_t>& paletteIndicesBackground,
-                                         bool secondPass)
+void OverlayOptimiser::solvePassFully(SolverBackend& backend, SolverProblem& problem, SolverSolution& solution, bool reportIncumbents)
 {
-    std::ifstream f;
-    f.open(csvFilename, std::ifstream::in);
-    if(!f)
+    Presolve presolve(problem, mPresolve);
+    if(reportIncumbents)
     {
-        throw std::runtime_error(std::string("Failed to open solution file: ") + csvFilename);
+        std::lock_guard<std::mutex> lock(mIncumbentMutex);
+        mIncumbentObjective = std::numeric_limits<int>::max();
     }
-    // Read data
-    const std::string noSolutionString = "No solution has been found";
-    const std::string colorsBackgroundPrefix = secondPass ? "colorsOverlayGrid[" : "colorsBG[";
-    const std::string colorsOverlayPrefix = secondPass ? "colorsOverlayFree[" : "colorsOverlay[";
-    const std::string palettesNamePrefix = secondPass ? "palettesOverlay[" : "palettesBG[";
-    const std::string usesPalettePrefix = secondPass ? "usesPaletteOverlay[" : "usesPaletteBG[";
-    std::string line;
-    std::getline(f, line);
-    if(line.find("Problem;") == std::string::npos)
-    {
-        throw std::runtime_error(std::string("Solution file header unrecognized"));
-    }
-    // Parse values
-    palettes.clear();
-    std::vector<int> indices;
-    int value;
-    while(true)
+    // Dominated cells left uncovered by the solution are put back into the model before solving again.
+    // The last attempt puts back all of them, which bounds the number of solver runs.
+    const int MaxPresolveAttempts = 3;
+    // All attempts share the time limit of the pass
+    const bool timeLimited = problem.timeOut > 0;
+    const auto passDeadline = std::chrono::steady_clock::now() + std::chrono::seconds(problem.timeOut);
+    for(int attempt = 1; ; attempt++)
     {
-        if(!std::getline(f, line))
-            break;
-        if(line.find(noSolutionString, 0) == 0)
+        bool budgetSpent = false;
+        if(attempt > 1 && timeLimited)
         {
-            throw std::runtime_error(std::string("No solution found"));
+            const auto remaining = std::chrono::duration_cast<std::chrono::seconds>(passDeadline - std::chrono::steady_clock::now()).count();
+            budgetSpent = remaining < 1;
+            problem.timeOut = std::max(int(remaining), 1);
         }
-        else if(line.rfind(colorsBackgroundPrefix, 0) == 0)
+        // Without time for another solver run, the heuristics solve the full problem instead
+        if(attempt == MaxPresolveAttempts || budgetSpent)
         {
-            parseSolutionValue(line, indices, value);
-            assert(indices.size() == 3 && "colors background index length mismatch");
-            if(value == 1)
-            {
-                int x = indices[0];
-                int y = indices[1];
-                int c = indices[2];
-                colorsBackground(x, y).colors.insert(c);
-            }
+            presolve.restoreAll();
+        }
+        presolve.apply(problem);
+        // Start the search from a greedy assignment improved by local search, which is also kept
+        // when the solver stops at a worse incumbent on timeout
+        HeuristicSolver heuristicSolver(problem);
+        problem.start = CellAssignment();
+        if(heuristicSolver.greedy(problem.start))
+        {
+            heuristicSolver.localSearch(problem.start);
         }
-        else if(line.rfind(colorsOverlayPrefix, 0) == 0)
+        else
+        {
+            problem.start = CellAssignment();
+        }
+        // After an incremental re-solve failed, the previous palettes may give a better start
+        if(const PassResult* previous = previousPass(problem))
         {
-            parseSolutionValue(line, indices, value);
-            assert(indices.size() == 3 && "colors overlay index length mismatch");
-            if(value == 1)
+            CellAssignment previousStart;
+            if(heuristicSolver.fromPalettes(previous->solution.palettes, previousStart) &&
+               (problem.start.empty() || heuristicSolver.objective(previousStart) < heuristicSolver.objective(problem.start)))
             {
-                int x = indices[0];
-                int y = indices[1];
-                int c = indices[2];
-                colorsOverlay(x, y).colors.insert(c);
+                heuristicSolver.localSearch(previousStart);
+                problem.start = std::move(previousStart);
             }
         }
-        else if(line.rfind(palettesNamePrefix, 0) == 0)
+        if(reportIncumbents && !problem.start.empty())
         {
-            parseSolutionValue(line, indices, value);
-            assert(indices.size() == 2 && "Palette index length mismatch");
-            if(value == 1)
+            handleIncumbent(problem, presolve, problem.start, heuristicSolver.objective(problem.start));
+        }
+        problem.objectiveLowerBound = heuristicSolver.lowerBound();
+        if(!problem.start.empty() && (budgetSpent || heuristicSolver.objective(problem.start) <= problem.objectiveLowerBound))
+        {
+            // Heuristic result is already optimal or no time is left, so the solver can be skipped
+            solution = solutionFromAssignment(problem, problem.start);
+            solution.optimal = heuristicSolver.objective(problem.start) <= problem.objectiveLowerBound;
+        }
+        else
+        {
+            if(reportIncumbents)
             {
-                int p = indices[0];
-                int c = indices[1];
-                if(p >= palettes.size())
+                // Incumbents only carry palettes, which cells are then assigned to as by the heuristics
+                backend.setIncumbentCallback([&](const std::vector<Colors>& palettes)
                 {
-                    palettes.resize(p + 1);
-                }
-                palettes[p].insert(c);
+                    CellAssignment assignment;
+                    if(heuristicSolver.fromPalettes(palettes, assignment))
+                    {
+                        handleIncumbent(problem, presolve, assignment, heuristicSolver.objective(assignment));
+                    }
+                });
             }
-        }
-        else if(line.rfind(usesPalettePrefix, 0) == 0)
-        {
-            parseSolutionValue(line, indices, value);
-            assert(indices.size() == 3 && "Uses-palette index length mismatch");
-            if(value == 1)
+            try
             {
-                int x = indices[0];
-                int y = indices[1];
-                int paletteIndex = indices[2];
-                paletteIndicesBackground(x, y) = paletteIndex + (secondPass ? NumBackgroundPalettes : 0);
+                backend.solve(problem, solution);
+            }
+            catch(...)
+            {
+                backend.setIncumbentCallback(nullptr);
+                throw;
+            }
+            backend.setIncumbentCallback(nullptr);
+            // Backends that cannot stop at the bound may still reach it before timing out
+            if(solutionObjective(problem, solution) <= problem.objectiveLowerBound)
+            {
+                solution.optimal = true;
+            }
+            if(!solution.optimal && !problem.start.empty())
+            {
+                SolverSolution startSolution = solutionFromAssignment(problem, problem.start);
+                if(solutionObjective(problem, startSolution) < solutionObjective(problem, solution))
+                {
+                    solution = std::move(startSolution);
+                }
             }
         }
+        if(presolve.expand(solution))
+            break;
     }
-    return true;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -303,7 +645,7 @@ void OverlayOptimiser::setEmptyPaletteIndices(Array2D<uint8_t>& paletteIndices,
     {
         for(size_t x = 0; x < layer.width(); x++)
         {
-            if(layer(x, y).colors.size() == 0)
+            if(layer.cellColors(x, y) == 0)
             {
                 paletteIndices(x, y) = emptyIndex;
             }
@@ -346,6 +688,7 @@ void moveOverlayColors(const Image2D& inputImage,
     {
         for(size_t x = 0; x < layerOverlay.width(); x++)
         {
+            const ColorMask overlayColors = layerOverlay.cellColors(x, y);
             for(size_t i = 0; i < layerOverlay.cellHeight(); i++)
             {
                 for(size_t j = 0; j < layerOverlay.cellWidth(); j++)
@@ -355,7 +698,7 @@ void moveOverlayColors(const Image2D& inputImage,
                     uint8_t c = inputImage(xx, yy);
                     imageOverlay(xx, yy) = backgroundColor;
                     imageBackground(xx, yy) = inputImage(xx, yy);
-                    if(layerOverlay(x, y).colors.count(c) > 0)
+                    if(overlayColors & colorBit(c))
                     {
                         imageOverlay(xx, yy) = c;
                         imageBackground(xx, yy) = backgroundColor;
@@ -373,19 +716,22 @@ bool OverlayOptimiser::consistentLayers(const Image2D& image, const GridLayer& l
     assert(layer.width() == paletteIndices.width() && layer.height() == paletteIndices.height());
     const size_t w = layer.width();
     const size_t h = layer.height();
+    std::vector<ColorMask> paletteColors;
+    for(const Colors& palette : palettes)
+    {
+        paletteColors.push_back(colorMask(palette));
+    }
     for(size_t y = 0; y < h; y++)
     {
         for(size_t x = 0; x < w; x++)
         {
             uint8_t paletteIndex = paletteIndices(x, y);
             assert(paletteIndex < palettes.size());
-            for(uint8_t c : layer(x, y).colors)
-            {
-                bool colorInPalette = palettes[paletteIndex].count(c) > 0;
-                assert(colorInPalette && "GridCell colors must be present in palette");
-                if(!colorInPalette)
-                    return false;
-            }
+            const ColorMask cellColors = layer.cellColors(x, y);
+            bool colorsInPalette = (cellColors & ~paletteColors[paletteIndex]) == 0;
+            assert(colorsInPalette && "Grid cell colors must be present in palette");
+            if(!colorsInPalette)
+                return false;
             //
             for(size_t i = 0; i < layer.cellHeight(); i++)
             {
@@ -396,7 +742,7 @@ bool OverlayOptimiser::consistentLayers(const Image2D& image, const GridLayer& l
                     uint8_t c = image(xx, yy);
                     if(c != backgroundColor)
                     {
-                        bool colorInGridCell = layer(x, y).colors.count(c) > 0;
+                        bool colorInGridCell = (cellColors & colorBit(c)) != 0;
                         assert(colorInGridCell && "Pixel colors must be present in grid cell");
                         if(!colorInGridCell)
                             return false;
@@ -429,24 +775,24 @@ bool OverlayOptimiser::convertFirstPassNoBG(int gridCellColorLimit,
                                             std::vector<std::set<uint8_t>>& palettesBG,
                                             Array2D<uint8_t>& paletteIndicesBackground)
 {
-    std::set<uint8_t> colors;
+    ColorMask colors = 0;
     int maxCellsInRow = 0;
     for(int y = 0; y < layer.height(); y++)
     {
         int numCellsInRow = 0;
         for(int x = 0; x < layer.width(); x++)
         {
-            colors.insert(layer(x, y).colors.begin(), layer(x, y).colors.end());
-            if(layer(x, y).colors.size() > 0)
+            colors |= layer.cellColors(x, y);
+            if(layer.cellColors(x, y) != 0)
                 numCellsInRow++;
-            layerOverlay(x, y) = layer(x, y);
-            layerBackground(x, y) = GridCell();
+            layerOverlay.setCellColors(x, y, layer.cellColors(x, y));
+            layerBackground.setCellColors(x, y, 0);
         }
         maxCellsInRow = std::max(maxCellsInRow, numCellsInRow);
     }
     setEmptyPaletteIndices(paletteIndicesBackground, layerBackground, 0);
     const int maxColorsOverlay = maxSpritePalettes * gridCellColorLimit;
-    return colors.size() <= maxColorsOverlay && maxCellsInRow <= maxRowSize;
+    return colorCount(colors) <= maxColorsOverlay && maxCellsInRow <= maxRowSize;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -482,27 +828,13 @@ bool OverlayOptimiser::convertFirstPass(const Image2D& image,
             return true;
         }
     }
-    // Make layer for input image
-    writeCmplDataFile(layer,
-                      gridCellColorLimit,
-                      maxBackgroundPalettes,
-                      maxSpritePalettes,
-                      maxRowSize,
-                      workPathFilename(firstPassDataFilename));
-    //
-    runCmplProgram(exePathFilename(firstPassProgramInputFilename),
-                   workPathFilename(firstPassProgramOutputFilename),
-                   workPathFilename(firstPassSolutionFilename),
-                   timeOut);
-    if(!parseCmplSolution(workPathFilename(firstPassSolutionFilename),
-                          palettesBG,
-                          layerBackground,
-                          layerOverlay,
-                          paletteIndicesBackground,
-                          false))
-    {
-        throw Error("Failed to parse CMPL result (first pass)");
-    }
+    SolverProblem problem = firstPassProblem(layer, gridCellColorLimit, maxBackgroundPalettes, maxSpritePalettes, maxRowSize, timeOut);
+    SolverSolution solution;
+    solvePass(problem, solution);
+    palettesBG = solution.palettes;
+    layerBackground = solution.layerGrid;
+    layerOverlay = solution.layerMoved;
+    paletteIndicesBackground = solution.paletteIndices;
     setEmptyPaletteIndices(paletteIndicesBackground, layerBackground, 0);
     return true;
 }
@@ -519,29 +851,14 @@ bool OverlayOptimiser::convertSecondPass(int gridCellColorLimit,
                                          std::vector<std::set<uint8_t>>& palettes,
                                          Array2D<uint8_t>& paletteIndicesOverlay)
 {
-    writeCmplDataFile(layer,
-                      gridCellColorLimit,
-                      0,
-                      maxSpritePalettes,
-                      2 * maxSpritesPerScanline,
-                      workPathFilename(secondPassDataFilename));
-    //
-    runCmplProgram(exePathFilename(secondPassProgramInputFilename),
-                   workPathFilename(secondPassProgramOutputFilename),
-                   workPathFilename(secondPassSolutionFilename),
-                   timeOut);
-    std::vector<std::set<uint8_t>> palettesSPR;
-    if(!parseCmplSolution(workPathFilename(secondPassSolutionFilename),
-                          palettesSPR,
-                          layerOverlayGrid,
-                          layerOverlayFree,
-                          paletteIndicesOverlay,
-                          true))
-    {
-        throw Error("Failed to parse CMPL result (second pass)");
-    }
+    SolverProblem problem = secondPassProblem(layer, gridCellColorLimit, maxSpritePalettes, maxSpritesPerScanline, timeOut);
+    SolverSolution solution;
+    solvePass(problem, solution);
+    layerOverlayGrid = solution.layerGrid;
+    layerOverlayFree = solution.layerMoved;
+    paletteIndicesOverlay = solution.paletteIndices;
     setEmptyPaletteIndices(paletteIndicesOverlay, layerOverlayGrid, NumBackgroundPalettes);
-    for(const std::set<uint8_t>& palette : palettesSPR)
+    for(const std::set<uint8_t>& palette : solution.palettes)
     {
         palettes.push_back(palette);
     }
@@ -550,6 +867,309 @@ bool OverlayOptimiser::convertSecondPass(int gridCellColorLimit,
 
 //---------------------------------------------------------------------------------------------------------------------
 
+int OverlayOptimiser::firstPassMaxRowSize(int gridCellWidth, int maxSpritesPerScanline) const
+{
+    // * 4 to always get a visible solution, even if beyond constraints
+    return ((4 * spriteWidth()) / gridCellWidth) * maxSpritesPerScanline;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+SolverProblem OverlayOptimiser::firstPassProblem(const GridLayer& layer,
+                                                 int gridCellColorLimit,
+                                                 int maxBackgroundPalettes,
+                                                 int maxSpritePalettes,
+                                                 int maxRowSize,
+                                                 int timeOut) const
+{
+    SolverProblem problem;
+    problem.pass = SolverPass::First;
+    problem.layer = layer;
+    problem.gridCellColorLimit = gridCellColorLimit;
+    problem.numPalettes = maxBackgroundPalettes;
+    problem.maxSpritePalettes = maxSpritePalettes;
+    problem.maxRowSize = maxRowSize;
+    problem.timeOut = timeOut;
+    problem.paletteIndexOffset = 0;
+    problem.symmetryBreaking = mSymmetryBreaking;
+    problem.formulation = mFormulation;
+    return problem;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+SolverProblem OverlayOptimiser::secondPassProblem(const GridLayer& layer,
+                                                  int gridCellColorLimit,
+                                                  int maxSpritePalettes,
+                                                  int maxSpritesPerScanline,
+                                                  int timeOut) const
+{
+    SolverProblem problem;
+    problem.pass = SolverPass::Second;
+    problem.layer = layer;
+    problem.gridCellColorLimit = gridCellColorLimit;
+    problem.numPalettes = maxSpritePalettes;
+    problem.maxSpritePalettes = maxSpritePalettes;
+    problem.maxRowSize = 2 * maxSpritesPerScanline;
+    problem.timeOut = timeOut;
+    problem.paletteIndexOffset = uint8_t(NumBackgroundPalettes);
+    problem.symmetryBreaking = mSymmetryBreaking;
+    problem.formulation = mFormulation;
+    return problem;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::startSpeculator()
+{
+    mSpeculator.reset(new SecondPassSpeculator());
+    mSpeculator->thread = std::thread(&OverlayOptimiser::runSpeculator, this);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::queueSpeculativePass(const SolverSolution& firstPassSolution)
+{
+    SecondPassSpeculator& speculator = *mSpeculator;
+    std::lock_guard<std::mutex> lock(speculator.mutex);
+    speculator.firstPassSolution = firstPassSolution;
+    speculator.pending = true;
+    speculator.wakeUp.notify_one();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::runSpeculator()
+{
+    SecondPassSpeculator& speculator = *mSpeculator;
+    std::unique_lock<std::mutex> lock(speculator.mutex);
+    for(;;)
+    {
+        speculator.wakeUp.wait(lock, [&speculator] { return speculator.pending || speculator.stop; });
+        if(!speculator.pending)
+            return;
+        const SolverSolution firstPassSolution = std::move(speculator.firstPassSolution);
+        speculator.pending = false;
+        lock.unlock();
+        speculateSecondPass(firstPassSolution);
+        lock.lock();
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::stopSpeculator(bool finishPending)
+{
+    if(!mSpeculator)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mSpeculator->mutex);
+        mSpeculator->stop = true;
+        mSpeculator->pending = mSpeculator->pending && finishPending;
+        mSpeculator->wakeUp.notify_one();
+    }
+    mSpeculator->thread.join();
+    mSpeculator.reset();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::speculateSecondPass(const SolverSolution& firstPassSolution)
+{
+    const ConvertParameters& p = mConvertParameters;
+    if(p.maxSpritePalettes == 0)
+        return;
+    // Derive the overlay as convertImage() does for the final first pass solution
+    GridLayer layerBackground = firstPassSolution.layerGrid;
+    GridLayer layerOverlay = firstPassSolution.layerMoved;
+    std::vector<std::set<uint8_t>> palettes = firstPassSolution.palettes;
+    Array2D<uint8_t> paletteIndicesBackground = firstPassSolution.paletteIndices;
+    setEmptyPaletteIndices(paletteIndicesBackground, layerBackground, 0);
+    optimizeUnnecessaryOverlayColors(layerBackground,
+                                     layerOverlay,
+                                     paletteIndicesBackground,
+                                     0,
+                                     palettes);
+    Image2D imageBackground(p.image.width(), p.image.height());
+    Image2D imageOverlay(p.image.width(), p.image.height());
+    moveOverlayColors(p.image, imageBackground, imageOverlay, layerOverlay, p.backgroundColor);
+    if(imageOverlay.empty(p.backgroundColor))
+    {
+        stopSpeculativeRun();
+        return;
+    }
+    SolverProblem problem = secondPassProblem(GridLayer(p.backgroundColor, spriteWidth(), p.spriteHeight, imageOverlay),
+                                              p.gridCellColorLimit,
+                                              p.maxSpritePalettes,
+                                              4 * p.maxSpritesPerScanline,
+                                              passTimeOut(1.0));
+    // Better first pass solutions often leave the same overlay, which needs no restart
+    if(mSpeculativePass && sameLayerCells(mSpeculativePass->problem.layer, problem.layer))
+        return;
+    stopSpeculativeRun();
+    mSpeculativePass.reset(new SpeculativePass());
+    SpeculativePass* speculativePass = mSpeculativePass.get();
+    speculativePass->problem = std::move(problem);
+    // A single instance of the backend, with its own work directory for file-based backends
+    const std::string workPath = workPathFilename("speculative");
+    std::error_code errorCode;
+    std::filesystem::create_directories(workPath, errorCode);
+    speculativePass->backend = createConcurrentSolverBackend(mSolverBackend->name());
+    speculativePass->backend->setExecutablePath(mExecutablePath);
+    speculativePass->backend->setWorkPath(workPath);
+    speculativePass->backend->setCancelFlag(&speculativePass->stop);
+    speculativePass->thread = std::thread([this, speculativePass]()
+    {
+        try
+        {
+            solvePassFully(*speculativePass->backend, speculativePass->problem, speculativePass->solution, false);
+            speculativePass->valid = true;
+        }
+        catch(const std::exception&)
+        {
+            // The second pass is then solved after the first pass
+        }
+        speculativePass->finished = true;
+    });
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool OverlayOptimiser::takeSpeculativePass(const SolverProblem& problem, SolverSolution& solution)
+{
+    // Incumbents reported just before the first pass finished may still change the speculative run
+    stopSpeculator(true);
+    if(!mSpeculativePass)
+        return false;
+    SpeculativePass& speculativePass = *mSpeculativePass;
+    if(!sameProblemParameters(speculativePass.problem, problem) ||
+       !sameLayerCells(speculativePass.problem.layer, problem.layer))
+    {
+        stopSpeculativeRun();
+        return false;
+    }
+    // Wait for the speculative run, passing on cancelling of the conversion
+    const std::chrono::milliseconds PollInterval(10);
+    while(!speculativePass.finished)
+    {
+        if(mCancelFlag)
+        {
+            speculativePass.stop = true;
+        }
+        std::this_thread::sleep_for(PollInterval);
+    }
+    speculativePass.thread.join();
+    const bool valid = speculativePass.valid;
+    if(valid)
+    {
+        solution = std::move(speculativePass.solution);
+    }
+    mSpeculativePass.reset();
+    if(mCancelFlag)
+    {
+        throw SolverBackend::Cancelled();
+    }
+    return valid;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::stopSpeculativePass()
+{
+    stopSpeculator(false);
+    stopSpeculativeRun();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::stopSpeculativeRun()
+{
+    if(!mSpeculativePass)
+        return;
+    mSpeculativePass->stop = true;
+    mSpeculativePass->thread.join();
+    mSpeculativePass.reset();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::startDeadline(int timeOut)
+{
+    // Percentage of the time budget kept for the work after the solver passes
+    const int PostProcessingPercentage = 5;
+    if(timeOut <= 0)
+    {
+        mDeadline = std::chrono::steady_clock::time_point::max();
+        mPostProcessingReserve = std::chrono::steady_clock::duration::zero();
+        return;
+    }
+    const std::chrono::steady_clock::duration budget = std::chrono::seconds(timeOut);
+    mDeadline = std::chrono::steady_clock::now() + budget;
+    mPostProcessingReserve = budget * PostProcessingPercentage / 100;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int OverlayOptimiser::passTimeOut(double share) const
+{
+    if(mDeadline == std::chrono::steady_clock::time_point::max())
+        return 0;
+    const auto solvingTime = mDeadline - mPostProcessingReserve - std::chrono::steady_clock::now();
+    const int seconds = int(std::chrono::duration_cast<std::chrono::seconds>(solvingTime * share).count());
+    // A pass that starts late still gets time to return its start solution, as 0 would mean no limit
+    return std::max(seconds, 1);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+double OverlayOptimiser::firstPassShare(const GridLayer& layer, const PassBounds& firstPassBounds, int gridCellColorLimit, int maxSpritePalettes) const
+{
+    // The second pass gets all time left after the first one, so it is never starved by these limits
+    const double MinShare = 0.5;
+    const double MaxShare = 0.9;
+    if(maxSpritePalettes == 0)
+        return 1.0;
+    // The second pass model is not known yet. Each cell that must use sprites is estimated to become
+    // a full-palette second pass cell for each sprite it covers.
+    const int spritesPerCell = std::max(int(layer.cellWidth()) / spriteWidth(), 1) * std::max(int(layer.cellHeight()) / mSpriteHeight, 1);
+    const std::vector<int>& rowUsage = firstPassBounds.rowUsage();
+    const double secondPassSize = double(std::accumulate(rowUsage.begin(), rowUsage.end(), 0) * spritesPerCell * gridCellColorLimit);
+    const double firstPassSize = double(layer.colorsPerCellSum());
+    if(firstPassSize + secondPassSize <= 0.0)
+        return MaxShare;
+    return std::clamp(firstPassSize / (firstPassSize + secondPassSize), MinShare, MaxShare);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::cancel()
+{
+    mCancelFlag = true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::resetCancel()
+{
+    mCancelFlag = false;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+OverlayOptimiser::Status OverlayOptimiser::status() const
+{
+    return mStatus;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::setProvisionalCallback(const ProvisionalCallback& provisionalCallback)
+{
+    mProvisionalCallback = provisionalCallback;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
 std::string OverlayOptimiser::convert(const Image2D& image,
                                       uint8_t backgroundColor,
                                       int gridCellWidth,
@@ -561,47 +1181,113 @@ std::string OverlayOptimiser::convert(const Image2D& image,
                                       int maxSpritesPerScanline,
                                       int timeOut)
 {
-    // Remove old files
-    std::array<const char*, 6> filenames = {
-        firstPassProgramOutputFilename,
-        firstPassDataFilename,
-        firstPassSolutionFilename,
-        secondPassProgramOutputFilename,
-        secondPassDataFilename,
-        secondPassSolutionFilename
-    };
-    for(const char* filename : filenames)
+    mStatus = Status::Running;
+    mConvertParameters = ConvertParameters{image,
+                                           backgroundColor,
+                                           gridCellWidth,
+                                           gridCellHeight,
+                                           _spriteHeight,
+                                           gridCellColorLimit,
+                                           maxBackgroundPalettes,
+                                           maxSpritePalettes,
+                                           maxSpritesPerScanline,
+                                           timeOut};
+    startDeadline(timeOut);
+    if(mProvisionalCallback && !mHeuristicOnly)
     {
-        remove(workPathFilename(filename).c_str());
+        startProvisionalPublisher();
     }
+    if(mPipelined && !mHeuristicOnly)
+    {
+        startSpeculator();
+    }
+    try
+    {
+        std::string conversionError = convertImage(image,
+                                                   backgroundColor,
+                                                   gridCellWidth,
+                                                   gridCellHeight,
+                                                   _spriteHeight,
+                                                   gridCellColorLimit,
+                                                   maxBackgroundPalettes,
+                                                   maxSpritePalettes,
+                                                   maxSpritesPerScanline,
+                                                   timeOut);
+        stopSpeculativePass();
+        stopProvisionalPublisher();
+        mArena.release();
+        mStatus = conversionError.empty() ? Status::Finished : Status::Failed;
+        return conversionError;
+    }
+    catch(const SolverBackend::Cancelled&)
+    {
+        stopSpeculativePass();
+        stopProvisionalPublisher();
+        mArena.release();
+        mStatus = Status::Cancelled;
+        throw;
+    }
+    catch(...)
+    {
+        stopSpeculativePass();
+        stopProvisionalPublisher();
+        mArena.release();
+        mStatus = Status::Failed;
+        throw;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::string OverlayOptimiser::convertImage(const Image2D& image,
+                                           uint8_t backgroundColor,
+                                           int gridCellWidth,
+                                           int gridCellHeight,
+                                           int _spriteHeight,
+                                           int gridCellColorLimit,
+                                           int maxBackgroundPalettes,
+                                           int maxSpritePalettes,
+                                           int maxSpritesPerScanline,
+                                           int timeOut)
+{
     mBackgroundColor = backgroundColor;
     mSpriteHeight = _spriteHeight;
-    Image2D imageBackground(image.width(), image.height());
-    Image2D imageOverlay(image.width(), image.height());
-    Image2D imageOverlayGrid(image.width(), image.height());
-    Image2D imageOverlayFree(image.width(), image.height());
-    GridLayer layer(mBackgroundColor, gridCellWidth, gridCellHeight, image);
-    GridLayer layerBackground(mBackgroundColor, layer.cellWidth(), layer.cellHeight(), layer.width(), layer.height());
-    GridLayer layerOverlay(mBackgroundColor, layer.cellWidth(), layer.cellHeight(), layer.width(), layer.height());
-    Array2D<uint8_t> paletteIndicesBackground(layer.width(), layer.height());
+    mPassObjectives[0] = 0;
+    mPassObjectives[1] = 0;
+    // Temporaries live in the arena, and are copied to the default resource when assigned to persistent members
+    Image2D imageBackground(image.width(), image.height(), 0, &mArena);
+    Image2D imageOverlay(image.width(), image.height(), 0, &mArena);
+    Image2D imageOverlayGrid(image.width(), image.height(), 0, &mArena);
+    Image2D imageOverlayFree(image.width(), image.height(), 0, &mArena);
+    // Heuristic-only optimisers already run alongside others, and build their layers on one thread
+    const int layerThreads = mHeuristicOnly ? 1 : int(std::max(1u, std::thread::hardware_concurrency()));
+    GridLayer layer(mBackgroundColor, gridCellWidth, gridCellHeight, image, layerThreads, &mArena);
+    GridLayer layerBackground(mBackgroundColor, layer.cellWidth(), layer.cellHeight(), layer.width(), layer.height(), &mArena);
+    GridLayer layerOverlay(mBackgroundColor, layer.cellWidth(), layer.cellHeight(), layer.width(), layer.height(), &mArena);
+    Array2D<uint8_t> paletteIndicesBackground(layer.width(), layer.height(), 0, &mArena);
     const int OverlayGridCellWidth = spriteWidth();
     const int OverlayGridCellHeight = _spriteHeight;
     const int OverlayWidth = image.width() / OverlayGridCellWidth;
     const int OverlayHeight = image.height() / OverlayGridCellHeight;
     // Initialise output data to blank values
-    const Image2D blankImage = Image2D(image.width(), image.height(), mBackgroundColor);
+    // Images from a previous conversion of the same size keep their storage
+    Image2D blankImage = Image2D(image.width(), image.height(), mBackgroundColor);
     mOutputImage = blankImage;
     mOutputImageBackground = blankImage;
     mOutputImageOverlay = blankImage;
     mOutputImageOverlayGrid = blankImage;
-    mOutputImageOverlayFree = blankImage;
-    const GridLayer blankOverlay = GridLayer(mBackgroundColor, OverlayGridCellWidth, OverlayGridCellHeight, OverlayWidth, OverlayHeight);
+    mOutputImageOverlayFree = std::move(blankImage);
+    GridLayer blankOverlay = GridLayer(mBackgroundColor, OverlayGridCellWidth, OverlayGridCellHeight, OverlayWidth, OverlayHeight);
     mLayerOverlay = blankOverlay;
-    mLayerOverlayFree = blankOverlay;
+    mLayerOverlayFree = std::move(blankOverlay);
     mPaletteIndicesBackground = Array2D<uint8_t>(layer.width(), layer.height());
     mPaletteIndicesOverlay = Array2D<uint8_t>(OverlayWidth, OverlayHeight);
-    // * 4 to always get a visible solution, even if beyond constraints
-    int maxRowSize = ((4 * spriteWidth()) / gridCellWidth) * maxSpritesPerScanline;
+    int maxRowSize = firstPassMaxRowSize(gridCellWidth, maxSpritesPerScanline);
+    // Give up straight away when counting colors already proves that no solution exists
+    const PassBounds firstPassBounds(firstPassProblem(layer, gridCellColorLimit, maxBackgroundPalettes, maxSpritePalettes, maxRowSize, timeOut));
+    if(!firstPassBounds.feasible())
+        return firstPassBounds.infeasibilityDescription();
+    const int firstPassTimeOut = passTimeOut(firstPassShare(layer, firstPassBounds, gridCellColorLimit, maxSpritePalettes));
     // Execute first pass
     std::vector<std::set<uint8_t>> palettes;
     bool successPassOne = convertFirstPass(image,
@@ -609,7 +1295,7 @@ std::string OverlayOptimiser::convert(const Image2D& image,
                                            maxBackgroundPalettes,
                                            maxSpritePalettes,
                                            maxRowSize,
-                                           timeOut,
+                                           firstPassTimeOut,
                                            layer,
                                            layerBackground,
                                            layerOverlay,
@@ -637,8 +1323,16 @@ std::string OverlayOptimiser::convert(const Image2D& image,
     assert(!imageBackground.empty(mBackgroundColor) || maxBackgroundPalettes == 0);
     mOutputImageBackground = imageBackground;
     mLayerBackground = layerBackground;
+    // Re-initialise overlay layer with /2 width (...and /2 height if using 8x8 sprites)
+    std::string overlayError;
+    if(!imageOverlay.empty(mBackgroundColor) && maxSpritePalettes > 0)
+    {
+        layerOverlay = GridLayer(backgroundColor, OverlayGridCellWidth, OverlayGridCellHeight, imageOverlay, layerThreads, &mArena);
+        const PassBounds secondPassBounds(secondPassProblem(layerOverlay, gridCellColorLimit, maxSpritePalettes, 4 * maxSpritesPerScanline, timeOut));
+        overlayError = secondPassBounds.infeasibilityDescription();
+    }
     // if no colors were moved into overlay we are done
-    if(imageOverlay.empty(mBackgroundColor) || maxSpritePalettes == 0)
+    if(imageOverlay.empty(mBackgroundColor) || maxSpritePalettes == 0 || !overlayError.empty())
     {
         mOutputImage = image;
         mPaletteIndicesBackground = paletteIndicesBackground;
@@ -650,19 +1344,19 @@ std::string OverlayOptimiser::convert(const Image2D& image,
         mPalettes = palettes;
         if(imageOverlay.empty(mBackgroundColor))
             return "";
-        else
+        else if(maxSpritePalettes == 0)
             return "Sprite palettes required.";
+        else
+            return overlayError;
     }
-    // Re-initialise overlay layer with /2 width (...and /2 height if using 8x8 sprites)
-    layerOverlay = GridLayer(backgroundColor, OverlayGridCellWidth, OverlayGridCellHeight, imageOverlay);
-    GridLayer layerOverlayGrid(backgroundColor, OverlayGridCellWidth, OverlayGridCellHeight, OverlayWidth, OverlayHeight);
-    GridLayer layerOverlayFree(backgroundColor, OverlayGridCellWidth, OverlayGridCellHeight, OverlayWidth, OverlayHeight);
-    Array2D<uint8_t> paletteIndicesOverlay(OverlayWidth, OverlayHeight);
+    GridLayer layerOverlayGrid(backgroundColor, OverlayGridCellWidth, OverlayGridCellHeight, OverlayWidth, OverlayHeight, &mArena);
+    GridLayer layerOverlayFree(backgroundColor, OverlayGridCellWidth, OverlayGridCellHeight, OverlayWidth, OverlayHeight, &mArena);
+    Array2D<uint8_t> paletteIndicesOverlay(OverlayWidth, OverlayHeight, 0, &mArena);
     // Second pass
     bool successPassTwo = convertSecondPass(gridCellColorLimit,
                                             maxSpritePalettes,
                                             4 * maxSpritesPerScanline,
-                                            timeOut,
+                                            passTimeOut(1.0),
                                             layerOverlay,
                                             layerOverlayGrid,
                                             layerOverlayFree,
@@ -701,7 +1395,7 @@ std::string OverlayOptimiser::convert(const Image2D& image,
     assert(!mOutputImageBackground.empty(mBackgroundColor) || maxBackgroundPalettes == 0);
     mPalettes = palettes;
     // Finally, return error if maxSpritesPerScanline boundary not met
-    if(getMaxSpritesPerScanline(spritesOverlay()) > maxSpritesPerScanline)
+    if(getMaxSpritesPerScanline(spritesOverlay(&mArena)) > maxSpritesPerScanline)
         return "Too many sprites / scanline";
     else
         return "";
@@ -709,6 +1403,141 @@ std::string OverlayOptimiser::convert(const Image2D& image,
 
 //---------------------------------------------------------------------------------------------------------------------
 
+void OverlayOptimiser::findOptimalShift(const Image2D& image,
+                                        uint8_t backgroundColor,
+                                        int gridCellWidth,
+                                        int gridCellHeight,
+                                        int _spriteHeight,
+                                        int gridCellColorLimit,
+                                        int maxBackgroundPalettes,
+                                        int maxSpritePalettes,
+                                        int maxSpritesPerScanline,
+                                        int timeOut,
+                                        const std::atomic<bool>* cancelFlag,
+                                        int& shiftX,
+                                        int& shiftY) const
+{
+    // Number of best ranked shifts converted, as lower ranked ones rarely give a better conversion
+    const size_t MaxConvertedShifts = 16;
+    const auto deadline = timeOut > 0 ? std::chrono::steady_clock::now() + std::chrono::seconds(timeOut)
+                                      : std::chrono::steady_clock::time_point::max();
+    auto cancelled = [cancelFlag]()
+    {
+        return cancelFlag && *cancelFlag;
+    };
+    struct Candidate
+    {
+        int x;
+        int y;
+        size_t cost;
+        int lowerBound;
+        bool failed;
+        int objectives[2];
+    };
+    // Rank shifts by the cheap cost, and bound the background columns each of them moves
+    const int maxRowSize = firstPassMaxRowSize(gridCellWidth, maxSpritesPerScanline);
+    std::vector<Candidate> candidates;
+    ShiftedGridLayers layers(backgroundColor, gridCellWidth, gridCellHeight, image, 0, gridCellWidth - 1, 0, gridCellHeight - 1);
+    do
+    {
+        if(cancelled())
+        {
+            throw SolverBackend::Cancelled();
+        }
+        SolverProblem problem = firstPassProblem(layers.layer(), gridCellColorLimit, maxBackgroundPalettes, maxSpritePalettes, maxRowSize, 0);
+        Presolve(problem, false).apply(problem);
+        const int lowerBound = maxBackgroundPalettes > 0 ? HeuristicSolver(problem).lowerBound() : 0;
+        candidates.push_back(Candidate{layers.shiftX(), layers.shiftY(), layers.colorsPerCellSum(), lowerBound, true, {0, 0}});
+    }
+    while(layers.next());
+    std::stable_sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b)
+    {
+        return a.cost < b.cost;
+    });
+    // Ties are won by the shift ranked first
+    auto better = [&](size_t i, size_t j)
+    {
+        const Candidate& a = candidates[i];
+        const Candidate& b = candidates[j];
+        if(a.failed != b.failed)
+            return !a.failed;
+        if(a.objectives[0] != b.objectives[0])
+            return a.objectives[0] < b.objectives[0];
+        if(a.objectives[1] != b.objectives[1])
+            return a.objectives[1] < b.objectives[1];
+        return i < j;
+    };
+    const size_t numConverted = std::min(candidates.size(), MaxConvertedShifts);
+    std::mutex bestMutex;
+    size_t best = candidates.size();
+    std::atomic<size_t> next(0);
+    auto convertCandidates = [&]()
+    {
+        for(size_t i = next++; i < numConverted; i = next++)
+        {
+            if(cancelled() || (i > 0 && std::chrono::steady_clock::now() >= deadline))
+                break;
+            Candidate& candidate = candidates[i];
+            {
+                std::lock_guard<std::mutex> lock(bestMutex);
+                if(best < candidates.size() && !candidates[best].failed && candidate.lowerBound > candidates[best].objectives[0])
+                    continue;
+            }
+            OverlayOptimiser optimiser;
+            optimiser.mHeuristicOnly = true;
+            optimiser.mSymmetryBreaking = mSymmetryBreaking;
+            try
+            {
+                const std::string conversionError = optimiser.convert(shiftImage(image, candidate.x, candidate.y),
+                                                                      backgroundColor,
+                                                                      gridCellWidth,
+                                                                      gridCellHeight,
+                                                                      _spriteHeight,
+                                                                      gridCellColorLimit,
+                                                                      maxBackgroundPalettes,
+                                                                      maxSpritePalettes,
+                                                                      maxSpritesPerScanline,
+                                                                      0);
+                candidate.failed = !conversionError.empty();
+                candidate.objectives[0] = optimiser.mPassObjectives[0];
+                candidate.objectives[1] = optimiser.mPassObjectives[1];
+            }
+            catch(const std::runtime_error&)
+            {
+                candidate.failed = true;
+                candidate.objectives[0] = std::numeric_limits<int>::max();
+                candidate.objectives[1] = std::numeric_limits<int>::max();
+            }
+            std::lock_guard<std::mutex> lock(bestMutex);
+            if(best == candidates.size() || better(i, best))
+            {
+                best = i;
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    const unsigned numThreads = std::max(1u, std::thread::hardware_concurrency());
+    for(unsigned i = 1; i < numThreads; i++)
+    {
+        threads.emplace_back(convertCandidates);
+    }
+    convertCandidates();
+    for(std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    if(cancelled())
+    {
+        throw SolverBackend::Cancelled();
+    }
+    // The first ranked shift is never skipped
+    assert(best < candidates.size());
+    shiftX = candidates[best].x;
+    shiftY = candidates[best].y;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
 bool OverlayOptimiser::conversionSuccessful() const
 {
     return mConversionSuccessful;
@@ -735,6 +1564,7 @@ Image2D OverlayOptimiser::outputImageOverlayGrid() const
 Image2D OverlayOptimiser::outputImageOverlayFree() const
 {
     auto sprites = spritesOverlayFree();
+    const std::vector<Palette> palettes = compactPalettes(mPalettes);
     // Write sprites to new image
     Image2D outputImage(mOutputImageOverlayFree.width(), mOutputImageOverlayFree.height());
     for(auto const& s : sprites)
@@ -746,7 +1576,7 @@ Image2D OverlayOptimiser::outputImageOverlayFree() const
                 uint8_t c = s.pixels(x, y);
                 if(c != mBackgroundColor)
                 {
-                    outputImage(s.x + x, s.y + y) = (s.p << 2) | indexInPalette(mPalettes[s.p], c);
+                    outputImage(s.x + x, s.y + y) = (s.p << 2) | palettes[s.p].slot(c);
                 }
             }
         }
@@ -803,42 +1633,27 @@ Image2D OverlayOptimiser::remapColors(const Image2D& image,
                                       const std::vector<std::set<uint8_t>>& palettes,
                                       const Array2D<uint8_t>& paletteIndices) const
 {
-    // Create per-cell mapping
-    size_t gridWidth = paletteIndices.width();
-    size_t gridHeight = paletteIndices.height();
-    Array2D<std::unordered_map<uint8_t, uint8_t>> perCellMappingForward(gridWidth, gridHeight);
-    for(size_t y = 0; y < gridHeight; y++)
-    {
-        for(size_t x = 0; x < gridWidth; x++)
-        {
-            uint8_t paletteIndex = paletteIndices(x, y);
-            size_t j = 1;
-            for(uint8_t c : palettes[paletteIndex])
-            {
-                perCellMappingForward(x, y)[c] = paletteIndex * PaletteGroupSize + j;
-                j++;
-            }
-        }
-    }
-    // Map each pixel
+    // Map each pixel through the lookup table of the palette of its cell
+    const std::vector<Palette> compact = compactPalettes(palettes);
     Image2D rImage(image.width(), image.height());
     for(size_t y = 0; y < image.height(); y++)
     {
+        const uint8_t* pixels = image.row(y);
+        uint8_t* mappedPixels = rImage.row(y);
+        const size_t cellY = y / layer.cellHeight();
         for(size_t x = 0; x < image.width(); x++)
         {
-            size_t cellX = x / layer.cellWidth();
-            size_t cellY = y / layer.cellHeight();
-            const std::unordered_map<uint8_t, uint8_t>& m = perCellMappingForward(cellX, cellY);
-            uint8_t c = image(x, y);
-            if(m.find(c) != m.end())
+            const uint8_t paletteIndex = paletteIndices(x / layer.cellWidth(), cellY);
+            const uint8_t c = pixels[x];
+            const uint8_t slot = compact[paletteIndex].slot(c);
+            if(slot != 0)
             {
-                c = m.at(c);
-                rImage(x, y) = c;
+                mappedPixels[x] = paletteIndex * PaletteGroupSize + slot;
             }
             else
             {
                 assert(c == mBackgroundColor);
-                rImage(x, y) = 0;
+                mappedPixels[x] = 0;
             }
         }
     }
@@ -854,67 +1669,77 @@ const std::vector<std::set<uint8_t>> &OverlayOptimiser::palettes() const
 
 //---------------------------------------------------------------------------------------------------------------------
 
+//
+// View of the sprite at (x, y), clipped by the image edge
+//
+template<typename T>
+static Array2DView<T> spriteView(Array2DView<T> image, size_t x, size_t y, size_t width, size_t height)
+{
+    assert(x <= image.width() && y <= image.height());
+    return image.subView(x, y, std::min(width, image.width() - x), std::min(height, image.height() - y));
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
 Sprite OverlayOptimiser::extractSpriteWithBestPalette(Image2D& overlayImage,
                                                       size_t x,
                                                       size_t y,
                                                       size_t width,
                                                       size_t height,
-                                                      bool removePixels) const
+                                                      bool removePixels,
+                                                      std::pmr::memory_resource* resource) const
 {
-    // Try extracting sprites for each palette, and keep track of best one (the one extracting most colors)
+    const Array2DView<uint8_t> pixels = spriteView(Array2DView<uint8_t>(overlayImage), x, y, width, height);
+    // Try each palette on the pixels in place, and keep track of best one (the one extracting most colors)
     size_t bestIndex = 0;
-    size_t bestMaxColors = 0;
+    int bestMaxColors = 0;
     for(size_t i = NumBackgroundPalettes; i < NumBackgroundPalettes + NumSpritePalettes; i++)
     {
-        Sprite s = extractSprite(overlayImage,
-                                 x,
-                                 y,
-                                 width,
-                                 height,
-                                 mPalettes[i],
-                                 mBackgroundColor,
-                                 false);
-        if(s.colors.size() > bestMaxColors)
+        if(colorCount(spriteColors(pixels, colorMask(mPalettes[i]))) > bestMaxColors)
             bestIndex = i;
     }
-    // Do final extraction with (potential) pixel removal
-    Sprite s = extractSprite(overlayImage,
+    // Copy the pixels only for the chosen palette, followed by (potential) pixel removal
+    Sprite s = extractSprite(pixels,
                              x,
                              y,
                              width,
                              height,
                              mPalettes[bestIndex],
                              mBackgroundColor,
-                             removePixels);
+                             resource);
+    if(removePixels)
+    {
+        removeSpritePixels(pixels, mPalettes[bestIndex], mBackgroundColor);
+    }
     s.p = bestIndex;
     return s;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-std::vector<Sprite> OverlayOptimiser::spritesOverlayGrid() const
+std::vector<Sprite> OverlayOptimiser::spritesOverlayGrid(std::pmr::memory_resource* resource) const
 {
     const GridLayer& layer = mLayerOverlay;
     const Array2D<uint8_t>& paletteIndicesOverlay = mPaletteIndicesOverlay;
     std::vector<Sprite> sprites;
-    Image2D overlayImage = mOutputImageOverlayGrid;
+    const Array2DView<const uint8_t> overlayImage(mOutputImageOverlayGrid);
     for(size_t y = 0; y < layer.height(); y++)
     {
         for(size_t x = 0; x < layer.width(); x++)
         {
-            if(layer(x, y).colors.size() > 0)
+            if(layer.cellColors(x, y) != 0)
             {
                 uint8_t p = paletteIndicesOverlay(x, y);
-                Sprite s = extractSprite(overlayImage,
+                Sprite s = extractSprite(spriteView(overlayImage, x * layer.cellWidth(), y * layer.cellHeight(), spriteWidth(), spriteHeight()),
                                          x * layer.cellWidth(),
                                          y * layer.cellHeight(),
                                          spriteWidth(),
                                          spriteHeight(),
                                          mPalettes[p],
                                          mBackgroundColor,
-                                         false);
+                                         resource);
                 s.p = p;
-                sprites.push_back(s);
+                sprites.push_back(std::move(s));
             }
         }
     }
@@ -923,9 +1748,10 @@ std::vector<Sprite> OverlayOptimiser::spritesOverlayGrid() const
 
 //---------------------------------------------------------------------------------------------------------------------
 
-std::vector<Sprite> OverlayOptimiser::spritesOverlayFree() const
+std::vector<Sprite> OverlayOptimiser::spritesOverlayFree(std::pmr::memory_resource* resource) const
 {
-    Image2D overlayImage = mOutputImageOverlayFree;
+    // Extracted pixels are removed from a working copy of the image
+    Image2D overlayImage(mOutputImageOverlayFree, resource);
     std::vector<Sprite> sprites;
     size_t y = 0;
     while(y < overlayImage.height())
@@ -948,10 +1774,10 @@ std::vector<Sprite> OverlayOptimiser::spritesOverlayFree() const
             if(columnHasPixels)
             {
                 // Extract pixels into sprite at (x, y)
-                Sprite s = extractSpriteWithBestPalette(overlayImage, x, y, spriteWidth(), spriteHeight(), true);
+                Sprite s = extractSpriteWithBestPalette(overlayImage, x, y, spriteWidth(), spriteHeight(), true, resource);
                 if(s.colors.size() > 0)
                 {
-                    sprites.push_back(s);
+                    sprites.push_back(std::move(s));
                 }
                 else
                 {
@@ -973,22 +1799,22 @@ std::vector<Sprite> OverlayOptimiser::spritesOverlayFree() const
 
 //---------------------------------------------------------------------------------------------------------------------
 
-std::vector<Sprite> OverlayOptimiser::spritesOverlay() const
+std::vector<Sprite> OverlayOptimiser::spritesOverlay(std::pmr::memory_resource* resource) const
 {
-    std::vector<Sprite> sprites = spritesOverlayGrid();
-    std::vector<Sprite> spritesFree = spritesOverlayFree();
-    sprites.insert( sprites.end(), spritesFree.begin(), spritesFree.end() );
+    std::vector<Sprite> sprites = spritesOverlayGrid(resource);
+    std::vector<Sprite> spritesFree = spritesOverlayFree(resource);
+    sprites.insert(sprites.end(), std::make_move_iterator(spritesFree.begin()), std::make_move_iterator(spritesFree.end()));
     for(Sprite& s : sprites)
     {
         s.numBlankPixelsLeft = getNumBlankPixelsLeft(s);
         s.numBlankPixelsRight = getNumBlankPixelsRight(s);
     }
-    return optimizeHorizontallyAdjacentSprites(sprites);
+    return optimizeHorizontallyAdjacentSprites(std::move(sprites));
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-int OverlayOptimiser::getNumBlankPixelsLeft(Sprite sprite) const
+int OverlayOptimiser::getNumBlankPixelsLeft(const Sprite& sprite) const
 {
     assert(sprite.pixels.width() == spriteWidth());
     assert(sprite.pixels.height() == spriteHeight());
@@ -1005,7 +1831,7 @@ int OverlayOptimiser::getNumBlankPixelsLeft(Sprite sprite) const
 
 //---------------------------------------------------------------------------------------------------------------------
 
-int OverlayOptimiser::getNumBlankPixelsRight(Sprite sprite) const
+int OverlayOptimiser::getNumBlankPixelsRight(const Sprite& sprite) const
 {
     assert(sprite.pixels.width() == spriteWidth());
     assert(sprite.pixels.height() == spriteHeight());
@@ -1036,16 +1862,16 @@ std::vector<std::vector<Sprite>> OverlayOptimiser::getAdjacentSlices(std::vector
                sprites[i].p != previous.p)
             {
                 std::vector<Sprite> slice;
-                slice.insert(slice.end(), sprites.begin(), sprites.begin() + i);
+                slice.insert(slice.end(), std::make_move_iterator(sprites.begin()), std::make_move_iterator(sprites.begin() + i));
                 sprites.erase(sprites.begin(), sprites.begin() + i);
-                slices.push_back(slice);
+                slices.push_back(std::move(slice));
                 sliceFound = true;
                 break;
             }
         }
         if(!sliceFound)
         {
-            slices.push_back(sprites);
+            slices.push_back(std::move(sprites));
             break;
         }
     }
@@ -1054,9 +1880,9 @@ std::vector<std::vector<Sprite>> OverlayOptimiser::getAdjacentSlices(std::vector
 
 //---------------------------------------------------------------------------------------------------------------------
 
-std::vector<Sprite> OverlayOptimiser::optimizeHorizontallyAdjacentSprites(const std::vector<Sprite>& sprites) const
+std::vector<Sprite> OverlayOptimiser::optimizeHorizontallyAdjacentSprites(std::vector<Sprite> sprites) const
 {
-    std::vector<std::vector<Sprite>> adjacentSlices = getAdjacentSlices(sprites);
+    std::vector<std::vector<Sprite>> adjacentSlices = getAdjacentSlices(std::move(sprites));
     std::vector<Sprite> newSprites;
     for(auto& adjacentSlice : adjacentSlices)
     {
@@ -1079,7 +1905,7 @@ std::vector<Sprite> OverlayOptimiser::optimizeHorizontallyAdjacentSprites(const
                 }
             }
         }
-        newSprites.insert(newSprites.end(), adjacentSlice.begin(), adjacentSlice.end());
+        newSprites.insert(newSprites.end(), std::make_move_iterator(adjacentSlice.begin()), std::make_move_iterator(adjacentSlice.end()));
     }
     return newSprites;
 }
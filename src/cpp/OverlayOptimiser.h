@@ -21,12 +21,24 @@
 #define OVERLAY_OPTIMISER_H
 
 #include <functional>
+#include <memory>
+#include <memory_resource>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
 #include <string>
 #include <stdexcept>
 
 #include "GridLayer.h"
 #include "Array2D.h"
 #include "Sprite.h"
+#include "SolverBackend.h"
+#include "SolutionCache.h"
+
+class Presolve;
+class PassBounds;
 
 class OverlayOptimiser
 {
@@ -40,6 +52,18 @@ public:
         {}
     };
 
+    //
+    // State of the latest call to convert()
+    //
+    enum class Status
+    {
+        Idle,
+        Running,
+        Finished,
+        Failed,
+        Cancelled
+    };
+
     OverlayOptimiser();
 
     void setExecutablePath(const std::string& executablePath);
@@ -48,6 +72,69 @@ public:
     std::string exePathFilename(const std::string& exeFilename) const;
     std::string workPathFilename(const std::string& workFilename) const;
 
+    void setSolverBackend(const std::string& name, int portfolioSize = 1);
+    std::string solverBackend() const;
+    int portfolioSize() const;
+
+    void setSymmetryBreaking(bool symmetryBreaking);
+    bool symmetryBreaking() const;
+
+    void setPresolve(bool presolve);
+    bool presolve() const;
+
+    void setFormulation(Formulation formulation);
+    Formulation formulation() const;
+
+    //
+    // Re-solve each pass starting from the previous solution of the same pass, as used when tracking
+    // an input file. Only cells that changed since the previous conversion get new decisions.
+    //
+    void setIncremental(bool incremental);
+    bool incremental() const;
+
+    //
+    // Start solving the second pass in the background as soon as the first pass finds a solution,
+    // so that both passes search at the same time. The background run is restarted whenever a better
+    // first pass solution changes the overlay, and its result is used if the final first pass solution
+    // leaves the same overlay.
+    //
+    void setPipelined(bool pipelined);
+    bool pipelined() const;
+
+    //
+    // Directory to cache pass solutions in. An empty path disables the cache.
+    //
+    void setCachePath(const std::string& cachePath);
+
+    //
+    // Only reuse cached solutions that were proven optimal
+    //
+    void setCacheRequireOptimal(bool cacheRequireOptimal);
+    bool cacheRequireOptimal() const;
+
+    //
+    // Stop a running convert() from another thread, making it throw SolverBackend::Cancelled.
+    // Solver processes are killed rather than waited on. The request stays in effect, also for
+    // later conversions, until resetCancel() is called.
+    //
+    void cancel();
+    void resetCancel();
+
+    Status status() const;
+
+    //
+    // Called with a complete provisional conversion each time convert() finds a better solution for
+    // a pass: first from the heuristic start, then from the incumbents of backends that report them.
+    // The provisional optimiser holds the same outputs as this one does after convert(). It is called
+    // from the converting thread or from a solver thread, and must not call back into this optimiser.
+    //
+    using ProvisionalCallback = std::function<void(const OverlayOptimiser& provisional)>;
+    void setProvisionalCallback(const ProvisionalCallback& provisionalCallback);
+
+    //
+    // Convert an image. timeOut is the time budget in seconds of the whole conversion (0 = no limit),
+    // which is split between the solver passes with a share kept for the work after them.
+    //
     std::string convert(const Image2D& image,
                         uint8_t backgroundColor,
                         int gridCellWidth,
@@ -59,6 +146,30 @@ public:
                         int maxSpritesPerScanline,
                         int timeOut);
 
+    //
+    // Find the shift of an image within one grid cell that gives the best conversion.
+    //
+    // Shifts are tried in order of their total number of colors per cell, by converting them with
+    // heuristics alone on all cores. Conversions that meet all limits are preferred, then those moving
+    // the fewest pixel columns out of the background and out of grid-aligned sprites. Shifts whose lower
+    // bound on moved background columns is above the best conversion found so far are skipped.
+    // Only the best ranked shifts are converted, and no more are started once timeOut seconds have
+    // passed (0 for no limit). Throws SolverBackend::Cancelled once the optional cancelFlag is set.
+    //
+    void findOptimalShift(const Image2D& image,
+                          uint8_t backgroundColor,
+                          int gridCellWidth,
+                          int gridCellHeight,
+                          int _spriteHeight,
+                          int gridCellColorLimit,
+                          int maxBackgroundPalettes,
+                          int maxSpritePalettes,
+                          int maxSpritesPerScanline,
+                          int timeOut,
+                          const std::atomic<bool>* cancelFlag,
+                          int& shiftX,
+                          int& shiftY) const;
+
     bool conversionSuccessful() const;
 
     Image2D outputImageBackground() const;
@@ -84,20 +195,23 @@ public:
 
     const GridLayer& layerOverlay() const;
 
-    std::vector<Sprite> spritesOverlayGrid() const;
-    std::vector<Sprite> spritesOverlayFree() const;
-    std::vector<Sprite> spritesOverlay() const;
+    //
+    // Sprites of the overlay, with sprite pixels allocated from resource
+    //
+    std::vector<Sprite> spritesOverlayGrid(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) const;
+    std::vector<Sprite> spritesOverlayFree(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) const;
+    std::vector<Sprite> spritesOverlay(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) const;
 
     int getMaxSpritesPerScanline(const std::vector<Sprite>& sprites) const;
 
     static uint8_t indexInPalette(const std::set<uint8_t>& palette, uint8_t color);
 
-    int getNumBlankPixelsLeft(Sprite sprite) const;
-    int getNumBlankPixelsRight(Sprite sprite) const;
+    int getNumBlankPixelsLeft(const Sprite& sprite) const;
+    int getNumBlankPixelsRight(const Sprite& sprite) const;
 
     std::vector<std::vector<Sprite>> getAdjacentSlices(std::vector<Sprite> sprites) const;
 
-    std::vector<Sprite> optimizeHorizontallyAdjacentSprites(const std::vector<Sprite>& sprites) const;
+    std::vector<Sprite> optimizeHorizontallyAdjacentSprites(std::vector<Sprite> sprites) const;
 
     int spriteWidth() const;
     int spriteHeight() const;
@@ -106,22 +220,191 @@ public:
 
 protected:
 
-    void writeCmplDataFile(const GridLayer& layer, int gridCellColorLimit, int maxBackgroundPalettes, int maxSpritePalettes, int maxRowSize, const std::string& filename);
-    void writeCmplLayerData(std::ofstream& f, const std::string& name, const GridLayer& layer, std::function<int(int, int, int)> const& callback);
+    std::string convertImage(const Image2D& image,
+                             uint8_t backgroundColor,
+                             int gridCellWidth,
+                             int gridCellHeight,
+                             int _spriteHeight,
+                             int gridCellColorLimit,
+                             int maxBackgroundPalettes,
+                             int maxSpritePalettes,
+                             int maxSpritesPerScanline,
+                             int timeOut);
+
+    //
+    // Problem and solution of the last solved pass
+    //
+    struct PassResult
+    {
+        SolverProblem problem;
+        SolverSolution solution;
+        bool valid = false;
+    };
 
-    void runCmplProgram(const std::string& inputFilename,
-                        const std::string& outputFilename,
-                        const std::string& solutionCsvFilename,
-                        int timeOut);
+    const PassResult* previousPass(const SolverProblem& problem) const;
 
-    static void parseSolutionValue(const std::string& line, std::vector<int>& indices, int& value);
+    bool solvePassIncrementally(const SolverProblem& problem, SolverSolution& solution) const;
 
-    bool parseCmplSolution(const std::string& csvFilename,
-                           std::vector<std::set<uint8_t>>& palettes,
-                           GridLayer& colorsBackground,
-                           GridLayer& colorsOverlay,
-                           Array2D<uint8_t>& paletteIndicesBackground,
-                           bool secondPass);
+    //
+    // Solve a pass with a backend. With reportIncumbents set, the heuristic start and the incumbents
+    // reported by the backend are passed to handleIncumbent().
+    //
+    void solvePassFully(SolverBackend& backend, SolverProblem& problem, SolverSolution& solution, bool reportIncumbents);
+
+    void solvePassHeuristically(SolverProblem& problem, SolverSolution& solution) const;
+
+    void solvePass(SolverProblem& problem, SolverSolution& solution);
+
+    //
+    // Parameters of the latest call to convert()
+    //
+    struct ConvertParameters
+    {
+        Image2D image;
+        uint8_t backgroundColor = 0;
+        int gridCellWidth = 0;
+        int gridCellHeight = 0;
+        int spriteHeight = 0;
+        int gridCellColorLimit = 0;
+        int maxBackgroundPalettes = 0;
+        int maxSpritePalettes = 0;
+        int maxSpritesPerScanline = 0;
+        int timeOut = 0;
+    };
+
+    //
+    // Use an assignment of a presolved pass problem found while solving, unless a solution with the same
+    // or a lower objective was already used for the pass
+    //
+    void handleIncumbent(const SolverProblem& problem, const Presolve& presolve, const CellAssignment& assignment, int objective);
+
+    //
+    // Pass the conversion resulting from a pass solution to the provisional callback. Second pass
+    // solutions are combined with the given first pass solution.
+    //
+    void publishProvisional(SolverPass pass, const SolverSolution& solution, const SolverSolution& firstPassSolution);
+
+    //
+    // Worker publishing provisional results off the solver threads. Only the latest queued solution is
+    // kept, and publishing is throttled to leave the cores to the solvers.
+    //
+    struct ProvisionalPublisher
+    {
+        std::mutex mutex;
+        std::condition_variable wakeUp;
+        bool pending = false;
+        bool stop = false;
+        SolverPass pass = SolverPass::First;
+        SolverSolution solution;
+        SolverSolution firstPassSolution;
+        std::thread thread;
+    };
+
+    void startProvisionalPublisher();
+
+    //
+    // Hand a pass solution to the publisher, replacing any solution not yet published. Returns at once.
+    //
+    void queueProvisional(SolverPass pass, const SolverSolution& solution);
+
+    void runProvisionalPublisher();
+
+    //
+    // Stop the publisher, dropping any solution not yet published
+    //
+    void stopProvisionalPublisher();
+
+    //
+    // Second pass solved in the background while the first pass is still searching
+    //
+    struct SpeculativePass
+    {
+        SolverProblem problem;
+        SolverSolution solution;
+        std::unique_ptr<SolverBackend> backend;
+        std::atomic<bool> stop{false};
+        std::atomic<bool> finished{false};
+        bool valid = false;
+        std::thread thread;
+    };
+
+    //
+    // Worker (re)starting the speculative second pass for the latest first pass incumbent, so that
+    // solver threads reporting incumbents never wait for a speculative run to stop
+    //
+    struct SecondPassSpeculator
+    {
+        std::mutex mutex;
+        std::condition_variable wakeUp;
+        bool pending = false;
+        bool stop = false;
+        SolverSolution firstPassSolution;
+        std::thread thread;
+    };
+
+    void startSpeculator();
+
+    //
+    // Hand a first pass solution to the speculator, replacing any solution not yet handled. Returns at once.
+    //
+    void queueSpeculativePass(const SolverSolution& firstPassSolution);
+
+    void runSpeculator();
+
+    //
+    // Stop the speculator. With finishPending set, a solution not yet handled still (re)starts the
+    // speculative run, otherwise it is dropped.
+    //
+    void stopSpeculator(bool finishPending);
+
+    //
+    // (Re)start the speculative second pass for the overlay left by a first pass solution.
+    // Only called from the speculator thread.
+    //
+    void speculateSecondPass(const SolverSolution& firstPassSolution);
+
+    //
+    // Wait for the speculative second pass and use its solution, if it was started for the same problem
+    //
+    bool takeSpeculativePass(const SolverProblem& problem, SolverSolution& solution);
+
+    //
+    // Stop the speculator and any speculative run
+    //
+    void stopSpeculativePass();
+
+    void stopSpeculativeRun();
+
+    //
+    // Start counting down the time budget of a conversion
+    //
+    void startDeadline(int timeOut);
+
+    //
+    // Solver time limit in seconds for a pass starting now, given the share of the time left for solving.
+    // Returns 0 when the conversion has no time limit.
+    //
+    int passTimeOut(double share) const;
+
+    //
+    // Share of the solving time to give the first pass, from the relative sizes of the two pass models
+    //
+    double firstPassShare(const GridLayer& layer, const PassBounds& firstPassBounds, int gridCellColorLimit, int maxSpritePalettes) const;
+
+    int firstPassMaxRowSize(int gridCellWidth, int maxSpritesPerScanline) const;
+
+    SolverProblem firstPassProblem(const GridLayer& layer,
+                                   int gridCellColorLimit,
+                                   int maxBackgroundPalettes,
+                                   int maxSpritePalettes,
+                                   int maxRowSize,
+                                   int timeOut) const;
+
+    SolverProblem secondPassProblem(const GridLayer& layer,
+                                    int gridCellColorLimit,
+                                    int maxSpritePalettes,
+                                    int maxSpritesPerScanline,
+                                    int timeOut) const;
 
     bool consistentLayers(const Image2D& image,
                           const GridLayer& layer,
@@ -162,11 +445,45 @@ protected:
 
     void fillMissingPaletteGroups(std::vector<std::set<uint8_t>>& palettes, size_t numPalettes);
 
-    Sprite extractSpriteWithBestPalette(Image2D& overlayImage, size_t x, size_t y, size_t spriteWidth, size_t spriteHeight, bool removePixels) const;
+    Sprite extractSpriteWithBestPalette(Image2D& overlayImage, size_t x, size_t y, size_t spriteWidth, size_t spriteHeight, bool removePixels, std::pmr::memory_resource* resource) const;
 
 private:
     std::string mExecutablePath;
     std::string mWorkPath;
+    std::unique_ptr<SolverBackend> mSolverBackend;
+    std::atomic<bool> mCancelFlag;
+    std::atomic<Status> mStatus;
+    int mPortfolioSize;
+    bool mSymmetryBreaking;
+    bool mPresolve;
+    Formulation mFormulation;
+    bool mIncremental;
+    bool mPipelined;
+    PassResult mPreviousPasses[2];
+    SolutionCache mSolutionCache;
+    ProvisionalCallback mProvisionalCallback;
+    // Guards mIncumbentObjective while incumbents are reported
+    std::mutex mIncumbentMutex;
+    int mIncumbentObjective;
+    ConvertParameters mConvertParameters;
+    // End of the time budget of the latest conversion. The maximum time point means no limit.
+    std::chrono::steady_clock::time_point mDeadline;
+    std::chrono::steady_clock::duration mPostProcessingReserve;
+    // Final first pass solution, which provisional second pass solutions are combined with
+    SolverSolution mFirstPassSolution;
+    // Set on provisional optimisers only: pass solutions to use as given, and solving remaining passes
+    // by heuristics alone
+    const SolverSolution* mFixedPassSolutions[2];
+    bool mHeuristicOnly;
+    // Number of pixel columns moved out of the grid by the solution of each pass of the latest conversion
+    int mPassObjectives[2];
+    std::unique_ptr<SecondPassSpeculator> mSpeculator;
+    // Only used by the speculator thread while it runs
+    std::unique_ptr<SpeculativePass> mSpeculativePass;
+    std::unique_ptr<ProvisionalPublisher> mProvisionalPublisher;
+    // Storage for the temporary images, layers and sprites of a conversion, released when it ends.
+    // Only used by the thread running the conversion, as the arena is not thread-safe.
+    std::pmr::monotonic_buffer_resource mArena;
     bool mConversionSuccessful;
     uint8_t mBackgroundColor;
     int mSpriteHeight;
@@ -186,14 +503,6 @@ private:
     const size_t PaletteGroupSize = 4;
     const size_t NumBackgroundPalettes = 4;
     const size_t NumSpritePalettes = 4;
-    const char* firstPassProgramInputFilename = "FirstPass.cmpl";
-    const char* firstPassProgramOutputFilename = "FirstPass_withTimeOut.cmpl";
-    const char* firstPassSolutionFilename = "firstpass_output.csv";
-    const char* firstPassDataFilename = "firstpass_input.cdat";
-    const char* secondPassProgramInputFilename = "SecondPass.cmpl";
-    const char* secondPassProgramOutputFilename = "SecondPass_withTimeOut.cmpl";
-    const char* secondPassSolutionFilename = "secondpass_output.csv";
-    const char* secondPassDataFilename = "secondpass_input.cdat";
 };
 
 #endif // OVERLAY_OPTIMISER_H
@@ -21,6 +21,7 @@
 #include <QUrl>
 #include <QDebug>
 #include <QStandardPaths>
+#include <QThread>
 
 #include <iostream>
 #include <iomanip>
@@ -78,6 +79,11 @@ OverlayPalGuiBackend::OverlayPalGuiBackend(QObject *parent):
     QObject(parent),
     mUniqueColors(false),
     mTimeOut(60),
+    mSolverBackend(QString::fromStdString(defaultSolverBackendName())),
+    mPortfolioSize(1),
+    mPipelined(false),
+    mCacheOnlyOptimal(false),
+    mShowProvisionalResults(true),
     mTrackInputImage(false),
     mShiftX(0),
     mShiftY(0),
@@ -85,7 +91,11 @@ OverlayPalGuiBackend::OverlayPalGuiBackend(QObject *parent):
     mPreventBlackerThanBlack(true),
     mMapInputColors(true),
     mConversionInProgress(false),
+    mConversionRestartPending(false),
+    mProvisionalResultPending(false),
     mProcessingInputImage(false),
+    mShiftSearchInProgress(false),
+    mShiftSearchCancelFlag(false),
     mHardwarePaletteName("palgen"),
     mOutputImage(ScreenWidth, ScreenHeight, QImage::Format_Indexed8),
     mBackgroundColor(0),
@@ -104,6 +114,9 @@ OverlayPalGuiBackend::OverlayPalGuiBackend(QObject *parent):
     mOutputImage.setColorTable(dummyColorTable);
     mOutputImage.fill(0);
     QObject::connect(&mInputFileWatcher, SIGNAL(fileChanged(QString)), this, SLOT(handleInputFileChanged(QString)));
+    QObject::connect(this, SIGNAL(provisionalResultReady()), this, SLOT(applyProvisionalResult()), Qt::QueuedConnection);
+    QObject::connect(this, SIGNAL(conversionResultReady()), this, SLOT(applyConversionResult()), Qt::QueuedConnection);
+    QObject::connect(this, SIGNAL(optimalShiftFound(int, int)), this, SLOT(applyOptimalShift(int, int)), Qt::QueuedConnection);
     std::string executablePath = QCoreApplication::applicationDirPath().toStdString();
     mOverlayOptimiser.setExecutablePath(executablePath);
 
@@ -118,6 +131,8 @@ OverlayPalGuiBackend::OverlayPalGuiBackend(QObject *parent):
     // TODO: Investigate root cause of this bug.
     mOverlayOptimiser.setWorkPath(executablePath + "/" + "Cmpl/bin");
 #endif
+    // Cache solutions under the app storage path on all platforms. The cache stays disabled without one.
+    mOverlayOptimiser.setCachePath(qApp->appStoragePath("solutioncache").toStdString());
     loadHardwarePalettes(QString(executablePath.c_str()) + QString("/nespalettes"));
     // Prevent QML engine from taking ownership of and destroying models
     QQmlEngine::setObjectOwnership(&mPaletteModel, QQmlEngine::CppOwnership);
@@ -129,6 +144,7 @@ OverlayPalGuiBackend::OverlayPalGuiBackend(QObject *parent):
 
 OverlayPalGuiBackend::~OverlayPalGuiBackend()
 {
+    mShiftSearchCancelFlag = true;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -359,6 +375,8 @@ void OverlayPalGuiBackend::setInputImageFilename(const QString& inputImageFilena
     }
     mInputImageFilename = inputImageFilename;
     mInputImage = QImage(mInputImageFilename);
+    // A shift found for the previous image is of no use
+    mShiftSearchCancelFlag = true;
     quantizeInputImage();
 }
 
@@ -616,6 +634,98 @@ void OverlayPalGuiBackend::setTimeOut(int timeOut)
 
 //---------------------------------------------------------------------------------------------------------------------
 
+const QString& OverlayPalGuiBackend::solverBackend() const
+{
+    return mSolverBackend;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayPalGuiBackend::setSolverBackend(const QString& solverBackend)
+{
+    assert(solverBackendNames().contains(solverBackend));
+    mSolverBackend = solverBackend;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+QStringList OverlayPalGuiBackend::solverBackendNames() const
+{
+    QStringList names;
+    for(const std::string& name : ::solverBackendNames())
+    {
+        names.append(QString::fromStdString(name));
+    }
+    return names;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int OverlayPalGuiBackend::portfolioSize() const
+{
+    return mPortfolioSize;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayPalGuiBackend::setPortfolioSize(int portfolioSize)
+{
+    assert(portfolioSize >= 1);
+    mPortfolioSize = portfolioSize;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int OverlayPalGuiBackend::maxPortfolioSize() const
+{
+    // One solver instance per core
+    return std::max(1, QThread::idealThreadCount());
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool OverlayPalGuiBackend::pipelined() const
+{
+    return mPipelined;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayPalGuiBackend::setPipelined(bool pipelined)
+{
+    mPipelined = pipelined;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool OverlayPalGuiBackend::cacheOnlyOptimal() const
+{
+    return mCacheOnlyOptimal;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayPalGuiBackend::setCacheOnlyOptimal(bool cacheOnlyOptimal)
+{
+    mCacheOnlyOptimal = cacheOnlyOptimal;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool OverlayPalGuiBackend::showProvisionalResults() const
+{
+    return mShowProvisionalResults;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayPalGuiBackend::setShowProvisionalResults(bool showProvisionalResults)
+{
+    mShowProvisionalResults = showProvisionalResults;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
 bool OverlayPalGuiBackend::conversionSuccessful() const
 {
     return mConversionError.size() == 0;
@@ -632,10 +742,55 @@ const QString &OverlayPalGuiBackend::conversionError() const
 
 void OverlayPalGuiBackend::findOptimalShift()
 {
-    Image2D image = qImageToImage2D(mInputImageIndexedBeforeShift);
-    int shiftX = 0;
-    int shiftY = 0;
-    Image2D shiftedImage = shiftImageOptimal(image, mBackgroundColor, mGridCellWidth, mGridCellHeight, 0, mGridCellWidth - 1, 0, mGridCellHeight - 1, shiftX, shiftY);
+    if(mShiftSearchInProgress)
+        return;
+    mShiftSearchInProgress = true;
+    mShiftSearchCancelFlag = false;
+    const Image2D image = qImageToImage2D(mInputImageIndexedBeforeShift);
+    const uint8_t backgroundColor = mBackgroundColor;
+    const int gridCellWidth = mGridCellWidth;
+    const int gridCellHeight = mGridCellHeight;
+    const int spriteHeight = mSpriteHeight;
+    const int maxBackgroundPalettes = mMaxBackgroundPalettes;
+    const int maxSpritePalettes = mMaxSpritePalettes;
+    const int maxSpritesPerScanline = mMaxSpritesPerScanline;
+    // The search takes about as long as a single conversion
+    const int timeOut = mTimeOut;
+    // Converting each shift takes a while, so search in a separate thread
+    QFuture<void> future = QtConcurrent::run([=]()
+    {
+        int shiftX = 0;
+        int shiftY = 0;
+        try
+        {
+            mOverlayOptimiser.findOptimalShift(image,
+                                               backgroundColor,
+                                               gridCellWidth,
+                                               gridCellHeight,
+                                               spriteHeight,
+                                               GridCellColorLimit,
+                                               maxBackgroundPalettes,
+                                               maxSpritePalettes,
+                                               maxSpritesPerScanline,
+                                               timeOut,
+                                               &mShiftSearchCancelFlag,
+                                               shiftX,
+                                               shiftY);
+        }
+        catch(const SolverBackend::Cancelled&)
+        {
+            mShiftSearchInProgress = false;
+            return;
+        }
+        emit optimalShiftFound(shiftX, shiftY);
+    });
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayPalGuiBackend::applyOptimalShift(int shiftX, int shiftY)
+{
+    mShiftSearchInProgress = false;
     if(shiftX != mShiftX || shiftY != mShiftY)
     {
         mShiftX = shiftX;
@@ -657,60 +812,216 @@ QImage OverlayPalGuiBackend::shiftQImage(const QImage& qImage) const
 
 //---------------------------------------------------------------------------------------------------------------------
 
+OverlayPalGuiBackend::ConversionRequest OverlayPalGuiBackend::conversionRequest() const
+{
+    ConversionRequest request;
+    request.image = qImageToImage2D(mInputImageIndexed);
+    request.backgroundColor = mBackgroundColor;
+    request.gridCellWidth = mGridCellWidth;
+    request.gridCellHeight = mGridCellHeight;
+    request.spriteHeight = mSpriteHeight;
+    request.maxBackgroundPalettes = mMaxBackgroundPalettes;
+    request.maxSpritePalettes = mMaxSpritePalettes;
+    request.maxSpritesPerScanline = mMaxSpritesPerScanline;
+    request.timeOut = mTimeOut;
+    request.solverBackend = mSolverBackend.toStdString();
+    request.portfolioSize = mPortfolioSize;
+    request.pipelined = mPipelined;
+    // Tracked files are usually re-converted after small edits, so start from the previous solution
+    request.incremental = mTrackInputImage;
+    request.cacheOnlyOptimal = mCacheOnlyOptimal;
+    request.showProvisionalResults = mShowProvisionalResults;
+    return request;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool OverlayPalGuiBackend::sameConversion(const ConversionRequest& a, const ConversionRequest& b)
+{
+    return a.backgroundColor == b.backgroundColor &&
+           a.gridCellWidth == b.gridCellWidth &&
+           a.gridCellHeight == b.gridCellHeight &&
+           a.spriteHeight == b.spriteHeight &&
+           a.maxBackgroundPalettes == b.maxBackgroundPalettes &&
+           a.maxSpritePalettes == b.maxSpritePalettes &&
+           a.maxSpritesPerScanline == b.maxSpritesPerScanline &&
+           a.timeOut == b.timeOut &&
+           a.solverBackend == b.solverBackend &&
+           a.portfolioSize == b.portfolioSize &&
+           a.pipelined == b.pipelined &&
+           a.incremental == b.incremental &&
+           a.cacheOnlyOptimal == b.cacheOnlyOptimal &&
+           a.showProvisionalResults == b.showProvisionalResults &&
+           imagesEqual(a.image, b.image);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
 void OverlayPalGuiBackend::startImageConversion()
 {
-    // Prevent re-attempted conversion if multiple signals are emitted
-    if(mConversionInProgress)
-        return;
-    mConversionInProgress = true;
-    mImagePendingConversion = qImageToImage2D(mInputImageIndexed);
+    ConversionRequest request = conversionRequest();
+    {
+        QMutexLocker lock(&mConversionMutex);
+        if(mConversionInProgress)
+        {
+            // Multiple signals may be emitted for the same change, which must not restart the conversion
+            if(sameConversion(request, mPendingConversion))
+                return;
+            // Stop solving for an outdated input or settings. The conversion thread then starts over with the new ones.
+            mPendingConversion = std::move(request);
+            mConversionRestartPending = true;
+            mOverlayOptimiser.cancel();
+            return;
+        }
+        mConversionInProgress = true;
+        mPendingConversion = std::move(request);
+    }
 
     // Start conversion in separate thread
     QFuture<void> future = QtConcurrent::run([=]()
     {
+        convertPendingImage();
+    });
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayPalGuiBackend::convertPendingImage()
+{
+    while(true)
+    {
+        // Settings are read from the snapshot only, as the GUI thread keeps changing the members
+        ConversionRequest request;
+        {
+            QMutexLocker lock(&mConversionMutex);
+            request = mPendingConversion;
+            mConversionRestartPending = false;
+            mOverlayOptimiser.resetCancel();
+        }
+        ConversionResult result;
         try {
-            std::string conversionError = mOverlayOptimiser.convert(mImagePendingConversion,
-                                                                    mBackgroundColor,
-                                                                    mGridCellWidth,
-                                                                    mGridCellHeight,
-                                                                    mSpriteHeight,
+            // Switch backend from the conversion thread, so that it is never replaced while solving
+            mOverlayOptimiser.setSolverBackend(request.solverBackend, request.portfolioSize);
+            mOverlayOptimiser.setIncremental(request.incremental);
+            mOverlayOptimiser.setCacheRequireOptimal(request.cacheOnlyOptimal);
+            // Solving the second pass alongside the first one needs a spare core
+            mOverlayOptimiser.setPipelined(request.pipelined && QThread::idealThreadCount() > 1);
+            if(request.showProvisionalResults)
+            {
+                mOverlayOptimiser.setProvisionalCallback([this](const OverlayOptimiser& provisional)
+                {
+                    handleProvisionalResult(provisional);
+                });
+            }
+            else
+            {
+                mOverlayOptimiser.setProvisionalCallback(nullptr);
+            }
+            std::string conversionError = mOverlayOptimiser.convert(request.image,
+                                                                    request.backgroundColor,
+                                                                    request.gridCellWidth,
+                                                                    request.gridCellHeight,
+                                                                    request.spriteHeight,
                                                                     GridCellColorLimit,
-                                                                    mMaxBackgroundPalettes,
-                                                                    mMaxSpritePalettes,
-                                                                    mMaxSpritesPerScanline,
-                                                                    mTimeOut);
+                                                                    request.maxBackgroundPalettes,
+                                                                    request.maxSpritePalettes,
+                                                                    request.maxSpritesPerScanline,
+                                                                    request.timeOut);
             // successful
-            QVector<QRgb> colorTable = makeColorTable();
-            Image2D remappedImage = mOverlayOptimiser.outputImage();
-            mOutputImage = image2DToQImage(remappedImage, colorTable);
-            //
-            const std::vector<std::set<uint8_t>>& palettes = mOverlayOptimiser.palettes();
-            mPaletteModel.setPalette(palettes, mBackgroundColor);
-            mConversionError = QString(conversionError.c_str());
-            emit outputImageChanged();
+            result.palettes = mOverlayOptimiser.palettes();
+            result.image = image2DToQImage(mOverlayOptimiser.outputImage(), makeColorTable(result.palettes));
+            result.error = QString(conversionError.c_str());
         }
         catch (const std::runtime_error& error)
         {
-            mConversionError = error.what();
-            // Make dummy image
-            QVector<QRgb> colorTable;
-            colorTable.append(0x00000000);
-            mOutputImage.fill(0);
-            mOutputImage.setColorTable(colorTable);
-            mOutputImageOverlay.fill(0);
-            mOutputImageOverlay.setColorTable(colorTable);
-            emit outputImageChanged();
+            result.error = error.what();
+            result.failed = true;
         }
-        mConversionInProgress = false;
-    });
+        {
+            QMutexLocker lock(&mConversionMutex);
+            // Results for an outdated input are dropped
+            if(mConversionRestartPending)
+                continue;
+            mConversionInProgress = false;
+            mConversionResult = result;
+        }
+        emit conversionResultReady();
+        return;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayPalGuiBackend::handleProvisionalResult(const OverlayOptimiser& provisional)
+{
+    ConversionResult result;
+    result.palettes = provisional.palettes();
+    result.image = image2DToQImage(provisional.outputImage(), makeColorTable(result.palettes));
+    bool resultPending = false;
+    {
+        QMutexLocker lock(&mConversionMutex);
+        mProvisionalResult = result;
+        resultPending = mProvisionalResultPending;
+        mProvisionalResultPending = true;
+    }
+    // Results arriving faster than the GUI thread applies them replace the pending one
+    if(!resultPending)
+    {
+        emit provisionalResultReady();
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayPalGuiBackend::applyProvisionalResult()
+{
+    ConversionResult result;
+    {
+        QMutexLocker lock(&mConversionMutex);
+        mProvisionalResultPending = false;
+        // Provisional results are outdated once the conversion finished or its input changed
+        if(!mConversionInProgress || mConversionRestartPending)
+            return;
+        result = mProvisionalResult;
+    }
+    mOutputImage = result.image;
+    mPaletteModel.setPalette(result.palettes, mBackgroundColor);
+    emit provisionalOutputImageChanged();
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-QVector<QRgb> OverlayPalGuiBackend::makeColorTable() const
+void OverlayPalGuiBackend::applyConversionResult()
+{
+    ConversionResult result;
+    {
+        QMutexLocker lock(&mConversionMutex);
+        result = mConversionResult;
+    }
+    mConversionError = result.error;
+    if(result.failed)
+    {
+        // Make dummy image
+        QVector<QRgb> colorTable;
+        colorTable.append(0x00000000);
+        mOutputImage.fill(0);
+        mOutputImage.setColorTable(colorTable);
+        mOutputImageOverlay.fill(0);
+        mOutputImageOverlay.setColorTable(colorTable);
+    }
+    else
+    {
+        mOutputImage = result.image;
+        mPaletteModel.setPalette(result.palettes, mBackgroundColor);
+    }
+    emit outputImageChanged();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+QVector<QRgb> OverlayPalGuiBackend::makeColorTable(const std::vector<std::set<uint8_t>>& palettes) const
 {
     const auto& rgbPalette = mHardwarePalettes[hardwarePaletteName()];
-    const std::vector<std::set<uint8_t>>& palettes = mOverlayOptimiser.palettes();
     QVector<QRgb> colorTable;
     for(size_t i = 0; i < palettes.size(); i++)
     {
@@ -985,7 +1296,7 @@ QVariantList OverlayPalGuiBackend::debugNumSourceColors(const GridLayer& layer)
         QVariantList numSourceColorsRowQML;
         for(size_t x = 0; x < layer.width(); x++)
         {
-            size_t numSourceColors = layer(x, y).colors.size();
+            size_t numSourceColors = colorCount(layer.cellColors(x, y));
             numSourceColorsRowQML.push_back(QString::number(numSourceColors));
         }
         numSourceColorsQML.push_back(numSourceColorsRowQML);
@@ -1036,7 +1347,7 @@ QVariantList OverlayPalGuiBackend::debugColors(const GridLayer& layer,
             std::vector<uint8_t> colors;
             uint8_t paletteIndex = paletteIndices(x, y);
             size_t i = 1;
-            for(uint8_t c : layer(x, y).colors)
+            for(uint8_t c : ColorMaskRange(layer.cellColors(x, y)))
             {
                 if(colors.size() < 4)
                 {
@@ -29,6 +29,7 @@
 #include <QVector>
 #include <QRgb>
 #include <QFileSystemWatcher>
+#include <QMutex>
 
 #include "Array2D.h"
 #include "OverlayOptimiser.h"
@@ -53,6 +54,11 @@ class OverlayPalGuiBackend : public QObject
     Q_PROPERTY(int maxSpritePalettes READ maxSpritePalettes WRITE setMaxSpritePalettes)
     Q_PROPERTY(int maxSpritesPerScanline READ maxSpritesPerScanline WRITE setMaxSpritesPerScanline)
     Q_PROPERTY(int timeOut READ timeOut WRITE setTimeOut)
+    Q_PROPERTY(QString solverBackend READ solverBackend WRITE setSolverBackend)
+    Q_PROPERTY(int portfolioSize READ portfolioSize WRITE setPortfolioSize)
+    Q_PROPERTY(bool pipelined READ pipelined WRITE setPipelined)
+    Q_PROPERTY(bool cacheOnlyOptimal READ cacheOnlyOptimal WRITE setCacheOnlyOptimal)
+    Q_PROPERTY(bool showProvisionalResults READ showProvisionalResults WRITE setShowProvisionalResults)
     Q_PROPERTY(QString hardwarePaletteName READ hardwarePaletteName WRITE setHardwarePaletteName)
     Q_PROPERTY(bool conversionSuccessful READ conversionSuccessful)
     Q_PROPERTY(QString conversionError READ conversionError)
@@ -102,6 +108,23 @@ public:
     int timeOut() const;
     void setTimeOut(int timeOut);
 
+    const QString& solverBackend() const;
+    void setSolverBackend(const QString& solverBackend);
+    Q_INVOKABLE QStringList solverBackendNames() const;
+
+    int portfolioSize() const;
+    void setPortfolioSize(int portfolioSize);
+    Q_INVOKABLE int maxPortfolioSize() const;
+
+    bool pipelined() const;
+    void setPipelined(bool pipelined);
+
+    bool cacheOnlyOptimal() const;
+    void setCacheOnlyOptimal(bool cacheOnlyOptimal);
+
+    bool showProvisionalResults() const;
+    void setShowProvisionalResults(bool showProvisionalResults);
+
     bool conversionSuccessful() const;
 
     const QString& conversionError() const;
@@ -157,9 +180,73 @@ signals:
 
     void inputImageChanged();
     void outputImageChanged();
+    // Output image and palettes were replaced by the best result so far of a running conversion
+    void provisionalOutputImageChanged();
+
+    // Emitted from the conversion thread for applying results in the GUI thread
+    void provisionalResultReady();
+    void conversionResultReady();
+
+    void optimalShiftFound(int shiftX, int shiftY);
+
+protected slots:
+    void applyProvisionalResult();
+    void applyConversionResult();
+    void applyOptimalShift(int shiftX, int shiftY);
 
 protected:
 
+    //
+    // Output of a conversion, made in the conversion thread and applied in the GUI thread
+    //
+    struct ConversionResult
+    {
+        QImage image;
+        std::vector<std::set<uint8_t>> palettes;
+        QString error;
+        bool failed = false;
+    };
+
+    //
+    // Snapshot of the input image and all settings of a conversion, taken in the GUI thread
+    //
+    struct ConversionRequest
+    {
+        Image2D image;
+        uint8_t backgroundColor = 0;
+        int gridCellWidth = 0;
+        int gridCellHeight = 0;
+        int spriteHeight = 0;
+        int maxBackgroundPalettes = 0;
+        int maxSpritePalettes = 0;
+        int maxSpritesPerScanline = 0;
+        int timeOut = 0;
+        std::string solverBackend;
+        int portfolioSize = 1;
+        bool pipelined = false;
+        bool incremental = false;
+        bool cacheOnlyOptimal = false;
+        bool showProvisionalResults = false;
+    };
+
+    ConversionRequest conversionRequest() const;
+
+    //
+    // Whether two requests have the same input and settings, so that a running conversion need not be restarted
+    //
+    static bool sameConversion(const ConversionRequest& a, const ConversionRequest& b);
+
+    //
+    // Convert the pending request in the conversion thread, starting over whenever the conversion
+    // is cancelled because the input or settings changed
+    //
+    void convertPendingImage();
+
+    //
+    // Queue a provisional conversion for display, called from the conversion or a solver thread
+    //
+    void handleProvisionalResult(const OverlayOptimiser& provisional);
+
     QVariantList debugPaletteIndices(const Array2D<uint8_t>& paletteIndices) const;
     QVariantList debugNumSourceColors(const GridLayer& layer) const;
     QVariantList debugColors(const GridLayer& layer,
@@ -169,7 +256,7 @@ protected:
     static Image2D qImageToImage2D(const QImage& qImage);
     static QImage image2DToQImage(const Image2D& image, const QVector<QRgb>& colorTable);
 
-    QVector<QRgb> makeColorTable() const;
+    QVector<QRgb> makeColorTable(const std::vector<std::set<uint8_t>>& palettes) const;
     QVector<QRgb> makeColorTableFromHardwarePalette() const;
 
     const QString& hardwarePaletteName() const;
@@ -190,6 +277,11 @@ protected:
 private:
     bool mUniqueColors;
     int mTimeOut;
+    QString mSolverBackend;
+    int mPortfolioSize;
+    bool mPipelined;
+    bool mCacheOnlyOptimal;
+    bool mShowProvisionalResults;
     bool mTrackInputImage;
     int mShiftX;
     int mShiftY;
@@ -203,8 +295,18 @@ private:
     bool mAutoBackgroundColor;
     bool mPreventBlackerThanBlack;
     bool mInputImagePaletteMapping;
+    // Guards mConversionInProgress, mConversionRestartPending, mPendingConversion and the results
+    // passed from the conversion thread
+    QMutex mConversionMutex;
     bool mConversionInProgress;
+    bool mConversionRestartPending;
+    bool mProvisionalResultPending;
+    ConversionResult mProvisionalResult;
+    ConversionResult mConversionResult;
     bool mProcessingInputImage;
+    // Set from the GUI thread, and cleared by the search thread when it is cancelled
+    std::atomic<bool> mShiftSearchInProgress;
+    std::atomic<bool> mShiftSearchCancelFlag;
     QString mConversionError;
     QString mHardwarePaletteName;
     QString mInputImageFilename;
@@ -213,7 +315,7 @@ private:
     QImage mInputImageIndexed;
     QImage mOutputImage;
     QImage mOutputImageOverlay;
-    Image2D mImagePendingConversion;
+    ConversionRequest mPendingConversion;
     QMap<QString, QVariantList> mHardwarePalettes;
     QStringList mHardwarePaletteNames;
     QStringListModel mHardwarePaletteNamesModel;
@@ -0,0 +1,87 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include "Palette.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+
+Palette::Palette():
+    mColors(0),
+    mSize(0),
+    mEntries{},
+    mSlots{}
+{
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+Palette::Palette(const Colors& colors):
+    Palette()
+{
+    assert(colors.size() <= MaxColors);
+    for(uint8_t c : colors)
+    {
+        mColors |= colorBit(c);
+        mEntries[mSize] = c;
+        mSize++;
+        mSlots[c] = mSize;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+size_t Palette::size() const
+{
+    return mSize;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+ColorMask Palette::colors() const
+{
+    return mColors;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+uint8_t Palette::color(size_t i) const
+{
+    assert(i < mSize);
+    return mEntries[i];
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool Palette::contains(uint8_t c) const
+{
+    return (mColors & colorBit(c)) != 0;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::vector<Palette> compactPalettes(const std::vector<Colors>& palettes)
+{
+    std::vector<Palette> compact;
+    compact.reserve(palettes.size());
+    for(const Colors& palette : palettes)
+    {
+        compact.emplace_back(palette);
+    }
+    return compact;
+}
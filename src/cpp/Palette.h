@@ -0,0 +1,75 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <cstdint>
+#include <cassert>
+#include <array>
+#include <vector>
+
+#include "ColorMask.h"
+
+//
+// Fixed-size palette of up to three colors, with a lookup table from color to slot in the palette group.
+//
+// Slot 0 of a palette group is the shared background color, so palette colors occupy slots 1..3
+// in increasing color order, matching the iteration order of the Colors set a palette is built from.
+//
+class Palette
+{
+public:
+    static constexpr size_t MaxColors = 3;
+
+    Palette();
+
+    explicit Palette(const Colors& colors);
+
+    size_t size() const;
+
+    ColorMask colors() const;
+
+    //
+    // Color in slot i + 1
+    //
+    uint8_t color(size_t i) const;
+
+    bool contains(uint8_t c) const;
+
+    //
+    // Slot of color c in the palette group, or 0 for colors not in the palette
+    //
+    uint8_t slot(uint8_t c) const
+    {
+        assert(c < mSlots.size());
+        return mSlots[c];
+    }
+
+private:
+    ColorMask mColors;
+    uint8_t mSize;
+    std::array<uint8_t, MaxColors> mEntries;
+    std::array<uint8_t, 64> mSlots;
+};
+
+std::vector<Palette> compactPalettes(const std::vector<Colors>& palettes);
+
+#endif // PALETTE_H
@@ -0,0 +1,386 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <array>
+#include <algorithm>
+#include <cassert>
+
+#include "PaletteCoverModel.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+
+//
+// Append all subsets of colors with between minSize and maxSize elements, in order of increasing size
+//
+static void appendSubsets(const std::vector<uint8_t>& colors, size_t minSize, size_t maxSize, std::vector<Colors>& subsets)
+{
+    maxSize = std::min(maxSize, colors.size());
+    for(size_t size = minSize; size <= maxSize; size++)
+    {
+        // Indices of the subset elements, advanced as an odometer
+        std::vector<size_t> indices(size);
+        for(size_t i = 0; i < size; i++)
+        {
+            indices[i] = i;
+        }
+        while(true)
+        {
+            Colors subset;
+            for(size_t i : indices)
+            {
+                subset.insert(colors[i]);
+            }
+            subsets.push_back(std::move(subset));
+            size_t i = size;
+            while(i > 0 && indices[i - 1] == colors.size() - size + i - 1)
+            {
+                i--;
+            }
+            if(i == 0)
+                break;
+            indices[i - 1]++;
+            for(size_t j = i; j < size; j++)
+            {
+                indices[j] = indices[j - 1] + 1;
+            }
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static size_t binomial(size_t n, size_t k)
+{
+    if(k > n)
+        return 0;
+    size_t result = 1;
+    for(size_t i = 1; i <= k; i++)
+    {
+        result = result * (n - k + i) / i;
+    }
+    return result;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+//
+// Sorted colors of all cell classes
+//
+static std::vector<uint8_t> problemColors(const std::vector<CellClass>& cellClasses)
+{
+    Colors colors;
+    for(const CellClass& cellClass : cellClasses)
+    {
+        colors.insert(cellClass.colors.begin(), cellClass.colors.end());
+    }
+    return std::vector<uint8_t>(colors.begin(), colors.end());
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+size_t PaletteCoverModel::estimatedColumns(const SolverProblem& problem)
+{
+    const size_t limit = size_t(problem.gridCellColorLimit);
+    const size_t numColors = problemColors(problem.cellClasses).size();
+    size_t columns = numColors + binomial(numColors, std::min(limit, numColors));
+    for(const CellClass& cellClass : problem.cellClasses)
+    {
+        for(size_t size = 0; size <= limit; size++)
+        {
+            columns += 2 * binomial(cellClass.colors.size(), size);
+        }
+    }
+    return columns;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+PaletteCoverModel::PaletteCoverModel(const SolverProblem& problem):
+    mPass(problem.pass),
+    mPaletteIndexOffset(problem.paletteIndexOffset),
+    mCellClasses(problem.cellClasses)
+{
+    const bool secondPass = mPass == SolverPass::Second;
+    const size_t limit = size_t(problem.gridCellColorLimit);
+    mColors = problemColors(mCellClasses);
+    std::array<int, 256> colorIndex;
+    colorIndex.fill(-1);
+    for(size_t i = 0; i < mColors.size(); i++)
+    {
+        colorIndex[mColors[i]] = int(i);
+    }
+    // Global variables
+    for(uint8_t c : mColors)
+    {
+        mColorsTotal.push_back(mModel.addBinary(variableName("colorsOverlayTotal", {c})));
+    }
+    // Palettes never need fewer colors than the limit, as unused entries can be filled with any color
+    const size_t paletteSize = std::min(limit, mColors.size());
+    if(paletteSize > 0)
+    {
+        appendSubsets(mColors, paletteSize, paletteSize, mCandidates);
+    }
+    for(size_t q = 0; q < mCandidates.size(); q++)
+    {
+        mCandidateColumns.push_back(mModel.addBinary(variableName("palettePicked", {int(q)})));
+    }
+    mModel.addRow("paletteLimit", mCandidateColumns, std::vector<double>(mCandidateColumns.size(), 1.0), 'L', problem.numPalettes);
+    // Per-cell variables and constraints
+    const int height = int(problem.layer.height());
+    std::vector<std::vector<int>> rowColumns(height);
+    std::vector<std::vector<double>> rowCoefficients(height);
+    for(int k = 0; k < int(mCellClasses.size()); k++)
+    {
+        const CellClass& cellClass = mCellClasses[k];
+        const std::vector<uint8_t> colors(cellClass.colors.begin(), cellClass.colors.end());
+        CellVariables v;
+        appendSubsets(colors, 0, limit, v.kept);
+        for(size_t o = 0; o < v.kept.size(); o++)
+        {
+            const Colors& kept = v.kept[o];
+            int movedColumns = 0;
+            for(uint8_t c : colors)
+            {
+                if(kept.count(c) == 0)
+                {
+                    movedColumns += cellClass.columnCount.at(c);
+                }
+            }
+            v.keep.push_back(mModel.addBinary(variableName("keep", {k, int(o)}), movedColumns));
+            if(kept.empty())
+                continue;
+            auto it = mKeptInPalette.find(kept);
+            if(it == mKeptInPalette.end())
+            {
+                const int column = mModel.addColumn(variableName("keptInPalette", {int(mKeptInPalette.size())}), 0.0, 1.0, 0.0, false);
+                it = mKeptInPalette.insert({kept, column}).first;
+            }
+            mModel.addRow(variableName("keepNeedsPalette", {k, int(o)}), {v.keep.back(), it->second}, {1.0, -1.0}, 'L', 0.0);
+        }
+        // Every cell keeps exactly one subset, and moves the remaining colors
+        mModel.addRow(variableName("keepOne", {k}), v.keep, std::vector<double>(v.keep.size(), 1.0), 'E', 1.0);
+        // Member cells count towards the row size limit of their own row. In the first pass, a cell uses
+        // one entry if it moves any color. In the second pass, it uses one for its grid-aligned sprite
+        // and one for each moved color.
+        std::vector<int> rowCount(height, 0);
+        for(const auto& cell : cellClass.cells)
+        {
+            rowCount[cell.second]++;
+        }
+        for(size_t o = 0; o < v.kept.size(); o++)
+        {
+            const size_t numMoved = colors.size() - v.kept[o].size();
+            const int usage = secondPass ? int(!v.kept[o].empty()) + int(numMoved) : int(numMoved > 0);
+            if(usage == 0)
+                continue;
+            for(int y = 0; y < height; y++)
+            {
+                if(rowCount[y] == 0)
+                    continue;
+                rowColumns[y].push_back(v.keep[o]);
+                rowCoefficients[y].push_back(usage * rowCount[y]);
+            }
+        }
+        // Moved colors contribute to the global overlay color set
+        for(uint8_t c : colors)
+        {
+            std::vector<int> columns = {mColorsTotal[colorIndex[c]]};
+            std::vector<double> coefficients = {1.0};
+            for(size_t o = 0; o < v.kept.size(); o++)
+            {
+                if(v.kept[o].count(c) == 0)
+                {
+                    columns.push_back(v.keep[o]);
+                    coefficients.push_back(-1.0);
+                }
+            }
+            mModel.addRow(variableName("colorsOverlayTotalFromMoved", {k, c}), columns, coefficients, 'G', 0.0);
+        }
+        mCells.push_back(std::move(v));
+    }
+    // Kept subsets must be contained in a picked palette
+    std::map<Colors, std::vector<int>> containingCandidates;
+    for(size_t q = 0; q < mCandidates.size(); q++)
+    {
+        std::vector<Colors> subsets;
+        appendSubsets(std::vector<uint8_t>(mCandidates[q].begin(), mCandidates[q].end()), 1, limit, subsets);
+        for(const Colors& subset : subsets)
+        {
+            if(mKeptInPalette.count(subset))
+            {
+                containingCandidates[subset].push_back(mCandidateColumns[q]);
+            }
+        }
+    }
+    for(const auto& keptInPalette : mKeptInPalette)
+    {
+        std::vector<int> columns = containingCandidates[keptInPalette.first];
+        std::vector<double> coefficients(columns.size(), -1.0);
+        columns.push_back(keptInPalette.second);
+        coefficients.push_back(1.0);
+        mModel.addRow(variableName("keptSubsetInPalette", {keptInPalette.second}), columns, coefficients, 'L', 0.0);
+    }
+    // Row size limit, minus the usage of cells left out of the model
+    for(int y = 0; y < height; y++)
+    {
+        const int reserved = y < int(problem.rowReserved.size()) ? problem.rowReserved[y] : 0;
+        // Only one subset per cell class is kept, but summing all coefficients is enough to skip rows that can never bind
+        double maxUsage = 0.0;
+        for(double coefficient : rowCoefficients[y])
+        {
+            maxUsage += coefficient;
+        }
+        if(maxUsage > problem.maxRowSize - reserved)
+        {
+            mModel.addRow(variableName("rowLimit", {y}), rowColumns[y], rowCoefficients[y], 'L', problem.maxRowSize - reserved);
+        }
+    }
+    // Each free color must be present in at least one palette
+    if(secondPass)
+    {
+        for(size_t i = 0; i < mColors.size(); i++)
+        {
+            std::vector<int> columns;
+            for(size_t q = 0; q < mCandidates.size(); q++)
+            {
+                if(mCandidates[q].count(mColors[i]))
+                {
+                    columns.push_back(mCandidateColumns[q]);
+                }
+            }
+            std::vector<double> coefficients(columns.size(), 1.0);
+            columns.push_back(mColorsTotal[i]);
+            coefficients.push_back(-1.0);
+            mModel.addRow(variableName("freeColorInAnyPalette", {mColors[i]}), columns, coefficients, 'G', 0.0);
+        }
+    }
+    // Overlay color limit
+    mModel.addRow("overlayColorLimit", mColorsTotal, std::vector<double>(mColorsTotal.size(), 1.0), 'L', problem.maxSpritePalettes * problem.gridCellColorLimit);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+const MipModel& PaletteCoverModel::model() const
+{
+    return mModel;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int PaletteCoverModel::pickedCandidate(const std::vector<double>& values, const Colors& colors) const
+{
+    int paletteIndex = 0;
+    for(size_t q = 0; q < mCandidates.size(); q++)
+    {
+        if(values[mCandidateColumns[q]] <= 0.5)
+            continue;
+        if(std::includes(mCandidates[q].begin(), mCandidates[q].end(), colors.begin(), colors.end()))
+            return paletteIndex;
+        paletteIndex++;
+    }
+    return -1;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void PaletteCoverModel::decode(const std::vector<double>& values, SolverSolution& solution) const
+{
+    assert(values.size() == mModel.columns().size());
+    solution.palettes = decodePalettes(values);
+    for(size_t k = 0; k < mCells.size(); k++)
+    {
+        const CellVariables& v = mCells[k];
+        const CellClass& cellClass = mCellClasses[k];
+        for(size_t o = 0; o < v.kept.size(); o++)
+        {
+            if(values[v.keep[o]] <= 0.5)
+                continue;
+            for(uint8_t c : cellClass.colors)
+            {
+                solution.setCellClassColor(cellClass, c, v.kept[o].count(c) == 0);
+            }
+            // A cell keeping no colors may use any palette
+            const int paletteIndex = std::max(pickedCandidate(values, v.kept[o]), 0);
+            solution.setCellClassPalette(cellClass, uint8_t(paletteIndex) + mPaletteIndexOffset);
+            break;
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::vector<Colors> PaletteCoverModel::decodePalettes(const std::vector<double>& values) const
+{
+    assert(values.size() == mModel.columns().size());
+    std::vector<Colors> palettes;
+    for(size_t q = 0; q < mCandidates.size(); q++)
+    {
+        if(values[mCandidateColumns[q]] > 0.5)
+        {
+            palettes.push_back(mCandidates[q]);
+        }
+    }
+    return palettes;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::vector<double> PaletteCoverModel::startValues(const CellAssignment& assignment) const
+{
+    std::vector<double> values(mModel.columns().size(), 0.0);
+    if(assignment.empty())
+    {
+        return values;
+    }
+    // Each palette becomes the first candidate containing it
+    for(const Colors& palette : assignment.palettes)
+    {
+        if(palette.empty())
+            continue;
+        for(size_t q = 0; q < mCandidates.size(); q++)
+        {
+            if(std::includes(mCandidates[q].begin(), mCandidates[q].end(), palette.begin(), palette.end()))
+            {
+                values[mCandidateColumns[q]] = 1.0;
+                break;
+            }
+        }
+    }
+    for(size_t k = 0; k < mCells.size(); k++)
+    {
+        const CellVariables& v = mCells[k];
+        const Colors& grid = assignment.grid[k];
+        auto it = std::find(v.kept.begin(), v.kept.end(), grid);
+        if(it == v.kept.end())
+            continue;
+        values[v.keep[it - v.kept.begin()]] = 1.0;
+        if(!grid.empty())
+        {
+            values[mKeptInPalette.at(grid)] = 1.0;
+        }
+        for(uint8_t c : mCellClasses[k].colors)
+        {
+            if(grid.count(c) == 0)
+            {
+                const size_t colorIndex = std::lower_bound(mColors.begin(), mColors.end(), c) - mColors.begin();
+                values[mColorsTotal[colorIndex]] = 1.0;
+            }
+        }
+    }
+    return values;
+}
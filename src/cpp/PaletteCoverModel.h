@@ -0,0 +1,87 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef PALETTE_COVER_MODEL_H
+#define PALETTE_COVER_MODEL_H
+
+#include <vector>
+#include <map>
+
+#include "MipModel.h"
+
+//
+// Set-cover formulation of the FirstPass / SecondPass problems.
+//
+// Instead of deciding the color of each palette entry, the model picks palettes from all sets of
+// gridCellColorLimit colors present in the problem, and each cell class picks the subset of its colors
+// to keep in the grid, which must be contained in one of the picked palettes. Kept subsets shared
+// between cell classes are linked to the palettes once.
+//
+// As palettes are unordered sets of candidates, there is no palette symmetry to break. The model
+// grows with the number of candidates, which makes it much smaller than PassModel for problems with
+// few colors, such as the second pass.
+//
+class PaletteCoverModel: public PassFormulation
+{
+public:
+    PaletteCoverModel(const SolverProblem& problem);
+
+    //
+    // Number of columns the model of a problem would have, counting each kept subset for every
+    // cell class that can keep it
+    //
+    static size_t estimatedColumns(const SolverProblem& problem);
+
+    const MipModel& model() const override;
+
+    void decode(const std::vector<double>& values, SolverSolution& solution) const override;
+
+    std::vector<Colors> decodePalettes(const std::vector<double>& values) const override;
+
+    std::vector<double> startValues(const CellAssignment& assignment) const override;
+
+private:
+    //
+    // Variable indices for a single cell class, with one column per subset of colors it can keep
+    //
+    struct CellVariables
+    {
+        std::vector<Colors> kept;
+        std::vector<int> keep;
+    };
+
+    //
+    // Index of the first picked candidate containing the given colors, or -1 if there is none
+    //
+    int pickedCandidate(const std::vector<double>& values, const Colors& colors) const;
+
+    SolverPass mPass;
+    uint8_t mPaletteIndexOffset;
+    MipModel mModel;
+    std::vector<uint8_t> mColors;
+    std::vector<int> mColorsTotal;
+    std::vector<Colors> mCandidates;
+    std::vector<int> mCandidateColumns;
+    // Column telling whether a picked palette contains a kept subset, for each non-empty kept subset
+    std::map<Colors, int> mKeptInPalette;
+    std::vector<CellClass> mCellClasses;
+    std::vector<CellVariables> mCells;
+};
+
+#endif // PALETTE_COVER_MODEL_H
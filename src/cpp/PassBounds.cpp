@@ -0,0 +1,266 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <numeric>
+#include <map>
+#include <sstream>
+
+#include "PassBounds.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+
+//
+// Number of colors a cell can keep in the grid. Without any palettes in the first pass, all colors must move.
+//
+static size_t keptColorLimit(const SolverProblem& problem)
+{
+    if(problem.pass == SolverPass::First && problem.numPalettes == 0)
+        return 0;
+    return size_t(problem.gridCellColorLimit);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+//
+// Cell of a grid layer, for bounds computed directly from the layer
+//
+struct LayerCell
+{
+    const GridLayer* layer;
+    size_t x;
+    size_t y;
+};
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static void addColorWeights(const CellClass* cellClass, std::vector<int>& weights, std::map<uint8_t, int>& colorWeights)
+{
+    for(uint8_t c : cellClass->colors)
+    {
+        const int weight = cellClass->columnCount.at(c);
+        weights.push_back(weight);
+        colorWeights[c] += weight;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static void addColorWeights(const LayerCell& cell, std::vector<int>& weights, std::map<uint8_t, int>& colorWeights)
+{
+    for(uint8_t c : ColorMaskRange(cell.layer->cellColors(cell.x, cell.y)))
+    {
+        const int weight = cell.layer->columnCount(cell.x, cell.y, c);
+        weights.push_back(weight);
+        colorWeights[c] += weight;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+//
+// Lower bound on moved columns over a set of layer cells or cell classes
+//
+template<typename T>
+static int movedColumnsBound(const SolverProblem& problem, const std::vector<T>& cells)
+{
+    const size_t keep = keptColorLimit(problem);
+    int cellBound = 0;
+    std::map<uint8_t, int> colorWeights;
+    std::vector<int> weights;
+    for(const T& cell : cells)
+    {
+        weights.clear();
+        addColorWeights(cell, weights, colorWeights);
+        if(weights.size() <= keep)
+            continue;
+        std::sort(weights.begin(), weights.end());
+        cellBound += std::accumulate(weights.begin(), weights.begin() + (weights.size() - keep), 0);
+    }
+    // Second pass palettes must hold moved colors too, so leaving colors out of them is never an option
+    const size_t paletteColors = size_t(problem.numPalettes * problem.gridCellColorLimit);
+    if(problem.pass != SolverPass::First || colorWeights.size() <= paletteColors)
+        return cellBound;
+    weights.clear();
+    for(const auto& colorWeight : colorWeights)
+    {
+        weights.push_back(colorWeight.second);
+    }
+    std::sort(weights.begin(), weights.end());
+    const int paletteBound = std::accumulate(weights.begin(), weights.begin() + (weights.size() - paletteColors), 0);
+    return std::max(cellBound, paletteBound);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int movedColumnsLowerBound(const SolverProblem& problem)
+{
+    std::vector<const CellClass*> cellClasses;
+    for(const CellClass& cellClass : problem.cellClasses)
+    {
+        cellClasses.push_back(&cellClass);
+    }
+    return movedColumnsBound(problem, cellClasses);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+PassBounds::PassBounds(const SolverProblem& problem):
+    mPass(problem.pass),
+    mCellWidth(int(problem.layer.cellWidth())),
+    mCellHeight(int(problem.layer.cellHeight())),
+    mMaxRowSize(problem.maxRowSize),
+    mMaxOverlayColors(0),
+    mMovedColumns(0),
+    mOverlayColors(0)
+{
+    const GridLayer& layer = problem.layer;
+    const int limit = problem.gridCellColorLimit;
+    const int keep = int(keptColorLimit(problem));
+    mMaxOverlayColors = (mPass == SolverPass::First ? problem.maxSpritePalettes : problem.numPalettes) * limit;
+    mRowUsage.assign(layer.height(), 0);
+    std::vector<LayerCell> cells;
+    ColorMask colors = 0;
+    for(int y = 0; y < int(layer.height()); y++)
+    {
+        for(int x = 0; x < int(layer.width()); x++)
+        {
+            const ColorMask cellColors = layer.cellColors(x, y);
+            const int numColors = colorCount(cellColors);
+            if(numColors == 0)
+                continue;
+            cells.push_back(LayerCell{&layer, size_t(x), size_t(y)});
+            colors |= cellColors;
+            int cellOverlayColors;
+            if(mPass == SolverPass::First)
+            {
+                // Any moved color makes the cell count towards the row limit
+                cellOverlayColors = std::max(numColors - keep, 0);
+                mRowUsage[y] += cellOverlayColors > 0 ? 1 : 0;
+            }
+            else
+            {
+                // A grid-aligned sprite with as many colors as possible, plus a free sprite for each color left
+                cellOverlayColors = numColors;
+                mRowUsage[y] += 1 + std::max(numColors - limit, 0);
+            }
+            mOverlayColors = std::max(mOverlayColors, cellOverlayColors);
+            if(cellOverlayColors > mMaxOverlayColors)
+            {
+                mInfeasibleCells.push_back({x, y});
+            }
+        }
+    }
+    // First pass colors that do not fit in the background palettes must all go to sprite palettes
+    const int numColors = colorCount(colors);
+    if(mPass == SolverPass::First)
+        mOverlayColors = std::max(mOverlayColors, numColors - problem.numPalettes * limit);
+    else
+        mOverlayColors = std::max(mOverlayColors, numColors);
+    for(int y = 0; y < int(mRowUsage.size()); y++)
+    {
+        if(mRowUsage[y] > mMaxRowSize)
+        {
+            mInfeasibleRows.push_back(y);
+        }
+    }
+    mMovedColumns = movedColumnsBound(problem, cells);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int PassBounds::movedColumns() const
+{
+    return mMovedColumns;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int PassBounds::overlayColors() const
+{
+    return mOverlayColors;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+const std::vector<int>& PassBounds::rowUsage() const
+{
+    return mRowUsage;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool PassBounds::feasible() const
+{
+    return mInfeasibleCells.empty() && mInfeasibleRows.empty() && mOverlayColors <= mMaxOverlayColors;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+const std::vector<std::pair<int, int>>& PassBounds::infeasibleCells() const
+{
+    return mInfeasibleCells;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+const std::vector<int>& PassBounds::infeasibleRows() const
+{
+    return mInfeasibleRows;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::string PassBounds::infeasibilityDescription() const
+{
+    // Only the first few offenders are listed, to keep the message readable
+    const size_t MaxListed = 3;
+    std::stringstream ss;
+    const char* separator = "";
+    const std::string spriteColors = std::to_string(mMaxOverlayColors) + " sprite colors";
+    for(size_t i = 0; i < mInfeasibleCells.size() && i < MaxListed; i++)
+    {
+        const auto& cell = mInfeasibleCells[i];
+        ss << separator << "cell at (" << cell.first * mCellWidth << ", " << cell.second * mCellHeight << ") needs more than " << spriteColors;
+        separator = ", ";
+    }
+    if(mInfeasibleCells.size() > MaxListed)
+    {
+        ss << separator << (mInfeasibleCells.size() - MaxListed) << " more cells";
+    }
+    if(mInfeasibleCells.empty() && mOverlayColors > mMaxOverlayColors)
+    {
+        ss << separator << "image needs " << mOverlayColors << " sprite colors, limit is " << mMaxOverlayColors;
+        separator = ", ";
+    }
+    const char* rowUnit = mPass == SolverPass::First ? " cells with sprites" : " sprites";
+    for(size_t i = 0; i < mInfeasibleRows.size() && i < MaxListed; i++)
+    {
+        const int y = mInfeasibleRows[i];
+        ss << separator << "row at y = " << y * mCellHeight << " needs " << mRowUsage[y] << rowUnit << ", limit is " << mMaxRowSize;
+        separator = ", ";
+    }
+    if(mInfeasibleRows.size() > MaxListed)
+    {
+        ss << separator << (mInfeasibleRows.size() - MaxListed) << " more rows";
+    }
+    const std::string description = ss.str();
+    if(description.empty())
+        return "";
+    return "No solution possible: " + description + ".";
+}
@@ -0,0 +1,95 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef PASS_BOUNDS_H
+#define PASS_BOUNDS_H
+
+#include <vector>
+#include <string>
+#include <utility>
+
+#include "SolverBackend.h"
+
+//
+// Lower bound on the objective of a problem restricted to its cell classes: each cell class must move
+// its lightest colors above the cell color limit, and in the first pass the colors left out of all
+// palettes must be moved everywhere they occur.
+//
+int movedColumnsLowerBound(const SolverProblem& problem);
+
+//
+// Bounds on a FirstPass / SecondPass problem that follow from counting colors in the grid alone.
+//
+// They take microseconds to compute, so problems that cannot have any solution are rejected
+// without running the solver, and a solver can stop as soon as its incumbent reaches the bound.
+//
+class PassBounds
+{
+public:
+    PassBounds(const SolverProblem& problem);
+
+    //
+    // Lower bound on the summed column count of moved colors, over all cells of the layer
+    //
+    int movedColumns() const;
+
+    //
+    // Lower bound on the number of distinct colors that sprite palettes must hold
+    //
+    int overlayColors() const;
+
+    //
+    // Lower bound on the usage of the row size limit by each row of the layer
+    //
+    const std::vector<int>& rowUsage() const;
+
+    //
+    // False if no solution can exist
+    //
+    bool feasible() const;
+
+    //
+    // Grid positions (x, y) of cells needing more sprite colors than the limit on their own
+    //
+    const std::vector<std::pair<int, int>>& infeasibleCells() const;
+
+    //
+    // Rows whose usage bound exceeds the row size limit
+    //
+    const std::vector<int>& infeasibleRows() const;
+
+    //
+    // Why no solution can exist, in terms of image pixel positions. Empty if the problem may be feasible.
+    //
+    std::string infeasibilityDescription() const;
+
+private:
+    SolverPass mPass;
+    int mCellWidth;
+    int mCellHeight;
+    int mMaxRowSize;
+    int mMaxOverlayColors;
+    int mMovedColumns;
+    int mOverlayColors;
+    std::vector<int> mRowUsage;
+    std::vector<std::pair<int, int>> mInfeasibleCells;
+    std::vector<int> mInfeasibleRows;
+};
+
+#endif // PASS_BOUNDS_H
@@ -0,0 +1,179 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+
+#include "PortfolioSolverBackend.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+
+PortfolioSolverBackend::PortfolioSolverBackend(const std::string& backendName, int size):
+    mBackendName(backendName)
+{
+    for(int i = 0; i < size; i++)
+    {
+        mMembers.push_back(createConcurrentSolverBackend(backendName));
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::string PortfolioSolverBackend::name() const
+{
+    return mBackendName;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+PortfolioSolverBackend::SolverOptions PortfolioSolverBackend::memberOptions(int index)
+{
+    // Search strategies to alternate between. First entry is CBC's default configuration.
+    static const std::vector<SolverOptions> Strategies = {
+        {},
+        {{"strategy", "2"}},
+        {{"nodeStrategy", "depth"}},
+        {{"cuts", "root"}},
+        {{"strategy", "0"}},
+        {{"nodeStrategy", "fewest"}},
+        {{"preprocess", "off"}},
+        {{"cuts", "off"}, {"heuristicsOnOff", "on"}}
+    };
+    SolverOptions options = Strategies[index % Strategies.size()];
+    // Repeated strategies are diversified by the random seed
+    if(index >= int(Strategies.size()))
+    {
+        options.push_back({"randomCbcSeed", std::to_string(index)});
+    }
+    return options;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void PortfolioSolverBackend::solve(const SolverProblem& problem, SolverSolution& solution)
+{
+    struct MemberResult
+    {
+        SolverSolution solution;
+        int objective = 0;
+        bool valid = false;
+        std::string error;
+    };
+    const int size = int(mMembers.size());
+    std::vector<MemberResult> results(size);
+    std::vector<int> finishOrder;
+    std::mutex finishOrderMutex;
+    std::vector<std::thread> threads;
+    // Members are stopped when the portfolio is cancelled, or as soon as one of them has proven optimality
+    std::atomic<bool> stopMembers(false);
+    std::atomic<int> numFinished(0);
+    // Incumbents of all members are passed on one at a time
+    std::mutex incumbentMutex;
+    IncumbentCallback memberIncumbentCallback;
+    if(mIncumbentCallback)
+    {
+        memberIncumbentCallback = [&](const std::vector<Colors>& palettes)
+        {
+            std::lock_guard<std::mutex> lock(incumbentMutex);
+            reportIncumbent(palettes);
+        };
+    }
+    for(int i = 0; i < size; i++)
+    {
+        // Give each member its own work directory, as file-based backends use fixed filenames
+        const std::string memberWorkPath = workPathFilename("portfolio" + std::to_string(i));
+        std::error_code errorCode;
+        std::filesystem::create_directories(memberWorkPath, errorCode);
+        mMembers[i]->setExecutablePath(mExecutablePath);
+        mMembers[i]->setWorkPath(memberWorkPath);
+        mMembers[i]->setCancelFlag(&stopMembers);
+        mMembers[i]->setIncumbentCallback(memberIncumbentCallback);
+        threads.emplace_back([&, i]()
+        {
+            SolverProblem memberProblem = problem;
+            for(const auto& option : memberOptions(i))
+            {
+                memberProblem.solverOptions.push_back(option);
+            }
+            MemberResult& result = results[i];
+            try
+            {
+                mMembers[i]->solve(memberProblem, result.solution);
+                result.objective = solutionObjective(problem, result.solution);
+                result.valid = true;
+                if(result.solution.optimal)
+                {
+                    stopMembers = true;
+                }
+            }
+            catch(const std::exception& e)
+            {
+                result.error = e.what();
+            }
+            std::lock_guard<std::mutex> lock(finishOrderMutex);
+            finishOrder.push_back(i);
+            numFinished++;
+        });
+    }
+    // Pass on cancelling of the portfolio to the members
+    const std::chrono::milliseconds PollInterval(10);
+    while(numFinished < size)
+    {
+        if(cancelled())
+        {
+            stopMembers = true;
+        }
+        std::this_thread::sleep_for(PollInterval);
+    }
+    for(int i = 0; i < size; i++)
+    {
+        threads[i].join();
+        mMembers[i]->setCancelFlag(nullptr);
+        mMembers[i]->setIncumbentCallback(nullptr);
+    }
+    if(cancelled())
+    {
+        throw Cancelled();
+    }
+    // Prefer the first proven optimum, then the best incumbent
+    int best = -1;
+    for(int i : finishOrder)
+    {
+        const MemberResult& result = results[i];
+        if(!result.valid)
+            continue;
+        if(result.solution.optimal)
+        {
+            best = i;
+            break;
+        }
+        if(best < 0 || result.objective < results[best].objective)
+        {
+            best = i;
+        }
+    }
+    if(best < 0)
+    {
+        throw Error(results[finishOrder.front()].error);
+    }
+    solution = results[best].solution;
+}
@@ -0,0 +1,57 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef PORTFOLIO_SOLVER_BACKEND_H
+#define PORTFOLIO_SOLVER_BACKEND_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "SolverBackend.h"
+
+//
+// Solver backend running several differently configured instances of another backend in parallel.
+//
+// The first proven optimal solution is kept, or otherwise the solution with the best objective value.
+// Remaining members are stopped as soon as one member has proven optimality.
+//
+class PortfolioSolverBackend : public SolverBackend
+{
+public:
+    using SolverOptions = std::vector<std::pair<std::string, std::string>>;
+
+    PortfolioSolverBackend(const std::string& backendName, int size);
+
+    std::string name() const override;
+
+    void solve(const SolverProblem& problem, SolverSolution& solution) override;
+
+    //
+    // CBC parameters used by portfolio member with given index
+    //
+    static SolverOptions memberOptions(int index);
+
+private:
+    std::string mBackendName;
+    std::vector<std::unique_ptr<SolverBackend>> mMembers;
+};
+
+#endif // PORTFOLIO_SOLVER_BACKEND_H
@@ -0,0 +1,184 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <numeric>
+#include <map>
+
+#include "Presolve.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+
+Presolve::Presolve(const SolverProblem& problem, bool enabled):
+    mPass(problem.pass),
+    mPaletteIndexOffset(problem.paletteIndexOffset),
+    mHeight(int(problem.layer.height()))
+{
+    const GridLayer& layer = problem.layer;
+    // Collapsing identical cells is only exact in the first pass. In the second pass, moving colors to
+    // free sprites uses up the row limit, so identical cells in different rows may need different decisions.
+    const bool collapse = enabled && mPass == SolverPass::First;
+    std::map<std::vector<std::pair<uint8_t, int>>, size_t> classIndices;
+    for(int y = 0; y < int(layer.height()); y++)
+    {
+        for(int x = 0; x < int(layer.width()); x++)
+        {
+            const ColorMask cellColors = layer.cellColors(x, y);
+            if(cellColors == 0)
+                continue;
+            if(collapse)
+            {
+                std::vector<std::pair<uint8_t, int>> key;
+                for(uint8_t c : ColorMaskRange(cellColors))
+                {
+                    key.push_back({c, layer.columnCount(x, y, c)});
+                }
+                auto it = classIndices.find(key);
+                if(it != classIndices.end())
+                {
+                    CellClass& cellClass = mCellClasses[it->second];
+                    for(const auto& colorColumns : key)
+                    {
+                        cellClass.columnCount[colorColumns.first] += colorColumns.second;
+                    }
+                    cellClass.cells.push_back({x, y});
+                    continue;
+                }
+                classIndices[key] = mCellClasses.size();
+            }
+            CellClass cellClass;
+            cellClass.colors = maskColors(cellColors);
+            for(uint8_t c : ColorMaskRange(cellColors))
+            {
+                cellClass.columnCount[c] = layer.columnCount(x, y, c);
+            }
+            cellClass.cells.push_back({x, y});
+            mCellClasses.push_back(std::move(cellClass));
+        }
+    }
+    if(!enabled)
+        return;
+    // Visit larger cells first, so that every dominating cell has been kept before its subsets are visited.
+    // Only cells that fit a palette can dominate, as other cells can never keep all of their colors.
+    const size_t limit = size_t(problem.gridCellColorLimit);
+    std::vector<size_t> order(mCellClasses.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+    {
+        return mCellClasses[a].colors.size() > mCellClasses[b].colors.size();
+    });
+    std::vector<bool> dominated(mCellClasses.size(), false);
+    std::vector<size_t> dominating;
+    for(size_t i : order)
+    {
+        const Colors& colors = mCellClasses[i].colors;
+        if(colors.size() > limit)
+            continue;
+        dominated[i] = std::any_of(dominating.begin(), dominating.end(), [&](size_t j)
+        {
+            const Colors& superset = mCellClasses[j].colors;
+            return std::includes(superset.begin(), superset.end(), colors.begin(), colors.end());
+        });
+        if(!dominated[i])
+        {
+            dominating.push_back(i);
+        }
+    }
+    // Split into modelled and dominated cells, keeping the grid order for symmetry breaking
+    std::vector<CellClass> cellClasses;
+    for(size_t i = 0; i < mCellClasses.size(); i++)
+    {
+        if(dominated[i])
+        {
+            mDominated.push_back(std::move(mCellClasses[i]));
+        }
+        else
+        {
+            cellClasses.push_back(std::move(mCellClasses[i]));
+        }
+    }
+    mCellClasses = std::move(cellClasses);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void Presolve::apply(SolverProblem& problem) const
+{
+    problem.cellClasses = mCellClasses;
+    // In the second pass, a dominated cell keeps all its colors in grid-aligned sprites, using up one
+    // entry of its row. The first pass row limit only counts cells with moved colors.
+    problem.rowReserved.assign(mHeight, 0);
+    if(mPass == SolverPass::Second)
+    {
+        for(const CellClass& cellClass : mDominated)
+        {
+            for(const auto& cell : cellClass.cells)
+            {
+                problem.rowReserved[cell.second]++;
+            }
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool Presolve::expand(SolverSolution& solution)
+{
+    std::vector<CellClass> covered;
+    std::vector<CellClass> uncovered;
+    for(CellClass& cellClass : mDominated)
+    {
+        const Colors& colors = cellClass.colors;
+        auto it = std::find_if(solution.palettes.begin(), solution.palettes.end(), [&](const Colors& palette)
+        {
+            return std::includes(palette.begin(), palette.end(), colors.begin(), colors.end());
+        });
+        if(it == solution.palettes.end())
+        {
+            uncovered.push_back(std::move(cellClass));
+            continue;
+        }
+        for(uint8_t c : colors)
+        {
+            solution.setCellClassColor(cellClass, c, false);
+        }
+        solution.setCellClassPalette(cellClass, uint8_t(it - solution.palettes.begin()) + mPaletteIndexOffset);
+        covered.push_back(std::move(cellClass));
+    }
+    mDominated = std::move(covered);
+    if(uncovered.empty())
+    {
+        return true;
+    }
+    for(CellClass& cellClass : uncovered)
+    {
+        mCellClasses.push_back(std::move(cellClass));
+    }
+    return false;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void Presolve::restoreAll()
+{
+    for(CellClass& cellClass : mDominated)
+    {
+        mCellClasses.push_back(std::move(cellClass));
+    }
+    mDominated.clear();
+}
@@ -0,0 +1,74 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef PRESOLVE_H
+#define PRESOLVE_H
+
+#include <vector>
+
+#include "SolverBackend.h"
+
+//
+// Reduces the grid of a SolverProblem to the cell classes actually given to the solver backend.
+//
+// Empty cells are always left out, as they do not affect the solution.
+//
+// When enabled, two further reductions are made:
+//
+// 1) In the first pass, cells with identical colors and column counts are collapsed into a single
+//    weighted cell class. This is exact, as any optimal solution can be changed to give all such
+//    cells the same decision without increasing the objective or the row usage.
+//
+// 2) Cells whose colors are a subset of the colors of another modelled cell that fits a palette are
+//    dominated, and left out of the model together with their palette coverage constraints.
+//    The model without them is a relaxation, so the solution stays optimal as long as expand()
+//    finds a palette covering each dominated cell. Dominated cells that are not covered are put
+//    back into the model, and the pass needs to be solved again.
+//
+class Presolve
+{
+public:
+    Presolve(const SolverProblem& problem, bool enabled);
+
+    //
+    // Set the cell classes and reserved row usage of a problem to the current reduction
+    //
+    void apply(SolverProblem& problem) const;
+
+    //
+    // Complete a solution of the reduced problem with the dominated cells.
+    // Returns false if some dominated cells are not covered by any palette. These are then
+    // restored into the model, and the solution must not be used.
+    //
+    bool expand(SolverSolution& solution);
+
+    //
+    // Put all dominated cells back into the model
+    //
+    void restoreAll();
+
+private:
+    SolverPass mPass;
+    uint8_t mPaletteIndexOffset;
+    int mHeight;
+    std::vector<CellClass> mCellClasses;
+    std::vector<CellClass> mDominated;
+};
+
+#endif // PRESOLVE_H
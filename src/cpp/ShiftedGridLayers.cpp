@@ -0,0 +1,230 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include <cassert>
+#include <algorithm>
+
+#include "ShiftedGridLayers.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+
+ShiftedGridLayers::ShiftedGridLayers(uint8_t backgroundColor, size_t cellWidth, size_t cellHeight, const Image2D& image,
+                                     int minShiftX, int maxShiftX, int minShiftY, int maxShiftY):
+    mImage(image),
+    mBackgroundColor(backgroundColor),
+    mCellWidth(cellWidth),
+    mCellHeight(cellHeight),
+    mWidth((image.width() + cellWidth - 1) / cellWidth),
+    mHeight((image.height() + cellHeight - 1) / cellHeight),
+    mMinShiftX(minShiftX),
+    mMaxShiftX(maxShiftX),
+    mMaxShiftY(maxShiftY),
+    mShiftX(minShiftX),
+    mShiftY(minShiftY),
+    mColorsPerCellSum(0)
+{
+    assert(cellWidth <= 255 && cellHeight <= 255 && "Counts must fit in 8 bits");
+    assert(minShiftX <= maxShiftX && minShiftY <= maxShiftY);
+    initializeRows();
+    initializeColumns();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int ShiftedGridLayers::shiftX() const
+{
+    return mShiftX;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int ShiftedGridLayers::shiftY() const
+{
+    return mShiftY;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+size_t ShiftedGridLayers::colorsPerCellSum() const
+{
+    return mColorsPerCellSum;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+size_t ShiftedGridLayers::wrapX(int x) const
+{
+    const int w = int(mImage.width());
+    return size_t(((x % w) + w) % w);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+size_t ShiftedGridLayers::wrapY(int y) const
+{
+    const int h = int(mImage.height());
+    return size_t(((y % h) + h) % h);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void ShiftedGridLayers::addRow(size_t cellY, size_t imageY)
+{
+    const size_t imageWidth = mImage.width();
+    const uint8_t* pixels = mImage.row(imageY);
+    for(size_t x = 0; x < imageWidth; x++)
+    {
+        const uint8_t c = pixels[x];
+        if(c == mBackgroundColor)
+            continue;
+        if(mRowCounts[(cellY * imageWidth + x) * 64 + c]++ == 0)
+        {
+            mColumnColors[cellY * imageWidth + x] |= colorBit(c);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void ShiftedGridLayers::removeRow(size_t cellY, size_t imageY)
+{
+    const size_t imageWidth = mImage.width();
+    const uint8_t* pixels = mImage.row(imageY);
+    for(size_t x = 0; x < imageWidth; x++)
+    {
+        const uint8_t c = pixels[x];
+        if(c == mBackgroundColor)
+            continue;
+        if(--mRowCounts[(cellY * imageWidth + x) * 64 + c] == 0)
+        {
+            mColumnColors[cellY * imageWidth + x] &= ~colorBit(c);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void ShiftedGridLayers::addColumn(size_t cellX, size_t cellY, size_t imageX)
+{
+    const size_t cellIndex = cellY * mWidth + cellX;
+    uint8_t* counts = &mColumnCounts[cellIndex * 64];
+    for(uint8_t c : ColorMaskRange(mColumnColors[cellY * mImage.width() + imageX]))
+    {
+        if(counts[c]++ == 0)
+        {
+            mCellColors[cellIndex] |= colorBit(c);
+            mColorsPerCellSum++;
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void ShiftedGridLayers::removeColumn(size_t cellX, size_t cellY, size_t imageX)
+{
+    const size_t cellIndex = cellY * mWidth + cellX;
+    uint8_t* counts = &mColumnCounts[cellIndex * 64];
+    for(uint8_t c : ColorMaskRange(mColumnColors[cellY * mImage.width() + imageX]))
+    {
+        if(--counts[c] == 0)
+        {
+            mCellColors[cellIndex] &= ~colorBit(c);
+            mColorsPerCellSum--;
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void ShiftedGridLayers::initializeRows()
+{
+    mRowCounts.assign(mHeight * mImage.width() * 64, 0);
+    mColumnColors.assign(mHeight * mImage.width(), 0);
+    for(size_t Y = 0; Y < mHeight; Y++)
+    {
+        const size_t rows = std::min(mCellHeight, mImage.height() - Y * mCellHeight);
+        for(size_t r = 0; r < rows; r++)
+        {
+            addRow(Y, wrapY(int(Y * mCellHeight + r) - mShiftY));
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void ShiftedGridLayers::initializeColumns()
+{
+    mColumnCounts.assign(mHeight * mWidth * 64, 0);
+    mCellColors.assign(mHeight * mWidth, 0);
+    mColorsPerCellSum = 0;
+    for(size_t Y = 0; Y < mHeight; Y++)
+    {
+        for(size_t X = 0; X < mWidth; X++)
+        {
+            const size_t columns = std::min(mCellWidth, mImage.width() - X * mCellWidth);
+            for(size_t k = 0; k < columns; k++)
+            {
+                addColumn(X, Y, wrapX(int(X * mCellWidth + k) - mShiftX));
+            }
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool ShiftedGridLayers::next()
+{
+    if(mShiftX < mMaxShiftX)
+    {
+        // Each cell gains the column to its left and loses its rightmost column
+        for(size_t Y = 0; Y < mHeight; Y++)
+        {
+            for(size_t X = 0; X < mWidth; X++)
+            {
+                const size_t columns = std::min(mCellWidth, mImage.width() - X * mCellWidth);
+                addColumn(X, Y, wrapX(int(X * mCellWidth) - mShiftX - 1));
+                removeColumn(X, Y, wrapX(int(X * mCellWidth + columns - 1) - mShiftX));
+            }
+        }
+        mShiftX++;
+        return true;
+    }
+    if(mShiftY < mMaxShiftY)
+    {
+        // Each cell row gains the image row above it and loses its bottom row
+        for(size_t Y = 0; Y < mHeight; Y++)
+        {
+            const size_t rows = std::min(mCellHeight, mImage.height() - Y * mCellHeight);
+            addRow(Y, wrapY(int(Y * mCellHeight) - mShiftY - 1));
+            removeRow(Y, wrapY(int(Y * mCellHeight + rows - 1) - mShiftY));
+        }
+        mShiftY++;
+        mShiftX = mMinShiftX;
+        initializeColumns();
+        return true;
+    }
+    return false;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+GridLayer ShiftedGridLayers::layer() const
+{
+    return GridLayer(mBackgroundColor, mCellWidth, mCellHeight, mWidth, mHeight, mCellColors, mColumnCounts);
+}
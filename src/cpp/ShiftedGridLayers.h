@@ -0,0 +1,90 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+#ifndef SHIFTED_GRID_LAYERS_H
+#define SHIFTED_GRID_LAYERS_H
+
+#include <cstdint>
+#include <vector>
+
+#include "Array2D.h"
+#include "ColorMask.h"
+#include "GridLayer.h"
+
+//
+// Walks the grid layers of an image at every shift in a range, row by row, as GridLayer would build them from
+// shiftImage(image, shiftX, shiftY) but without materialising any shifted image.
+//
+// Each cell row keeps the colors of every image column within its rows, and each cell keeps the number of
+// those columns that contain each color. Advancing the shift by one pixel only adds the row or column that
+// enters each window and removes the one that leaves it.
+//
+class ShiftedGridLayers
+{
+public:
+    ShiftedGridLayers(uint8_t backgroundColor, size_t cellWidth, size_t cellHeight, const Image2D& image,
+                      int minShiftX, int maxShiftX, int minShiftY, int maxShiftY);
+
+    int shiftX() const;
+    int shiftY() const;
+
+    //
+    // Advance to the next shift, with x varying fastest. Returns false after the last shift.
+    //
+    bool next();
+
+    size_t colorsPerCellSum() const;
+
+    //
+    // Grid layer at the current shift
+    //
+    GridLayer layer() const;
+
+private:
+    void initializeRows();
+    void initializeColumns();
+    void addRow(size_t cellY, size_t imageY);
+    void removeRow(size_t cellY, size_t imageY);
+    void addColumn(size_t cellX, size_t cellY, size_t imageX);
+    void removeColumn(size_t cellX, size_t cellY, size_t imageX);
+    size_t wrapX(int x) const;
+    size_t wrapY(int y) const;
+
+    const Image2D& mImage;
+    uint8_t mBackgroundColor;
+    size_t mCellWidth;
+    size_t mCellHeight;
+    size_t mWidth;
+    size_t mHeight;
+    int mMinShiftX;
+    int mMaxShiftX;
+    int mMaxShiftY;
+    int mShiftX;
+    int mShiftY;
+    size_t mColorsPerCellSum;
+    // Image rows within each cell row that contain each color, indexed by (cellY * image width + imageX) * 64 + color
+    std::vector<uint8_t> mRowCounts;
+    std::vector<ColorMask> mColumnColors;
+    // Image columns within each cell that contain each color, indexed by (cellY * width + cellX) * 64 + color
+    std::vector<uint8_t> mColumnCounts;
+    std::vector<ColorMask> mCellColors;
+};
+
+#endif // SHIFTED_GRID_LAYERS_H
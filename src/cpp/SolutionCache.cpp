@@ -0,0 +1,363 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <vector>
+#include <filesystem>
+
+#include "SolutionCache.h"
+
+const char* SolutionCache::FileHeader = "OverlayPalSolution 1";
+const char* SolutionCache::FileExtension = ".sol";
+
+//---------------------------------------------------------------------------------------------------------------------
+
+SolutionCache::SolutionCache():
+    mMaxSize(64 * 1024 * 1024),
+    mRequireOptimal(false)
+{
+
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void SolutionCache::setPath(const std::string& path)
+{
+    mPath = path;
+    if(!mPath.empty())
+    {
+        std::error_code errorCode;
+        std::filesystem::create_directories(mPath, errorCode);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+const std::string& SolutionCache::path() const
+{
+    return mPath;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void SolutionCache::setMaxSize(uintmax_t maxSize)
+{
+    mMaxSize = maxSize;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+uintmax_t SolutionCache::maxSize() const
+{
+    return mMaxSize;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void SolutionCache::setRequireOptimal(bool requireOptimal)
+{
+    mRequireOptimal = requireOptimal;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool SolutionCache::requireOptimal() const
+{
+    return mRequireOptimal;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::string SolutionCache::key(const SolverProblem& problem, int timeBudget, const std::string& backendName, int portfolioSize)
+{
+    // 64-bit FNV-1a hash over all problem data, with each value added as 32 bits
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    auto add = [&hash](int64_t value)
+    {
+        for(int i = 0; i < 4; i++)
+        {
+            hash ^= uint8_t(value >> (8 * i));
+            hash *= 0x100000001b3ULL;
+        }
+    };
+    const GridLayer& layer = problem.layer;
+    add(int(problem.pass));
+    add(int(layer.width()));
+    add(int(layer.height()));
+    add(int(layer.cellWidth()));
+    add(int(layer.cellHeight()));
+    add(layer.backgroundColor());
+    add(problem.gridCellColorLimit);
+    add(problem.numPalettes);
+    add(problem.maxSpritePalettes);
+    add(problem.maxRowSize);
+    add(timeBudget);
+    add(problem.paletteIndexOffset);
+    add(int(problem.formulation));
+    add(portfolioSize);
+    for(char c : backendName)
+    {
+        add(c);
+    }
+    for(int y = 0; y < int(layer.height()); y++)
+    {
+        for(int x = 0; x < int(layer.width()); x++)
+        {
+            const ColorMask cellColors = layer.cellColors(x, y);
+            add(colorCount(cellColors));
+            for(uint8_t c : ColorMaskRange(cellColors))
+            {
+                add(c);
+                add(layer.columnCount(x, y, c));
+            }
+        }
+    }
+    std::stringstream ss;
+    ss << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return ss.str();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::string SolutionCache::filename(const std::string& key) const
+{
+    return mPath + "/" + key + FileExtension;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static bool readColors(std::istream& is, Colors& colors)
+{
+    int numColors = 0;
+    if(!(is >> numColors) || numColors < 0 || numColors > 256)
+        return false;
+    for(int i = 0; i < numColors; i++)
+    {
+        int c = 0;
+        if(!(is >> c) || c < 0 || c > 255)
+            return false;
+        colors.insert(uint8_t(c));
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static bool readCellColors(std::istream& is, ColorMask allowedColors, ColorMask& colors)
+{
+    int numColors = 0;
+    if(!(is >> numColors) || numColors < 0 || numColors > 64)
+        return false;
+    for(int i = 0; i < numColors; i++)
+    {
+        int c = 0;
+        if(!(is >> c) || c < 0 || c > 63 || (allowedColors & colorBit(uint8_t(c))) == 0)
+            return false;
+        colors |= colorBit(uint8_t(c));
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static void writeColors(std::ostream& os, const Colors& colors)
+{
+    os << colors.size();
+    for(uint8_t c : colors)
+    {
+        os << " " << int(c);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static void writeCellColors(std::ostream& os, ColorMask colors)
+{
+    os << colorCount(colors);
+    for(uint8_t c : ColorMaskRange(colors))
+    {
+        os << " " << int(c);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool SolutionCache::load(const std::string& key, const SolverProblem& problem, SolverSolution& solution) const
+{
+    if(mPath.empty())
+        return false;
+    const std::string cacheFilename = filename(key);
+    std::ifstream f(cacheFilename);
+    if(!f.is_open())
+        return false;
+    std::string header;
+    std::getline(f, header);
+    if(header != FileHeader)
+        return false;
+    const GridLayer& layer = problem.layer;
+    SolverSolution cached;
+    initialiseSolution(problem, cached);
+    int optimal = 0;
+    int numPalettes = 0;
+    if(!(f >> optimal >> numPalettes) || numPalettes < 0 || numPalettes > problem.numPalettes)
+        return false;
+    if(mRequireOptimal && !optimal)
+        return false;
+    cached.optimal = optimal != 0;
+    cached.palettes.resize(numPalettes);
+    for(Colors& palette : cached.palettes)
+    {
+        if(!readColors(f, palette))
+            return false;
+    }
+    int width = 0;
+    int height = 0;
+    if(!(f >> width >> height) || width != int(layer.width()) || height != int(layer.height()))
+        return false;
+    // Colors are checked against the problem layer, to reject corrupt files and hash collisions
+    for(int y = 0; y < height; y++)
+    {
+        for(int x = 0; x < width; x++)
+        {
+            const ColorMask cellColors = layer.cellColors(x, y);
+            int paletteIndex = 0;
+            if(!(f >> paletteIndex) || paletteIndex < 0 || paletteIndex > 255)
+                return false;
+            cached.paletteIndices(x, y) = uint8_t(paletteIndex);
+            // Empty cells are not assigned a palette, so their index is not checked
+            if(cellColors == 0)
+                continue;
+            const int palette = paletteIndex - problem.paletteIndexOffset;
+            if(palette < 0 || palette >= problem.numPalettes)
+                return false;
+            ColorMask gridColors = 0;
+            ColorMask movedColors = 0;
+            if(!readCellColors(f, cellColors, gridColors) || !readCellColors(f, cellColors, movedColors))
+                return false;
+            // Trailing empty palettes are not stored, so cells using them keep no grid colors
+            const ColorMask paletteColors = palette < numPalettes ? colorMask(cached.palettes[palette]) : 0;
+            if((gridColors & ~paletteColors) != 0 || (gridColors | movedColors) != cellColors)
+                return false;
+            cached.layerGrid.setCellColors(x, y, gridColors);
+            cached.layerMoved.setCellColors(x, y, movedColors);
+        }
+    }
+    solution = std::move(cached);
+    // Mark the entry as recently used for eviction
+    std::error_code errorCode;
+    std::filesystem::last_write_time(cacheFilename, std::filesystem::file_time_type::clock::now(), errorCode);
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void SolutionCache::store(const std::string& key, const SolverSolution& solution) const
+{
+    if(mPath.empty())
+        return;
+    // Write to a temporary file first, so that an interrupted write never leaves a truncated entry
+    const std::string cacheFilename = filename(key);
+    const std::string tmpFilename = cacheFilename + ".tmp";
+    {
+        std::ofstream f(tmpFilename);
+        if(!f.is_open())
+            return;
+        f << FileHeader << "\n";
+        f << (solution.optimal ? 1 : 0) << " " << solution.palettes.size() << "\n";
+        for(const Colors& palette : solution.palettes)
+        {
+            writeColors(f, palette);
+            f << "\n";
+        }
+        const GridLayer& layerGrid = solution.layerGrid;
+        f << layerGrid.width() << " " << layerGrid.height() << "\n";
+        for(size_t y = 0; y < layerGrid.height(); y++)
+        {
+            for(size_t x = 0; x < layerGrid.width(); x++)
+            {
+                const ColorMask gridColors = layerGrid.cellColors(x, y);
+                const ColorMask movedColors = solution.layerMoved.cellColors(x, y);
+                f << int(solution.paletteIndices(x, y));
+                if(gridColors != 0 || movedColors != 0)
+                {
+                    f << " ";
+                    writeCellColors(f, gridColors);
+                    f << " ";
+                    writeCellColors(f, movedColors);
+                }
+                f << "\n";
+            }
+        }
+        if(!f.good())
+            return;
+    }
+    std::error_code errorCode;
+    std::filesystem::rename(tmpFilename, cacheFilename, errorCode);
+    if(errorCode)
+    {
+        std::filesystem::remove(tmpFilename, errorCode);
+        return;
+    }
+    evict();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void SolutionCache::evict() const
+{
+    struct Entry
+    {
+        std::filesystem::path path;
+        std::filesystem::file_time_type time;
+        uintmax_t size;
+    };
+    std::vector<Entry> entries;
+    uintmax_t totalSize = 0;
+    std::error_code errorCode;
+    for(const auto& directoryEntry : std::filesystem::directory_iterator(mPath, errorCode))
+    {
+        if(directoryEntry.path().extension() != FileExtension)
+            continue;
+        Entry entry;
+        entry.path = directoryEntry.path();
+        entry.time = directoryEntry.last_write_time(errorCode);
+        entry.size = directoryEntry.file_size(errorCode);
+        if(errorCode)
+            continue;
+        totalSize += entry.size;
+        entries.push_back(entry);
+    }
+    if(totalSize <= mMaxSize)
+        return;
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b)
+    {
+        return a.time < b.time;
+    });
+    for(const Entry& entry : entries)
+    {
+        if(totalSize <= mMaxSize)
+            break;
+        if(std::filesystem::remove(entry.path, errorCode))
+        {
+            totalSize -= entry.size;
+        }
+    }
+}
@@ -0,0 +1,85 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef SOLUTION_CACHE_H
+#define SOLUTION_CACHE_H
+
+#include <cstdint>
+#include <string>
+
+#include "SolverBackend.h"
+
+//
+// On-disk cache of pass solutions, so that converting the same image with the same settings
+// again does not need to run the solver.
+//
+// Each solution is stored in its own file, named after a hash of the pass layer and all parameters
+// that affect the solution. Files are evicted in least-recently-used order when the total size
+// of the cache exceeds the size limit.
+//
+// Failing to read or write the cache is never an error: the pass is then simply solved again.
+//
+class SolutionCache
+{
+public:
+    SolutionCache();
+
+    //
+    // Directory to keep cached solutions in. An empty path disables the cache.
+    //
+    void setPath(const std::string& path);
+    const std::string& path() const;
+
+    void setMaxSize(uintmax_t maxSize);
+    uintmax_t maxSize() const;
+
+    //
+    // Only use cached solutions that were proven optimal.
+    // Non-optimal solutions are still stored, as the setting may change later.
+    //
+    void setRequireOptimal(bool requireOptimal);
+    bool requireOptimal() const;
+
+    //
+    // Cache key of a problem solved by the named backend within a conversion time budget.
+    // The budget is used instead of the time limit of the problem, which depends on how long earlier passes took.
+    //
+    static std::string key(const SolverProblem& problem, int timeBudget, const std::string& backendName, int portfolioSize);
+
+    //
+    // Read the cached solution for a key. Returns false on a cache miss.
+    //
+    bool load(const std::string& key, const SolverProblem& problem, SolverSolution& solution) const;
+
+    void store(const std::string& key, const SolverSolution& solution) const;
+
+protected:
+    std::string filename(const std::string& key) const;
+
+    void evict() const;
+
+private:
+    std::string mPath;
+    uintmax_t mMaxSize;
+    bool mRequireOptimal;
+    static const char* FileHeader;
+    static const char* FileExtension;
+};
+
+#endif // SOLUTION_CACHE_H
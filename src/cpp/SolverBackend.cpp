@@ -0,0 +1,252 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "CmplSolverBackend.h"
+#include "CbcLpSolverBackend.h"
+#include "CbcSolverBackend.h"
+#include "PortfolioSolverBackend.h"
+#include "BranchAndBoundSolverBackend.h"
+#include "SubProcess.h"
+
+#include "SolverBackend.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+
+SolverBackend::SolverBackend():
+    mCancelFlag(nullptr)
+{
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+SolverBackend::~SolverBackend()
+{
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void SolverBackend::setExecutablePath(const std::string& executablePath)
+{
+    mExecutablePath = executablePath;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void SolverBackend::setWorkPath(const std::string& workPath)
+{
+    mWorkPath = workPath;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::string SolverBackend::exePathFilename(const std::string& exeFilename) const
+{
+    return mExecutablePath + "/" + exeFilename;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::string SolverBackend::workPathFilename(const std::string& workFilename) const
+{
+    return mWorkPath + "/" + workFilename;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void SolverBackend::setCancelFlag(const std::atomic<bool>* cancelFlag)
+{
+    mCancelFlag = cancelFlag;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool SolverBackend::cancelled() const
+{
+    return mCancelFlag && mCancelFlag->load();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void SolverBackend::setIncumbentCallback(const IncumbentCallback& incumbentCallback)
+{
+    mIncumbentCallback = incumbentCallback;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void SolverBackend::reportIncumbent(const std::vector<Colors>& palettes) const
+{
+    if(mIncumbentCallback)
+    {
+        mIncumbentCallback(palettes);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int SolverBackend::runProcess(const std::string& exeFilename, const std::vector<std::string>& params, int timeOut) const
+{
+    try
+    {
+        return executeProcess(exeFilename, params, timeOut, mWorkPath, mCancelFlag);
+    }
+    catch(const ProcessCancelled&)
+    {
+        throw Cancelled();
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void initialiseSolution(const SolverProblem& problem, SolverSolution& solution)
+{
+    const GridLayer& layer = problem.layer;
+    solution.palettes.clear();
+    solution.layerGrid = GridLayer(layer.backgroundColor(), layer.cellWidth(), layer.cellHeight(), layer.width(), layer.height());
+    solution.layerMoved = GridLayer(layer.backgroundColor(), layer.cellWidth(), layer.cellHeight(), layer.width(), layer.height());
+    solution.paletteIndices = Array2D<uint8_t>(layer.width(), layer.height());
+    solution.optimal = false;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void SolverSolution::setCellClassColor(const CellClass& cellClass, uint8_t color, bool moved)
+{
+    GridLayer& layer = moved ? layerMoved : layerGrid;
+    for(const auto& cell : cellClass.cells)
+    {
+        layer.addCellColor(cell.first, cell.second, color);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void SolverSolution::setCellClassPalette(const CellClass& cellClass, uint8_t paletteIndex)
+{
+    for(const auto& cell : cellClass.cells)
+    {
+        paletteIndices(cell.first, cell.second) = paletteIndex;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+SolverSolution solutionFromAssignment(const SolverProblem& problem, const CellAssignment& assignment)
+{
+    SolverSolution solution;
+    initialiseSolution(problem, solution);
+    solution.palettes = assignment.palettes;
+    // Trailing empty palettes are left out, as when decoding solver output
+    while(!solution.palettes.empty() && solution.palettes.back().empty())
+    {
+        solution.palettes.pop_back();
+    }
+    for(size_t k = 0; k < problem.cellClasses.size(); k++)
+    {
+        const CellClass& cellClass = problem.cellClasses[k];
+        for(uint8_t c : cellClass.colors)
+        {
+            solution.setCellClassColor(cellClass, c, assignment.grid[k].count(c) == 0);
+        }
+        solution.setCellClassPalette(cellClass, assignment.palette[k] + problem.paletteIndexOffset);
+    }
+    return solution;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int solutionObjective(const SolverProblem& problem, const SolverSolution& solution)
+{
+    int objective = 0;
+    for(size_t y = 0; y < solution.layerMoved.height(); y++)
+    {
+        for(size_t x = 0; x < solution.layerMoved.width(); x++)
+        {
+            for(uint8_t c : ColorMaskRange(solution.layerMoved.cellColors(x, y)))
+            {
+                objective += problem.layer.columnCount(x, y, c);
+            }
+        }
+    }
+    return objective;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::vector<std::string> solverBackendNames()
+{
+    std::vector<std::string> names;
+#ifdef OVERLAYPAL_LINK_CBC
+    names.push_back(CbcSolverBackend::Name);
+#endif
+    names.push_back(CmplSolverBackend::Name);
+    names.push_back(CbcLpSolverBackend::Name);
+    names.push_back(BranchAndBoundSolverBackend::Name);
+    return names;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::string defaultSolverBackendName()
+{
+    // Backends are listed in order of preference
+    return solverBackendNames().front();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::unique_ptr<SolverBackend> createSolverBackend(const std::string& name, int portfolioSize)
+{
+    // The branch-and-bound search runs its instances as threads sharing one search tree
+    if(name == BranchAndBoundSolverBackend::Name)
+    {
+        return std::make_unique<BranchAndBoundSolverBackend>(portfolioSize);
+    }
+    if(portfolioSize > 1)
+    {
+        return std::make_unique<PortfolioSolverBackend>(name, portfolioSize);
+    }
+#ifdef OVERLAYPAL_LINK_CBC
+    if(name == CbcSolverBackend::Name)
+    {
+        return std::make_unique<CbcSolverBackend>();
+    }
+#endif
+    if(name == CmplSolverBackend::Name)
+    {
+        return std::make_unique<CmplSolverBackend>();
+    }
+    if(name == CbcLpSolverBackend::Name)
+    {
+        return std::make_unique<CbcLpSolverBackend>();
+    }
+    throw SolverBackend::Error(std::string("Unknown solver backend '") + name + "'");
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::unique_ptr<SolverBackend> createConcurrentSolverBackend(const std::string& name)
+{
+#ifdef OVERLAYPAL_LINK_CBC
+    if(name == CbcSolverBackend::Name)
+    {
+        return std::make_unique<CbcLpSolverBackend>();
+    }
+#endif
+    return createSolverBackend(name);
+}
@@ -0,0 +1,242 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef SOLVER_BACKEND_H
+#define SOLVER_BACKEND_H
+
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+#include <stdexcept>
+
+#include "GridLayer.h"
+#include "Array2D.h"
+
+//
+// Which of the two optimisation passes a problem describes.
+//
+// First:  Split image colors into background (colorsBG) and overlay (colorsOverlay)
+// Second: Split overlay colors into grid-aligned sprites (colorsOverlayGrid) and free sprites (colorsOverlayFree)
+//
+enum class SolverPass
+{
+    First,
+    Second
+};
+
+//
+// MIP formulation of a FirstPass / SecondPass problem
+//
+// Assignment:   Palette contents and cell palettes are decided together (PassModel)
+// PaletteCover: Cells choose between enumerated candidate palettes (PaletteCoverModel)
+// Automatic:    PaletteCover when there are few enough candidate palettes, Assignment otherwise
+//
+enum class Formulation
+{
+    Assignment,
+    PaletteCover,
+    Automatic
+};
+
+//
+// Set of non-empty grid cells that are solved for as a single model cell
+//
+struct CellClass
+{
+    Colors colors;
+    // Column count of each color, summed over all member cells
+    std::unordered_map<uint8_t, int> columnCount;
+    // Grid positions (x, y) of member cells
+    std::vector<std::pair<int, int>> cells;
+};
+
+//
+// Decisions for each cell class of a problem, as produced by heuristics
+//
+struct CellAssignment
+{
+    std::vector<Colors> palettes;
+    // Colors kept in the grid by each cell class. Remaining colors are moved.
+    std::vector<Colors> grid;
+    // Palette used by each cell class
+    std::vector<int> palette;
+
+    bool empty() const
+    {
+        return grid.empty();
+    }
+};
+
+//
+// Input data for a single optimisation pass
+//
+struct SolverProblem
+{
+    SolverPass pass;
+    GridLayer layer;
+    int gridCellColorLimit;
+    int numPalettes;
+    int maxSpritePalettes;
+    int maxRowSize;
+    int timeOut;
+    uint8_t paletteIndexOffset;
+    // Extra CBC parameters as (name, value) pairs, e.g. ("randomCbcSeed", "7")
+    std::vector<std::pair<std::string, std::string>> solverOptions;
+    // Add constraints that remove equivalent permutations of palettes from the search
+    bool symmetryBreaking = true;
+    // Formulation built by MIP-based backends. Backends running CMPL models always use Assignment.
+    Formulation formulation = Formulation::Assignment;
+    // Cells to create model variables for, as built by Presolve. Cells of the layer not in any class are left out.
+    std::vector<CellClass> cellClasses;
+    // Per-row usage of the row size limit by cells left out of the model
+    std::vector<int> rowReserved;
+    // Feasible assignment to start the search from (MIP start). Left empty when there is none.
+    CellAssignment start;
+    // Objective value no solution can go below. Backends may stop searching once an incumbent reaches it.
+    int objectiveLowerBound = 0;
+};
+
+//
+// Output data from a single optimisation pass
+//
+struct SolverSolution
+{
+    std::vector<Colors> palettes;
+    // Colors kept in palette-mapped grid cells (colorsBG / colorsOverlayGrid)
+    GridLayer layerGrid;
+    // Colors moved out of the grid (colorsOverlay / colorsOverlayFree)
+    GridLayer layerMoved;
+    Array2D<uint8_t> paletteIndices;
+    bool optimal;
+
+    //
+    // Set a color / palette decided for a cell class on all of its member cells
+    //
+    void setCellClassColor(const CellClass& cellClass, uint8_t color, bool moved);
+    void setCellClassPalette(const CellClass& cellClass, uint8_t paletteIndex);
+};
+
+//
+// Interface for solving the FirstPass / SecondPass models
+//
+class SolverBackend
+{
+public:
+
+    class Error: public std::runtime_error
+    {
+    public:
+        Error(const std::string& description):
+            std::runtime_error(description)
+        {}
+    };
+
+    class Cancelled: public Error
+    {
+    public:
+        Cancelled():
+            Error("Conversion cancelled")
+        {}
+    };
+
+    SolverBackend();
+    virtual ~SolverBackend();
+
+    virtual std::string name() const = 0;
+
+    virtual void solve(const SolverProblem& problem, SolverSolution& solution) = 0;
+
+    void setExecutablePath(const std::string& executablePath);
+    void setWorkPath(const std::string& workPath);
+
+    std::string exePathFilename(const std::string& exeFilename) const;
+    std::string workPathFilename(const std::string& workFilename) const;
+
+    //
+    // Flag polled while solving. Once it is set from another thread, solve() stops as soon as
+    // possible and throws Cancelled. A null flag (the default) disables cancelling.
+    //
+    void setCancelFlag(const std::atomic<bool>* cancelFlag);
+    bool cancelled() const;
+
+    //
+    // Called from the solving threads with the palettes of each new incumbent found while solving.
+    // Multi-threaded backends may call it concurrently, and not in order of improving objective.
+    // Backends that only see the final solution of a solver process never call it.
+    //
+    using IncumbentCallback = std::function<void(const std::vector<Colors>& palettes)>;
+    void setIncumbentCallback(const IncumbentCallback& incumbentCallback);
+
+protected:
+    void reportIncumbent(const std::vector<Colors>& palettes) const;
+
+    //
+    // Run a solver program from the work path, killing it when cancelled or when it overruns the time out
+    //
+    int runProcess(const std::string& exeFilename, const std::vector<std::string>& params, int timeOut) const;
+
+    std::string mExecutablePath;
+    std::string mWorkPath;
+    const std::atomic<bool>* mCancelFlag;
+    IncumbentCallback mIncumbentCallback;
+};
+
+//
+// Reset a solution to empty layers of the same size as the problem layer
+//
+void initialiseSolution(const SolverProblem& problem, SolverSolution& solution);
+
+//
+// Solution with the decisions of a cell assignment applied to all member cells
+//
+SolverSolution solutionFromAssignment(const SolverProblem& problem, const CellAssignment& assignment);
+
+//
+// Objective value of a solution, i.e. the number of pixel columns moved out of the grid
+//
+int solutionObjective(const SolverProblem& problem, const SolverSolution& solution);
+
+//
+// Names of all backends available in this build
+//
+std::vector<std::string> solverBackendNames();
+
+//
+// Name of the backend used when none has been explicitly selected
+//
+std::string defaultSolverBackendName();
+
+//
+// Create a backend from its name.
+// A portfolioSize above 1 runs that many differently configured instances of the backend in parallel.
+//
+std::unique_ptr<SolverBackend> createSolverBackend(const std::string& name, int portfolioSize = 1);
+
+//
+// Create a single backend instance that may solve at the same time as other instances in this process.
+// The linked-in CBC driver keeps global state and is not reentrant, so cbc is replaced by cbc-lp,
+// which runs the same solver in a separate process.
+//
+std::unique_ptr<SolverBackend> createConcurrentSolverBackend(const std::string& name);
+
+#endif // SOLVER_BACKEND_H
@@ -15,43 +15,71 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 //
+#include <cassert>
+
 #include "Sprite.h"
 
 //---------------------------------------------------------------------------------------------------------------------
 
-Sprite extractSprite(Image2D& image,
+ColorMask spriteColors(const Array2DView<const uint8_t>& pixels, ColorMask paletteColors)
+{
+    ColorMask colors = 0;
+    for(size_t y = 0; y < pixels.height(); y++)
+    {
+        const uint8_t* row = pixels.row(y);
+        for(size_t x = 0; x < pixels.width(); x++)
+        {
+            colors |= colorBit(row[x]);
+        }
+    }
+    return colors & paletteColors;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+Sprite extractSprite(const Array2DView<const uint8_t>& pixels,
                      size_t xPos,
                      size_t yPos,
                      size_t width,
                      size_t height,
                      const std::set<uint8_t>& colors,
                      uint8_t backgroundColor,
-                     bool removePixels)
+                     std::pmr::memory_resource* resource)
 {
-    Sprite s;
-    s.pixels = Image2D(width, height);
-    s.x = xPos;
-    s.y = yPos;
-    for(size_t y = 0; y < height; y++)
+    assert(pixels.width() <= width && pixels.height() <= height);
+    Sprite s{int(xPos), int(yPos), 0, {}, Image2D(width, height, backgroundColor, resource), 0, 0};
+    const ColorMask paletteColors = colorMask(colors);
+    ColorMask usedColors = 0;
+    for(size_t y = 0; y < pixels.height(); y++)
     {
-        for(size_t x = 0; x < width; x++)
+        for(size_t x = 0; x < pixels.width(); x++)
         {
-            uint8_t c = image(xPos + x, yPos + y);
-            bool insideImage = xPos + x < image.width() && yPos + y < image.height();
-            if(colors.count(c) > 0 && insideImage)
+            uint8_t c = pixels(x, y);
+            if((paletteColors & colorBit(c)) != 0)
             {
                 s.pixels(x, y) = c;
-                s.colors.insert(c);
-                if(removePixels)
-                {
-                    image(xPos + x, yPos + y) = backgroundColor;
-                }
+                usedColors |= colorBit(c);
             }
-            else
+        }
+    }
+    s.colors = maskColors(usedColors);
+    return s;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void removeSpritePixels(const Array2DView<uint8_t>& pixels, const std::set<uint8_t>& colors, uint8_t backgroundColor)
+{
+    const ColorMask paletteColors = colorMask(colors);
+    for(size_t y = 0; y < pixels.height(); y++)
+    {
+        uint8_t* row = pixels.row(y);
+        for(size_t x = 0; x < pixels.width(); x++)
+        {
+            if((paletteColors & colorBit(row[x])) != 0)
             {
-                s.pixels(x, y) = backgroundColor;
+                row[x] = backgroundColor;
             }
         }
     }
-    return s;
 }
@@ -21,6 +21,8 @@
 #include <set>
 
 #include "Array2D.h"
+#include "Array2DView.h"
+#include "ColorMask.h"
 
 struct Sprite
 {
@@ -33,13 +35,28 @@ struct Sprite
     int numBlankPixelsRight;
 };
 
-Sprite extractSprite(Image2D& image,
+//
+// Colors of the pixels within a view that are also in a palette
+//
+ColorMask spriteColors(const Array2DView<const uint8_t>& pixels, ColorMask paletteColors);
+
+//
+// Copy the pixels with palette colors from a view at (xPos, yPos) into a new width x height sprite,
+// with its pixels allocated from resource.
+// The view may be clipped by the image edge, leaving the remaining sprite pixels as background.
+//
+Sprite extractSprite(const Array2DView<const uint8_t>& pixels,
                      size_t xPos,
                      size_t yPos,
                      size_t width,
                      size_t height,
                      const std::set<uint8_t>& colors,
                      uint8_t backgroundColor,
-                     bool removePixels);
+                     std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+//
+// Replace the pixels with palette colors within a view by the background color
+//
+void removeSpritePixels(const Array2DView<uint8_t>& pixels, const std::set<uint8_t>& colors, uint8_t backgroundColor);
 
 #endif // SPRITE_H
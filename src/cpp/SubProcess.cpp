@@ -19,18 +19,47 @@
 #include <stdexcept>
 #include <string>
 #include <vector>
+#include <chrono>
+#include <thread>
 
 #ifdef _WIN32
 #define NOMINMAX
 #include <windows.h>
 #else
 #include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #endif
 
 #include "SubProcess.h"
 
+// Interval for checking the cancel flag while waiting on a process
+static const std::chrono::milliseconds PollInterval(10);
+
+//---------------------------------------------------------------------------------------------------------------------
+
+//
+// Point in time after which a process is killed, or time_point::max() for no limit.
+// Solvers stop searching by themselves after timeOut seconds, and get the same time again plus
+// a fixed margin to generate their model and write their solution.
+//
+static std::chrono::steady_clock::time_point processDeadline(int timeOut)
+{
+    if(timeOut <= 0)
+        return std::chrono::steady_clock::time_point::max();
+    const std::chrono::seconds ExtraTime(10);
+    return std::chrono::steady_clock::now() + 2 * std::chrono::seconds(timeOut) + ExtraTime;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static bool cancelled(const std::atomic<bool>* cancelFlag)
+{
+    return cancelFlag && cancelFlag->load();
+}
+
 #ifdef _WIN32
 
 std::string quoteStringOnWindows(const std::string& s)
@@ -54,7 +83,8 @@ std::wstring mergedParams(std::vector<std::string>& params)
 int executeProcess(std::string exeFilename,
                    std::vector<std::string> params,
                    int timeOut,
-                   std::string startingDirectory)
+                   std::string startingDirectory,
+                   const std::atomic<bool>* cancelFlag)
 {
     // Create structures
     STARTUPINFO si;
@@ -69,28 +99,58 @@ int executeProcess(std::string exeFilename,
     std::wstring paramsW = mergedParams(params);
     // Attempt to execute
     std::wstring startingDirectoryW(startingDirectory.begin(), startingDirectory.end());
+    // Run the process in a job, so that any processes it starts itself (e.g. CMPL running CBC) are killed with it
+    HANDLE job = CreateJobObject(nullptr, nullptr);
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION jobLimits;
+    ZeroMemory( &jobLimits, sizeof(jobLimits) );
+    jobLimits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+    SetInformationJobObject(job, JobObjectExtendedLimitInformation, &jobLimits, sizeof(jobLimits));
 
     if( CreateProcessW( exeFilenameW.c_str(),
                         &paramsW[0],
                         nullptr,                    // Don't inherit process handle
                         nullptr,                    // Don't inherit thread handle
                         0,                          // Handle inheritance off
-                        0,                          // Flags
+                        CREATE_SUSPENDED,           // Flags
                         nullptr,                    // Parent environment block
                         startingDirectoryW.c_str(), // Parent starting directory
                         &si,
                         &pi ))
     {
-        // Wait until process is finished - but no longer than 10x timeOut value
-        // Or a ridiculously long time if timeOut is 0 (=disabled)
-        int timeOutMs = timeOut ? 1000 * timeOut : 200000000;
-        uint32_t eventType = WaitForSingleObject(pi.hProcess, 10 * timeOutMs);
-        if(eventType == WAIT_OBJECT_0)
+        AssignProcessToJobObject(job, pi.hProcess);
+        ResumeThread(pi.hThread);
+        // Wait until process is finished, the deadline has passed, or the process is cancelled
+        const auto deadline = processDeadline(timeOut);
+        bool finished = false;
+        while(!cancelled(cancelFlag) && std::chrono::steady_clock::now() < deadline)
+        {
+            if(WaitForSingleObject(pi.hProcess, DWORD(PollInterval.count())) == WAIT_OBJECT_0)
+            {
+                finished = true;
+                break;
+            }
+        }
+        DWORD exitCode = 0xFFFFFFFF;
+        if(finished)
         {
-            DWORD exitCode = 0xFFFFFFFF;
             GetExitCodeProcess(pi.hProcess, &exitCode);
+        }
+        else
+        {
+            TerminateJobObject(job, exitCode);
+            WaitForSingleObject(pi.hProcess, INFINITE);
+        }
+        CloseHandle(pi.hThread);
+        CloseHandle(pi.hProcess);
+        CloseHandle(job);
+        if(finished)
+        {
             return int(exitCode);
         }
+        else if(cancelled(cancelFlag))
+        {
+            throw ProcessCancelled();
+        }
         else
         {
             throw std::runtime_error("Waited too long on process.");
@@ -99,6 +159,7 @@ int executeProcess(std::string exeFilename,
     else
     {
         // Process invocation failed
+        CloseHandle(job);
         throw std::runtime_error("Failed to invoke process");
     }
 }
@@ -121,16 +182,51 @@ std::vector<char*> splitParams(std::vector<std::string>& params)
     return charPtrs;
 }
 
+//
+// Send a signal to the process group of a forked process, which includes any processes it started itself
+//
+static void signalProcessGroup(pid_t pid, int signal)
+{
+    kill(-pid, signal);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+//
+// Wait for a process to exit until the given point in time.
+// Returns true and sets status when the process has exited.
+//
+static bool waitForProcess(pid_t pid, std::chrono::steady_clock::time_point until, const std::atomic<bool>* cancelFlag, int& status)
+{
+    while(true)
+    {
+        pid_t result = waitpid(pid, &status, WNOHANG);
+        if(result == pid)
+            return true;
+        if(result == -1 && errno != EINTR)
+        {
+            throw std::runtime_error("waitpid() failed in executeProcess");
+        }
+        if(cancelled(cancelFlag) || std::chrono::steady_clock::now() >= until)
+            return false;
+        std::this_thread::sleep_for(PollInterval);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
 int executeProcess(std::string exeFilename,
                    std::vector<std::string> params,
                    int timeOut,
-                   std::string startingDirectory)
+                   std::string startingDirectory,
+                   const std::atomic<bool>* cancelFlag)
 {
     // Split space-separated parameters into individual asciiz strings to create argv
     std::vector<char*> ptrs = splitParams(params);
     char* exeFilenameP = exeFilename.data();
     ptrs.insert(ptrs.begin(), 1, exeFilenameP);
     char** argv = ptrs.data();
+    const auto deadline = processDeadline(timeOut);
     // Fork new process for execv call
     pid_t pid = fork();
     if(pid == -1)
@@ -139,15 +235,35 @@ int executeProcess(std::string exeFilename,
     }
     else if(pid == 0)
     {
-        // Run program in forked process - new process also terminates here
+        // Run program in forked process - new process also terminates here.
+        // Its own process group lets it be killed together with any processes it starts.
+        setpgid(0, 0);
         execv(exeFilename.c_str(), argv);
+        _exit(127);
     }
     else
     {
+        // Also set the process group from the parent, so that it is in place before any signal is sent
+        setpgid(pid, pid);
         // Wait for forked process to finish
-        int exitCode = -1;
-        waitpid(pid, &exitCode, 0);
-        return exitCode;
+        int status = 0;
+        if(waitForProcess(pid, deadline, cancelFlag, status))
+        {
+            return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+        }
+        // Ask the process to exit, and kill it if it has not done so after a grace period
+        const std::chrono::seconds KillGracePeriod(2);
+        signalProcessGroup(pid, SIGTERM);
+        if(!waitForProcess(pid, std::chrono::steady_clock::now() + KillGracePeriod, nullptr, status))
+        {
+            signalProcessGroup(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+        }
+        if(cancelled(cancelFlag))
+        {
+            throw ProcessCancelled();
+        }
+        throw std::runtime_error("Waited too long on process.");
     }
 }
 #endif
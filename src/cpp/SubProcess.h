@@ -21,8 +21,34 @@
 #define SUB_PROCESS_H
 
 #include <string>
+#include <vector>
+#include <atomic>
+#include <stdexcept>
 
-int executeProcess(std::string exeFilename, std::vector<std::string> params, int timeOut, std::string startingDirectory);
+//
+// Thrown by executeProcess when the process was stopped because its cancel flag was set
+//
+class ProcessCancelled: public std::runtime_error
+{
+public:
+    ProcessCancelled():
+        std::runtime_error("Process cancelled")
+    {}
+};
+
+//
+// Run a program and wait for it to exit, returning its exit code.
+//
+// The program is expected to stop by itself after timeOut seconds (0 = no limit). It is given the same
+// time again to finish up before it is killed and a std::runtime_error is thrown.
+// Setting cancelFlag from another thread kills the program and throws ProcessCancelled.
+// On GNU/Linux and MacOS, programs are asked to exit with SIGTERM before being sent SIGKILL.
+//
+int executeProcess(std::string exeFilename,
+                   std::vector<std::string> params,
+                   int timeOut,
+                   std::string startingDirectory,
+                   const std::atomic<bool>* cancelFlag = nullptr);
 
 std::string quoteStringOnWindows(const std::string& s);
 
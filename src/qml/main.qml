@@ -112,6 +112,10 @@ Window {
         }
         onShiftXChanged: xShiftSpinBox.value = shiftX
         onShiftYChanged: yShiftSpinBox.value = shiftY
+        onOptimalShiftFound: {
+            shiftAutoOptimalButton.enabled = true;
+            shiftAutoOptimalButton.text = qsTr("Autodetect optimal");
+        }
         onInputImageChanged: {
             var img = Qt.resolvedUrl(optimiser.inputImageData());
             srcImageCanvas.paletteGroupImages[0] = img;
@@ -177,6 +181,18 @@ Window {
             exportBankSizeComboBox.enabled = true;
         }
 
+        onProvisionalOutputImageChanged: {
+            // Show the best result so far while the conversion keeps running
+            dstImageGroupBox.title = "Conversion running... (provisional result)";
+            for(var i = 0; i < dstImageCanvas.showPaletteGroup.length; i++)
+            {
+                var img = Qt.resolvedUrl(optimiser.outputImageDataRGBA(1 << i, true));
+                dstImageCanvas.paletteGroupImages[i] = img;
+            }
+            dstImageCanvas.backdropImage = Qt.resolvedUrl(optimiser.outputImageDataRGBA(0x00, false));
+            dstImageCanvas.requestPaint();
+        }
+
         function startImageConversionWrapper()
         {
             // Disable optimisation input controls while running
@@ -576,6 +592,10 @@ Window {
                     anchors.bottomMargin: 14
                     anchors.right: parent.right
                     anchors.rightMargin: 0
+                    onClicked: {
+                        shiftAutoOptimalButton.enabled = false;
+                        shiftAutoOptimalButton.text = qsTr("Searching...");
+                    }
                     Component.onCompleted: {
                         shiftAutoOptimalButton.onClicked.connect(optimiser.findOptimalShift);
                     }
@@ -585,14 +605,15 @@ Window {
             GroupBox {
                 id: optimisationSettingsGroupBox
                 width: 270
-                height: 200
+                height: 290
                 title: qsTr("Optimization settings")
 
                 GridLayout {
                     x: 10
                     y: 5
-                    rows: 3
+                    rows: 8
                     columns: 2
+                    rowSpacing: 0
 
                     Label {
                         id: maxBackgroundPalettesLabel
@@ -601,6 +622,7 @@ Window {
 
                     SpinBox {
                         id: maxBackgroundPalettesSpinBox
+                        Layout.preferredHeight: 30
                         to: 4
                         value: 4
                         onValueChanged: {
@@ -615,6 +637,7 @@ Window {
 
                     SpinBox {
                         id: maxSpritePalettesSpinBox
+                        Layout.preferredHeight: 30
                         to: 4
                         value: 4
                         onValueChanged: {
@@ -629,12 +652,73 @@ Window {
 
                     SpinBox {
                         id: maxSpritesPerScanlineSpinBox
+                        Layout.preferredHeight: 30
                         to: 8
                         value: 8
                         onValueChanged: {
                             optimiser.maxSpritesPerScanline = maxSpritesPerScanlineSpinBox.value
                         }
                     }
+
+                    Label {
+                        id: solverBackendLabel
+                        text: qsTr("Solver")
+                    }
+
+                    ComboBox {
+                        id: solverBackendComboBox
+                        model: optimiser.solverBackendNames()
+                        Layout.preferredHeight: 30
+                        onCurrentValueChanged: {
+                            optimiser.solverBackend = currentValue
+                        }
+                    }
+
+                    Label {
+                        id: portfolioSizeLabel
+                        text: qsTr("Parallel")
+                    }
+
+                    SpinBox {
+                        id: portfolioSizeSpinBox
+                        Layout.preferredHeight: 30
+                        from: 1
+                        to: optimiser.maxPortfolioSize()
+                        value: 1
+                        onValueChanged: {
+                            optimiser.portfolioSize = portfolioSizeSpinBox.value
+                        }
+                    }
+
+                    CheckBox {
+                        id: pipelinedCheckBox
+                        text: qsTr("Overlap solver passes")
+                        Layout.columnSpan: 2
+                        Layout.preferredHeight: 30
+                        leftPadding: 0
+                        checked: false
+                        onCheckStateChanged: optimiser.pipelined = checked
+                    }
+
+                    CheckBox {
+                        id: cacheOnlyOptimalCheckBox
+                        text: qsTr("Reuse optimal results only")
+                        Layout.columnSpan: 2
+                        Layout.preferredHeight: 30
+                        leftPadding: 0
+                        checked: false
+                        onCheckStateChanged: optimiser.cacheOnlyOptimal = checked
+                    }
+
+                    CheckBox {
+                        id: showProvisionalResultsCheckBox
+                        text: qsTr("Show intermediate results")
+                        Layout.columnSpan: 2
+                        Layout.preferredHeight: 30
+                        leftPadding: 0
+                        checked: true
+                        onCheckStateChanged: optimiser.showProvisionalResults = checked
+                    }
                 }
             }
 
@@ -970,6 +1054,9 @@ Window {
                                 maxBackgroundPalettesSpinBox.valueModified.connect(optimiser.startImageConversionWrapper);
                                 maxSpritePalettesSpinBox.valueModified.connect(optimiser.startImageConversionWrapper);
                                 maxSpritesPerScanlineSpinBox.valueModified.connect(optimiser.startImageConversionWrapper);
+                                solverBackendComboBox.currentValueChanged.connect(optimiser.startImageConversionWrapper);
+                                portfolioSizeSpinBox.valueModified.connect(optimiser.startImageConversionWrapper);
+                                pipelinedCheckBox.toggled.connect(optimiser.startImageConversionWrapper);
                                 optimiser.shiftXChanged.connect(optimiser.startImageConversionWrapper);
                                 optimiser.shiftYChanged.connect(optimiser.startImageConversionWrapper);
                                 optimiser.inputImageChanged.connect(optimiser.startImageConversionWrapper);
@@ -986,6 +1073,9 @@ Window {
                                 maxBackgroundPalettesSpinBox.valueModified.disconnect(optimiser.startImageConversionWrapper);
                                 maxSpritePalettesSpinBox.valueModified.disconnect(optimiser.startImageConversionWrapper);
                                 maxSpritesPerScanlineSpinBox.valueModified.disconnect(optimiser.startImageConversionWrapper);
+                                solverBackendComboBox.currentValueChanged.disconnect(optimiser.startImageConversionWrapper);
+                                portfolioSizeSpinBox.valueModified.disconnect(optimiser.startImageConversionWrapper);
+                                pipelinedCheckBox.toggled.disconnect(optimiser.startImageConversionWrapper);
                                 optimiser.shiftXChanged.disconnect(optimiser.startImageConversionWrapper);
                                 optimiser.shiftYChanged.disconnect(optimiser.startImageConversionWrapper);
                                 optimiser.inputImageChanged.disconnect(optimiser.startImageConversionWrapper);